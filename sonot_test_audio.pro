@@ -0,0 +1,26 @@
+#-------------------------------------------------
+#
+# Project created by QtCreator 2016-09-01T23:30:32
+#
+#-------------------------------------------------
+
+QT       += testlib multimedia
+
+TARGET = SonotAudioTest
+CONFIG   += console c++11
+CONFIG   -= app_bundle
+
+TEMPLATE = app
+
+
+INCLUDEPATH += ./src
+
+include(src/core.pri)
+include(src/audio.pri)
+include(src/QProps.pri)
+
+SOURCES += test/SonotAudioTest.cpp
+# always check for heap use on the audio path
+DEFINES += SONOT_ALLOCATION_GUARD
+
+DEFINES += SRCDIR=\\\"$$PWD/\\\"
@@ -2,9 +2,38 @@ HEADERS += \
     $$PWD/audio/Synth.h \
     $$PWD/audio/SamplePlayer.h \
     $$PWD/audio/SynthDevice.h \
-    $$PWD/audio/EnvelopeGenerator.h
+    $$PWD/audio/EnvelopeGenerator.h \
+    $$PWD/audio/SynthVoiceBank.h \
+    $$PWD/audio/Oscillator.h \
+    $$PWD/audio/SynthEventQueue.h \
+    $$PWD/audio/SynthVoiceAllocator.h \
+    $$PWD/audio/SpscQueue.h \
+    $$PWD/audio/SpscRing.h \
+    $$PWD/audio/AllocationGuard.h \
+    $$PWD/audio/SynthWorkerPool.h \
+    $$PWD/audio/SynthControl.h \
+    $$PWD/audio/DenormalGuard.h \
+    $$PWD/audio/SynthLoad.h \
+    $$PWD/audio/SynthVoicePack.h \
+    $$PWD/audio/SynthSequencer.h \
+    $$PWD/audio/SynthTimeline.h \
+    $$PWD/audio/SynthRenderer.h \
+    $$PWD/audio/SynthSettings.h \
+    $$PWD/audio/WavWriter.h
 
 SOURCES += \
     $$PWD/audio/Synth.cpp \
     $$PWD/audio/SamplePlayer.cpp \
-    $$PWD/audio/SynthDevice.cpp
+    $$PWD/audio/SynthDevice.cpp \
+    $$PWD/audio/Oscillator.cpp \
+    $$PWD/audio/AllocationGuard.cpp \
+    $$PWD/audio/SynthWorkerPool.cpp \
+    $$PWD/audio/SynthVoicePack.cpp \
+    $$PWD/audio/SynthSequencer.cpp \
+    $$PWD/audio/SynthTimeline.cpp \
+    $$PWD/audio/SynthRenderer.cpp \
+    $$PWD/audio/SynthSettings.cpp \
+    $$PWD/audio/WavWriter.cpp
+
+# count heap use on the audio path, see AllocationGuard.h
+CONFIG(debug, debug|release): DEFINES += SONOT_ALLOCATION_GUARD
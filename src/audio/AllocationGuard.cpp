@@ -0,0 +1,104 @@
+/***************************************************************************
+
+Copyright (C) 2016  stefan.berke @ modular-audio-graphics.com
+
+This source is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either
+version 3.0 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this software; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+****************************************************************************/
+
+#include "AllocationGuard.h"
+
+#ifdef SONOT_ALLOCATION_GUARD
+
+#include <cstdlib>
+#include <new>
+
+namespace Sonot {
+
+namespace {
+
+    thread_local int guardDepth = 0;
+    thread_local size_t guardViolations = 0;
+
+} // namespace
+
+AllocationGuard::AllocationGuard() { ++guardDepth; }
+AllocationGuard::~AllocationGuard() { --guardDepth; }
+
+AllocationGuard::Exception::Exception()
+    : p_depth   (guardDepth)
+{
+    guardDepth = 0;
+}
+
+AllocationGuard::Exception::~Exception() { guardDepth = p_depth; }
+
+size_t AllocationGuard::violations() { return guardViolations; }
+void AllocationGuard::resetViolations() { guardViolations = 0; }
+
+void AllocationGuard::onHeapCall()
+{
+    if (guardDepth > 0)
+        ++guardViolations;
+}
+
+} // namespace Sonot
+
+
+// ---------------- replaced global operators -----------------
+
+void* operator new(std::size_t size)
+{
+    Sonot::AllocationGuard::onHeapCall();
+    if (void* p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size)
+{
+    Sonot::AllocationGuard::onHeapCall();
+    if (void* p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+    if (!p)
+        return;
+    Sonot::AllocationGuard::onHeapCall();
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    if (!p)
+        return;
+    Sonot::AllocationGuard::onHeapCall();
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    ::operator delete(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept
+{
+    ::operator delete[](p);
+}
+
+#endif // SONOT_ALLOCATION_GUARD
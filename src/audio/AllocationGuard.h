@@ -0,0 +1,94 @@
+/***************************************************************************
+
+Copyright (C) 2016  stefan.berke @ modular-audio-graphics.com
+
+This source is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either
+version 3.0 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this software; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+****************************************************************************/
+
+#ifndef SONOTSRC_ALLOCATIONGUARD_H
+#define SONOTSRC_ALLOCATIONGUARD_H
+
+#include <cstddef>
+
+namespace Sonot {
+
+/** Debug helper that detects heap use on the real-time audio path.
+
+    When compiled with @c SONOT_ALLOCATION_GUARD defined, the global
+    operator new and delete count every call that happens on a thread
+    while an AllocationGuard is alive on that thread. The unit tests
+    check violations() after running the audio code.
+    Without the define, all of this compiles to nothing.
+
+    @code
+    {
+        AllocationGuard guard;
+        // code that must not allocate
+    }
+    @endcode */
+class AllocationGuard
+{
+public:
+
+#ifdef SONOT_ALLOCATION_GUARD
+
+    AllocationGuard();
+    ~AllocationGuard();
+
+    /** Lifts all guards of the current thread for the lifetime
+        of the object, for code that is allowed to allocate */
+    class Exception
+    {
+    public:
+        Exception();
+        ~Exception();
+    private:
+        int p_depth;
+    };
+
+    static bool isEnabled() { return true; }
+
+    /** Number of heap calls inside guards on the current thread */
+    static size_t violations();
+    static void resetViolations();
+
+    /** Called by the replaced operators */
+    static void onHeapCall();
+
+#else
+
+    AllocationGuard() { }
+
+    class Exception
+    {
+    public:
+        Exception() { }
+    };
+
+    static bool isEnabled() { return false; }
+    static size_t violations() { return 0; }
+    static void resetViolations() { }
+
+#endif
+
+private:
+    AllocationGuard(const AllocationGuard&) = delete;
+    void operator=(const AllocationGuard&) = delete;
+};
+
+} // namespace Sonot
+
+#endif // SONOTSRC_ALLOCATIONGUARD_H
@@ -0,0 +1,58 @@
+/***************************************************************************
+
+Copyright (C) 2016  stefan.berke @ modular-audio-graphics.com
+
+This source is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either
+version 3.0 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this software; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+****************************************************************************/
+
+#ifndef SONOTSRC_DENORMALGUARD_H
+#define SONOTSRC_DENORMALGUARD_H
+
+#if defined(__SSE__) || defined(_M_X64)
+#   include <xmmintrin.h>
+#   define SONOT_HAVE_MXCSR
+#endif
+
+namespace Sonot {
+
+/** Flushes denormal numbers to zero (FTZ and DAZ) on the current
+    thread for the lifetime of the object, and restores the previous
+    mode afterwards.
+
+    Decaying envelopes and feedback paths otherwise run into the
+    denormal range, where each operation can cost a hundred cycles.
+    Does nothing on platforms without an SSE control register. */
+class DenormalGuard
+{
+public:
+#ifdef SONOT_HAVE_MXCSR
+    DenormalGuard() : p_csr(_mm_getcsr())
+        // flush-to-zero (bit 15) and denormals-are-zero (bit 6)
+        { _mm_setcsr(p_csr | 0x8040); }
+    ~DenormalGuard() { _mm_setcsr(p_csr); }
+private:
+    unsigned int p_csr;
+#else
+    DenormalGuard() { }
+#endif
+
+    DenormalGuard(const DenormalGuard&) = delete;
+    void operator = (const DenormalGuard&) = delete;
+};
+
+} // namespace Sonot
+
+#endif // SONOTSRC_DENORMALGUARD_H
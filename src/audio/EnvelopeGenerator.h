@@ -21,6 +21,10 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 #ifndef SONOTSRC_ENVELOPEGENERATOR_H
 #define SONOTSRC_ENVELOPEGENERATOR_H
 
+#include <algorithm>
+#include <climits>
+#include <cmath>
+
 namespace Sonot {
 
 enum EnvelopeState
@@ -39,7 +43,7 @@ public:
 
     // ----------- getter ------------
 
-    int sampleRate() const { return sr_; }
+    F sampleRate() const { return sr_; }
 
     /** Returns true when envelope was triggered and has not
         elapsed the release state. */
@@ -64,23 +68,27 @@ public:
 
     // ----------- setter ------------
 
-    void setSampleRate(int sr) { sr_ = sr; calcCoeffs_(); }
+    /** Sets the rate at which next() is called, in Hertz.
+        May be fractional, e.g. the sampling rate divided
+        by a control rate. */
+    void setSampleRate(F sr) { sr_ = sr; calcCoeffs_(); segDirty_ = true; }
 
-    void setAttack(F v) { attack_ = v; attack_c_ = F(8) / std::max(F(8), attack_ * sr_); }
-    void setDecay(F v) { decay_ = v; decay_c_ = F(8) / std::max(F(8), decay_ * sr_); }
-    void setSustain(F v) { sustain_ = v; }
-    void setRelease(F v) { release_ = v; release_c_ = F(8) / std::max(F(8), release_ * sr_); }
+    void setAttack(F v) { attack_ = v; attack_c_ = F(8) / std::max(F(8), attack_ * sr_); segDirty_ = true; }
+    void setDecay(F v) { decay_ = v; decay_c_ = F(8) / std::max(F(8), decay_ * sr_); segDirty_ = true; }
+    void setSustain(F v) { sustain_ = v; segDirty_ = true; }
+    void setRelease(F v) { release_ = v; release_c_ = F(8) / std::max(F(8), release_ * sr_); segDirty_ = true; }
 
     /** Sets the envelope generator to a particular state. */
-    void setState(EnvelopeState s) { state_ = s; }
+    void setState(EnvelopeState s) { state_ = s; segDirty_ = true; }
 
     // -------- processing -----------
 
     /** Starts the envelope generator */
-    void trigger(F init_value = F(0)) { active_ = true; state_ = ENV_ATTACK; value_ = init_value; }
+    void trigger(F init_value = F(0))
+        { active_ = true; state_ = ENV_ATTACK; value_ = init_value; segDirty_ = true; }
 
     /** Stops the envelope generator */
-    void stop() { active_ = false; value_ = F(0); }
+    void stop() { active_ = false; value_ = F(0); segDirty_ = true; }
 
     /** Forwards the envelop by one sample and returns the value */
     F next();
@@ -89,26 +97,58 @@ public:
         @p stride is the number of samples to forward in @p output for each sample. */
     void process(F * output, int blockSize, int stride = 1);
 
+    /** Forwards the envelope by up to @p count samples and writes the
+        values into @p output, like calling next() @p count times.
+        Returns early, after the sample at which the envelope became
+        inactive, and returns the number of samples written.
+
+        Each attack, decay and release segment is rendered in closed form,
+        <tt>target + (start - target) * (1 - c)^n</tt>, from a power series
+        of the multiplier. The state is only checked in the few samples
+        around the predicted end of the segment. The result is independent
+        of @p count and matches next() within rounding. */
+    int processBlock(F * output, int count);
+
     // __________ PRIVATE ____________
 
 private:
 
     void calcCoeffs_();
 
+    /** Starts the closed form of the current segment at value_ */
+    void startSegment_();
+    /** Renders @p num samples of the current segment without state checks */
+    void renderSegment_(F * output, int num);
+    /** Renders one sample of the current segment and changes the state
+        at it's end, like next() */
+    F stepSegment_();
+
     EnvelopeState state_;
 
-    bool active_;
+    bool active_,
+    /** The closed form needs to be restarted in processBlock() */
+         segDirty_;
 
-    int sr_;
+    /** Samples since start of the segment, and the number of samples
+        which can be rendered without checking for the end of the segment */
+    int segPos_,
+        segSafe_;
 
-    F value_,
+    F sr_,
+      value_,
       attack_,
       decay_,
       sustain_,
       release_,
       attack_c_,
       decay_c_,
-      release_c_;
+      release_c_,
+    /** Value the segment converges to */
+      segTarget_,
+    /** (start - target) * mul^n at the last multiple of 8 samples */
+      segBase_,
+    /** Powers mul^0 to mul^8 of the segment's multiplier */
+      segPow_[9];
 
 };
 
@@ -119,6 +159,9 @@ template <typename F>
 EnvelopeGenerator<F>::EnvelopeGenerator()
     : state_    (ENV_ATTACK),
       active_   (false),
+      segDirty_ (true),
+      segPos_   (0),
+      segSafe_  (0),
       sr_       (44100),
       value_    (0.0),
       attack_   (0.05),
@@ -144,6 +187,8 @@ F EnvelopeGenerator<F>::next()
     if (!active_)
         return F(0);
 
+    segDirty_ = true;
+
     switch (state_)
     {
         case ENV_ATTACK:
@@ -184,8 +229,157 @@ F EnvelopeGenerator<F>::next()
 template <typename F>
 void EnvelopeGenerator<F>::process(F * output, int count, int stride)
 {
-    for (int i=0; i<count; ++i, output += stride)
-        *output = next();
+    if (stride != 1)
+    {
+        for (int i=0; i<count; ++i, output += stride)
+            *output = next();
+        return;
+    }
+
+    for (int i = processBlock(output, count); i<count; ++i)
+        output[i] = F(0);
+}
+
+template <typename F>
+int EnvelopeGenerator<F>::processBlock(F * output, int count)
+{
+    int i = 0;
+    while (i < count)
+    {
+        if (!active_)
+        {
+            output[i] = F(0);
+            return i + 1;
+        }
+
+        if (state_ == ENV_SUSTAIN)
+        {
+            for (; i<count; ++i)
+                output[i] = value_;
+            return i;
+        }
+
+        if (segDirty_)
+            startSegment_();
+
+        // samples that can not reach the end of the segment
+        const int num = std::min(count - i, segSafe_ - segPos_);
+        if (num > 0)
+        {
+            renderSegment_(output + i, num);
+            i += num;
+        }
+
+        if (i < count)
+        {
+            output[i++] = stepSegment_();
+            if (!active_)
+                return i;
+        }
+    }
+    return i;
+}
+
+template <typename F>
+void EnvelopeGenerator<F>::startSegment_()
+{
+    F c, thresh;
+    switch (state_)
+    {
+        case ENV_ATTACK:  segTarget_ = F(1);     c = attack_c_;  thresh = F(0.001); break;
+        case ENV_DECAY:   segTarget_ = sustain_; c = decay_c_;   thresh = F(0.001); break;
+        case ENV_RELEASE: segTarget_ = F(0);     c = release_c_; thresh = F(0.0001); break;
+        default:          segTarget_ = value_;   c = F(0);       thresh = F(0); break;
+    }
+
+    const F mul = F(1) - c;
+    segBase_ = value_ - segTarget_;
+    segPos_ = 0;
+    segPow_[0] = F(1);
+    for (int j=1; j<9; ++j)
+        segPow_[j] = segPow_[j-1] * mul;
+
+    // predicted length of the segment: |start - target| * mul^n < thresh
+    // (attack and release only end when approaching from the right side)
+    segSafe_ = 0;
+    const F d = std::abs(segBase_);
+    if (mul > F(0) && mul < F(1) && d > thresh
+        && (state_ != ENV_ATTACK || segBase_ < F(0))
+        && (state_ != ENV_RELEASE || segBase_ > F(0)))
+    {
+        // leave a few samples for rounding differences
+        const double len = std::log(double(thresh / d)) / std::log(double(mul)) - 3.;
+        segSafe_ = len > 0. ? int(std::min(len, double(INT_MAX / 2))) : 0;
+    }
+
+    segDirty_ = false;
+}
+
+template <typename F>
+void EnvelopeGenerator<F>::renderSegment_(F * output, int num)
+{
+    const F target = segTarget_;
+    while (num > 0)
+    {
+        const int r = segPos_ & 7;
+        if (r == 0 && num >= 8)
+        {
+            // whole groups of 8
+            const F base = segBase_;
+            for (int j=0; j<8; ++j)
+                output[j] = target + base * segPow_[j+1];
+            segBase_ *= segPow_[8];
+            segPos_ += 8;
+            output += 8;
+            num -= 8;
+            continue;
+        }
+
+        const int n = std::min(num, 8 - r);
+        for (int j=0; j<n; ++j)
+            output[j] = target + segBase_ * segPow_[r+1+j];
+        segPos_ += n;
+        if ((segPos_ & 7) == 0)
+            segBase_ *= segPow_[8];
+        output += n;
+        num -= n;
+    }
+    value_ = output[-1];
+}
+
+template <typename F>
+F EnvelopeGenerator<F>::stepSegment_()
+{
+    F v;
+    renderSegment_(&v, 1);
+
+    switch (state_)
+    {
+        case ENV_ATTACK:
+            if (value_ >= F(0.999))
+                setState(ENV_DECAY);
+        break;
+
+        case ENV_DECAY:
+            if (std::abs(value_ - sustain_) < F(0.001))
+            {
+                if (sustain_ > 0)
+                    setState(ENV_SUSTAIN);
+                else
+                    stop();
+            }
+        break;
+
+        case ENV_RELEASE:
+            if (value_ <= 0.0001)
+                stop();
+        break;
+
+        case ENV_SUSTAIN:
+        break;
+    }
+
+    return value_;
 }
 
 
@@ -0,0 +1,287 @@
+/***************************************************************************
+
+Copyright (C) 2016  stefan.berke @ modular-audio-graphics.com
+
+This source is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either
+version 3.0 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this software; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+****************************************************************************/
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+#if defined(__AVX__) || defined(__SSE2__)
+#   include <immintrin.h>
+#endif
+
+#include "Oscillator.h"
+
+namespace Sonot {
+
+namespace {
+
+    /** The period of all waveforms is exactly 1.0, so the
+        wrapped fixed-point phases do not jump */
+    const double kTwoPi = 6.283185307179586476925;
+
+    /** Adding and subtracting this rounds a double to the nearest
+        integer (for |x| < 2^51) without leaving the SSE unit */
+    const double kRoundMagic = 6755399441055744.;
+
+    const size_t kTableSize = 4096;
+
+    const double
+        kC3 = Oscillator::polyC3,
+        kC5 = Oscillator::polyC5,
+        kC7 = Oscillator::polyC7,
+        kC9 = Oscillator::polyC9,
+        kC11 = Oscillator::polyC11;
+
+    typedef std::array<double, kTableSize + 1> SineTable;
+
+    SineTable makeSineTable()
+    {
+        SineTable t;
+        for (size_t i=0; i<=kTableSize; ++i)
+            t[i] = std::sin(double(i) / kTableSize
+                            * 6.283185307179586476925);
+        return t;
+    }
+
+    /** Built at load time, so the first use on the audio thread
+        neither allocates nor waits for a static-init guard */
+    const SineTable sineTable = makeSineTable();
+
+    inline double polyReduced(double x)
+    {
+        // x in [-.5, .5], fold into [-.25, .25]
+        const double a = std::abs(x);
+        if (a > .25)
+            x = (x < 0. ? -.5 : .5) - x;
+
+        const double t = x * 6.283185307179586476925,
+                     t2 = t * t;
+        return t * (1. + t2 * (kC3 + t2 * (kC5 + t2 * (kC7
+                        + t2 * (kC9 + t2 * kC11)))));
+    }
+
+} // namespace
+
+constexpr double Oscillator::polyC3;
+constexpr double Oscillator::polyC5;
+constexpr double Oscillator::polyC7;
+constexpr double Oscillator::polyC9;
+constexpr double Oscillator::polyC11;
+
+
+double Oscillator::maxError(Tier t)
+{
+    switch (t)
+    {
+        case OT_LIBM: return 0.;
+        case OT_TABLE: return 3.5e-7;
+        case OT_POLY:
+        case OT_SIMD: return 1.e-7;
+    }
+    return 0.;
+}
+
+const char* Oscillator::name(Tier t)
+{
+    switch (t)
+    {
+        case OT_LIBM: return "libm";
+        case OT_TABLE: return "table";
+        case OT_POLY: return "poly";
+        case OT_SIMD: return "simd";
+    }
+    return "";
+}
+
+double Oscillator::sample(Tier t, double phase)
+{
+    switch (t)
+    {
+        case OT_LIBM: return sampleLibm(phase);
+        case OT_TABLE: return sampleTable(phase);
+        case OT_POLY:
+        case OT_SIMD: return samplePoly(phase);
+    }
+    return 0.;
+}
+
+void Oscillator::process(Tier t, const double* phase, double* out, size_t num)
+{
+    switch (t)
+    {
+        case OT_LIBM: processLibm(phase, out, num); break;
+        case OT_TABLE: processTable(phase, out, num); break;
+        case OT_POLY: processPoly(phase, out, num); break;
+        case OT_SIMD: processSimd(phase, out, num); break;
+    }
+}
+
+
+double Oscillator::sampleLibm(double phase)
+{
+    return std::sin(phase * kTwoPi);
+}
+
+double Oscillator::sampleTable(double phase)
+{
+    const SineTable& table = sineTable;
+    phase = (phase - std::floor(phase)) * kTableSize;
+    const size_t i = std::min(kTableSize - 1, size_t(phase));
+    const double f = phase - i;
+    return table[i] + f * (table[i+1] - table[i]);
+}
+
+double Oscillator::samplePoly(double phase)
+{
+    return polyReduced(phase - ((phase + kRoundMagic) - kRoundMagic));
+}
+
+
+void Oscillator::processLibm(const double* phase, double* out, size_t num)
+{
+    for (size_t i=0; i<num; ++i)
+        out[i] = sampleLibm(phase[i]);
+}
+
+void Oscillator::processTable(const double* phase, double* out, size_t num)
+{
+    for (size_t i=0; i<num; ++i)
+        out[i] = sampleTable(phase[i]);
+}
+
+void Oscillator::processPoly(const double* phase, double* out, size_t num)
+{
+    for (size_t i=0; i<num; ++i)
+        out[i] = samplePoly(phase[i]);
+}
+
+void Oscillator::processSimd(const double* phase, double* out, size_t num)
+{
+    size_t i = 0;
+
+#if defined(__AVX__)
+    {
+        const __m256d
+            magic = _mm256_set1_pd(kRoundMagic),
+            quarter = _mm256_set1_pd(.25),
+            half = _mm256_set1_pd(.5),
+            signMask = _mm256_set1_pd(-0.),
+            twoPi = _mm256_set1_pd(6.283185307179586476925),
+            one = _mm256_set1_pd(1.),
+            c3 = _mm256_set1_pd(kC3),
+            c5 = _mm256_set1_pd(kC5),
+            c7 = _mm256_set1_pd(kC7),
+            c9 = _mm256_set1_pd(kC9),
+            c11 = _mm256_set1_pd(kC11);
+
+        for (; i + 4 <= num; i += 4)
+        {
+            __m256d x = _mm256_loadu_pd(phase + i);
+            // reduce to [-.5, .5]
+            x = _mm256_sub_pd(x, _mm256_sub_pd(
+                                  _mm256_add_pd(x, magic), magic));
+            // fold into [-.25, .25]
+            const __m256d
+                sign = _mm256_and_pd(x, signMask),
+                a = _mm256_andnot_pd(signMask, x),
+                fold = _mm256_cmp_pd(a, quarter, _CMP_GT_OQ),
+                xf = _mm256_sub_pd(_mm256_or_pd(half, sign), x);
+            x = _mm256_blendv_pd(x, xf, fold);
+            // polynomial
+            const __m256d
+                t = _mm256_mul_pd(x, twoPi),
+                t2 = _mm256_mul_pd(t, t);
+            __m256d p = _mm256_add_pd(c9, _mm256_mul_pd(t2, c11));
+            p = _mm256_add_pd(c7, _mm256_mul_pd(t2, p));
+            p = _mm256_add_pd(c5, _mm256_mul_pd(t2, p));
+            p = _mm256_add_pd(c3, _mm256_mul_pd(t2, p));
+            p = _mm256_add_pd(one, _mm256_mul_pd(t2, p));
+            _mm256_storeu_pd(out + i, _mm256_mul_pd(t, p));
+        }
+    }
+#elif defined(__SSE2__)
+    {
+        const __m128d
+            magic = _mm_set1_pd(kRoundMagic),
+            quarter = _mm_set1_pd(.25),
+            half = _mm_set1_pd(.5),
+            signMask = _mm_set1_pd(-0.),
+            twoPi = _mm_set1_pd(6.283185307179586476925),
+            one = _mm_set1_pd(1.),
+            c3 = _mm_set1_pd(kC3),
+            c5 = _mm_set1_pd(kC5),
+            c7 = _mm_set1_pd(kC7),
+            c9 = _mm_set1_pd(kC9),
+            c11 = _mm_set1_pd(kC11);
+
+        for (; i + 2 <= num; i += 2)
+        {
+            __m128d x = _mm_loadu_pd(phase + i);
+            // reduce to [-.5, .5]
+            x = _mm_sub_pd(x, _mm_sub_pd(_mm_add_pd(x, magic), magic));
+            // fold into [-.25, .25]
+            const __m128d
+                sign = _mm_and_pd(x, signMask),
+                a = _mm_andnot_pd(signMask, x),
+                fold = _mm_cmpgt_pd(a, quarter),
+                xf = _mm_sub_pd(_mm_or_pd(half, sign), x);
+            x = _mm_or_pd(_mm_and_pd(fold, xf), _mm_andnot_pd(fold, x));
+            // polynomial
+            const __m128d
+                t = _mm_mul_pd(x, twoPi),
+                t2 = _mm_mul_pd(t, t);
+            __m128d p = _mm_add_pd(c9, _mm_mul_pd(t2, c11));
+            p = _mm_add_pd(c7, _mm_mul_pd(t2, p));
+            p = _mm_add_pd(c5, _mm_mul_pd(t2, p));
+            p = _mm_add_pd(c3, _mm_mul_pd(t2, p));
+            p = _mm_add_pd(one, _mm_mul_pd(t2, p));
+            _mm_storeu_pd(out + i, _mm_mul_pd(t, p));
+        }
+    }
+#endif
+
+    // remainder (and non-x86 fallback)
+    for (; i<num; ++i)
+        out[i] = samplePoly(phase[i]);
+}
+
+void Oscillator::processFixed(Tier t, const uint64_t* phase, double* out,
+                              size_t num)
+{
+    if (t != OT_TABLE)
+    {
+        for (size_t i=0; i<num; ++i)
+            out[i] = toPeriods(phase[i]);
+        process(t, out, out, num);
+        return;
+    }
+
+    // index from the high bits, interpolate with the next 32 bits
+    const SineTable& table = sineTable;
+    for (size_t i=0; i<num; ++i)
+    {
+        const size_t k = phase[i] >> 52;
+        const double f = double(uint32_t(phase[i] >> 20)) * (1. / 4294967296.);
+        out[i] = table[k] + f * (table[k+1] - table[k]);
+    }
+}
+
+
+} // namespace Sonot
@@ -0,0 +1,127 @@
+/***************************************************************************
+
+Copyright (C) 2016  stefan.berke @ modular-audio-graphics.com
+
+This source is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either
+version 3.0 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this software; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+****************************************************************************/
+
+#ifndef SONOTSRC_OSCILLATOR_H
+#define SONOTSRC_OSCILLATOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+namespace Sonot {
+
+/** Sine oscillator kernels with different speed/accuracy trade-offs.
+
+    All functions calculate <tt>sin(phase * 2 * PI)</tt>, where the
+    phase is given in periods (1.0 is one full cycle).
+    The maximum absolute error against the OT_LIBM tier is returned
+    by maxError() and is verified in the unit tests for phases
+    within +/- 2^20 periods.
+
+    Oscillators keep their phase in 64 bit fixed-point, where 2^64 is
+    one period. The accumulators wrap around naturally, so the
+    precision does not degrade on long notes. */
+class Oscillator
+{
+public:
+
+    enum Tier
+    {
+        /** std::sin() in double precision; the reference */
+        OT_LIBM,
+        /** 4096 point table with linear interpolation */
+        OT_TABLE,
+        /** 11th order polynomial on the folded quarter period */
+        OT_POLY,
+        /** Same as OT_POLY, but processes blocks with SSE2/AVX */
+        OT_SIMD
+    };
+
+    /** Returns the documented maximum absolute error of the tier */
+    static double maxError(Tier t);
+
+    /** Returns the name of the tier */
+    static const char* name(Tier t);
+
+    /** Returns the fastest tier for fixed-point phases,
+        or for phases in periods if @p fixed is false */
+    static Tier fastest(bool fixed) { return fixed ? OT_TABLE : OT_SIMD; }
+
+    /** Returns one sample of the given tier */
+    static double sample(Tier t, double phase);
+
+    /** Writes the waveform of @p num @p phases into @p output.
+        @p phase and @p output may point to the same buffer. */
+    static void process(Tier t, const double* phase, double* output,
+                        size_t num);
+
+    /** Writes the waveform of @p num fixed-point @p phases into @p output.
+        The OT_TABLE tier indexes the table directly from the high bits. */
+    static void processFixed(Tier t, const uint64_t* phase, double* output,
+                             size_t num);
+
+    /** @{ */
+    /** Taylor coefficients of sin(t) of the OT_POLY and OT_SIMD tiers */
+    static constexpr double polyC3 = -1. / 6.;
+    static constexpr double polyC5 = 1. / 120.;
+    static constexpr double polyC7 = -1. / 5040.;
+    static constexpr double polyC9 = 1. / 362880.;
+    static constexpr double polyC11 = -1. / 39916800.;
+    /** @} */
+
+    // --- fixed-point phase ---
+
+    /** Converts a fixed-point phase to periods in [0,1).
+        The high 52 bits become the mantissa of a double in [1,2),
+        which vectorizes better than an integer conversion. */
+    static double toPeriods(uint64_t phase)
+    {
+        const uint64_t bits = (phase >> 12) | 0x3FF0000000000000ull;
+        double d;
+        std::memcpy(&d, &bits, sizeof(d));
+        return d - 1.;
+    }
+
+    /** Converts @p periods to a fixed-point phase, wrapped into [0,1) */
+    static uint64_t toFixed(double periods)
+    {
+        const double f = periods - std::floor(periods);
+        // largest double below 2^64
+        return uint64_t(std::min(f * 18446744073709551616.,
+                                 18446744073709549568.));
+    }
+
+    // --- single tiers ---
+
+    static double sampleLibm(double phase);
+    static double sampleTable(double phase);
+    static double samplePoly(double phase);
+
+    static void processLibm(const double* phase, double* output, size_t num);
+    static void processTable(const double* phase, double* output, size_t num);
+    static void processPoly(const double* phase, double* output, size_t num);
+    static void processSimd(const double* phase, double* output, size_t num);
+};
+
+} // namespace Sonot
+
+#endif // SONOTSRC_OSCILLATOR_H
@@ -0,0 +1,98 @@
+/***************************************************************************
+
+Copyright (C) 2016  stefan.berke @ modular-audio-graphics.com
+
+This source is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either
+version 3.0 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this software; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+****************************************************************************/
+
+#ifndef SONOTSRC_SPSCQUEUE_H
+#define SONOTSRC_SPSCQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+namespace Sonot {
+
+/** Wait-free ring buffer for one producer thread and one consumer thread.
+
+    The capacity is fixed at construction and rounded up to a power
+    of two. push() and pop() never block and never allocate; push()
+    fails if the ring is full, pop() if it is empty.
+    @p T needs to be default-constructible and copy-assignable. */
+template <typename T>
+class SpscQueue
+{
+public:
+
+    explicit SpscQueue(size_t capacity)
+        : p_head    (0)
+        , p_tail    (0)
+    {
+        size_t c = 2;
+        while (c < capacity)
+            c <<= 1;
+        p_slots.resize(c);
+        p_mask = c - 1;
+    }
+
+    size_t capacity() const { return p_slots.size(); }
+
+    /** Approximate number of items, exact on the consumer side */
+    size_t size() const
+    {
+        return p_tail.load(std::memory_order_acquire)
+             - p_head.load(std::memory_order_acquire);
+    }
+
+    bool isEmpty() const { return size() == 0; }
+
+    /** Producer side: appends a copy of @p item.
+        Returns false if the ring is full. */
+    bool push(const T& item)
+    {
+        const size_t tail = p_tail.load(std::memory_order_relaxed);
+        if (tail - p_head.load(std::memory_order_acquire) >= p_slots.size())
+            return false;
+        p_slots[tail & p_mask] = item;
+        p_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /** Consumer side: moves the oldest item into @p item.
+        Returns false if the ring is empty. */
+    bool pop(T& item)
+    {
+        const size_t head = p_head.load(std::memory_order_relaxed);
+        if (head == p_tail.load(std::memory_order_acquire))
+            return false;
+        item = p_slots[head & p_mask];
+        p_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+
+    std::vector<T> p_slots;
+    size_t p_mask;
+    // consumer and producer counters on separate cache lines
+    alignas(64) std::atomic<size_t> p_head;
+    alignas(64) std::atomic<size_t> p_tail;
+};
+
+} // namespace Sonot
+
+#endif // SONOTSRC_SPSCQUEUE_H
@@ -0,0 +1,132 @@
+/***************************************************************************
+
+Copyright (C) 2016  stefan.berke @ modular-audio-graphics.com
+
+This source is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either
+version 3.0 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this software; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+****************************************************************************/
+
+#ifndef SONOTSRC_SPSCRING_H
+#define SONOTSRC_SPSCRING_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+namespace Sonot {
+
+/** Wait-free ring buffer of audio samples for one producer thread
+    and one consumer thread.
+
+    Like SpscQueue, but for blocks of floats: read() and write() copy
+    with at most two memcpy() calls, and the producer can render
+    directly into the ring through writeRegion() and commit().
+    The capacity is rounded up to a power of two. */
+class SpscRing
+{
+public:
+
+    explicit SpscRing(size_t capacity)
+        : p_head    (0)
+        , p_tail    (0)
+    {
+        size_t c = 2;
+        while (c < capacity)
+            c <<= 1;
+        p_data.resize(c);
+        p_mask = c - 1;
+    }
+
+    size_t capacity() const { return p_data.size(); }
+
+    /** Number of samples that can be read,
+        exact on the consumer side */
+    size_t size() const
+    {
+        return p_tail.load(std::memory_order_acquire)
+             - p_head.load(std::memory_order_acquire);
+    }
+
+    /** Number of samples that can be written,
+        exact on the producer side */
+    size_t space() const { return capacity() - size(); }
+
+    bool isEmpty() const { return size() == 0; }
+
+    // ---- producer side ----
+
+    /** Returns the contiguous writable part of the ring,
+        up to the wrap-around, and it's length in @p len */
+    float* writeRegion(size_t* len)
+    {
+        const size_t tail = p_tail.load(std::memory_order_relaxed),
+                     free = capacity()
+                            - (tail - p_head.load(std::memory_order_acquire)),
+                     pos = tail & p_mask;
+        *len = std::min(free, capacity() - pos);
+        return &p_data[pos];
+    }
+
+    /** Publishes @p len samples written to writeRegion() */
+    void commit(size_t len)
+    {
+        p_tail.store(p_tail.load(std::memory_order_relaxed) + len,
+                     std::memory_order_release);
+    }
+
+    /** Appends up to @p len samples, returns the number written */
+    size_t write(const float* src, size_t len)
+    {
+        const size_t tail = p_tail.load(std::memory_order_relaxed);
+        len = std::min(len, capacity()
+                       - (tail - p_head.load(std::memory_order_acquire)));
+        const size_t pos = tail & p_mask,
+                     first = std::min(len, capacity() - pos);
+        std::memcpy(&p_data[pos], src, first * sizeof(float));
+        std::memcpy(&p_data[0], src + first, (len - first) * sizeof(float));
+        p_tail.store(tail + len, std::memory_order_release);
+        return len;
+    }
+
+    // ---- consumer side ----
+
+    /** Moves up to @p len samples into @p dst,
+        returns the number read */
+    size_t read(float* dst, size_t len)
+    {
+        const size_t head = p_head.load(std::memory_order_relaxed);
+        len = std::min(len, p_tail.load(std::memory_order_acquire) - head);
+        const size_t pos = head & p_mask,
+                     first = std::min(len, capacity() - pos);
+        std::memcpy(dst, &p_data[pos], first * sizeof(float));
+        std::memcpy(dst + first, &p_data[0], (len - first) * sizeof(float));
+        p_head.store(head + len, std::memory_order_release);
+        return len;
+    }
+
+private:
+
+    std::vector<float> p_data;
+    size_t p_mask;
+    // consumer and producer counters on separate cache lines
+    alignas(64) std::atomic<size_t> p_head;
+    alignas(64) std::atomic<size_t> p_tail;
+};
+
+} // namespace Sonot
+
+#endif // SONOTSRC_SPSCRING_H
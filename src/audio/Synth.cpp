@@ -18,10 +18,27 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 
 ****************************************************************************/
 
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <random>
+
+#ifdef __SSE__
+#   include <xmmintrin.h>
+#endif
+
 #include "QProps/error.h"
 #include "QProps/JsonInterfaceHelper.h"
 
 #include "Synth.h"
+#include "SynthVoiceBank.h"
+#include "SynthVoicePack.h"
+#include "SynthEventQueue.h"
+#include "SynthVoiceAllocator.h"
+#include "AllocationGuard.h"
+#include "SynthWorkerPool.h"
+#include "SynthControl.h"
+#include "DenormalGuard.h"
 
 #if (0)
 #   define SONOT_DEBUG_SYNTH(arg__) qDebug() << arg__
@@ -32,168 +49,22 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 
 namespace Sonot {
 
-// ------------------------------------ synthvoice private ------------------------------------
-
-class SynthVoice::Private
-{
-    public:
-
-    Private(Synth * synth)
-        : synth     (synth),
-          active	(false),
-          cued      (false),
-          cuedForStop(false),
-          note   	(0),
-          index     (0),
-          startSample(0),
-          stopSample(0),
-          freq		(0.0),
-          velo		(0.0),
-          fenvAmt   (0),
-          lifetime	(0),
-          nextUnison(0),
-          userData  (0),
-          userIndex (-1)
-
-    { }
-
-    double curLevel() const { return velo * env.value(); }
-    double calcSample();
-    double waveform(double p) { return std::sin(p * 3.14159265*2.); }
-
-    Synth * synth;
-
-    bool active, cued, cuedForStop;
-
-    int note;
-    size_t index, startSample, stopSample;
-
-    struct FMVoice
-    {
-        double
-            velo, freqMul, phase,
-            modFreq, modPhase, modAm, modAdd,
-            modSelfFreq, modSelfPhase, modSelfAm,
-            sample;
-        EnvelopeGenerator<double> env;
-    };
-
-    double
-        freq,
-        velo,
-        fenvAmt;
-
-    // per unisono voice
-    std::vector<double>
-        freq_c,
-        phase;
-
-    std::vector<FMVoice> fmVoices;
-
-    size_t lifetime;
-
-    EnvelopeGenerator<double> env;
-
-    SynthVoice * nextUnison;
-
-    void * userData;
-    int64_t userIndex;
-};
-
-
-
-
-// ------------------------------------ synthvoice ------------------------------------
-
-SynthVoice::SynthVoice(Synth * synth)
-    : p_    (new Private(synth))
-{
-}
-
-SynthVoice::~SynthVoice()
-{
-    delete p_;
-}
-
-Synth * SynthVoice::synth() const { return p_->synth; }
-size_t SynthVoice::index() const { return p_->index; }
-bool SynthVoice::active() const { return p_->active; }
-bool SynthVoice::cued() const { return p_->cued; }
-int SynthVoice::note() const { return p_->note; }
-size_t SynthVoice::startSample() const { return p_->startSample; }
-double SynthVoice::frequency() const { return p_->freq; }
-double SynthVoice::phase() const { return p_->phase[0]; }
-double SynthVoice::velocity() const { return p_->velo; }
-double SynthVoice::attack() const { return p_->env.attack(); }
-double SynthVoice::decay() const { return p_->env.decay(); }
-double SynthVoice::sustain() const { return p_->env.sustain(); }
-double SynthVoice::release() const { return p_->env.release(); }
-size_t SynthVoice::numFmVoices() const { return p_->fmVoices.size(); }
-
-const EnvelopeGenerator<double>& SynthVoice::envelope() const { return p_->env; }
-SynthVoice * SynthVoice::nextUnisonVoice() const { return p_->nextUnison; }
-void * SynthVoice::userData() const { return p_->userData; }
-int64_t SynthVoice::userIndex() const { return p_->userIndex; }
-
-void SynthVoice::setUserData(void *data) { p_->userData = data; }
-
-
-double SynthVoice::Private::calcSample()
-{
-    double s = 0.0;
-    if (fmVoices.empty())
-    {
-        // for each combined unisono voice
-        for (size_t j = 0; j<phase.size(); ++j)
-        {
-            // advance phase counter
-            phase[j] += freq_c[j];
+namespace {
 
-            s += waveform(phase[j]);
-        }
-    }
-    else
+    /** output[i] += input[i] */
+    void addBlock(float * output, const float * input, size_t num)
     {
-        double phaseMod = 0.,
-               freqMod = 0.,
-               ampMod = 0.,
-               addMod = 0.;
-        for (FMVoice& fm : fmVoices)
-        {
-            // proc modulator envelope
-            fm.env.next();
-            // modulation from previous stage
-            fm.phase += fm.modSelfFreq * freqMod;
-            freq += fm.modSelfFreq * freqMod;
-            // get modulator's sample
-            fm.phase += freq_c[0] * fm.freqMul;
-            fm.sample = fm.velo * fm.env.value()
-                            * waveform(fm.phase + fm.modSelfPhase * phaseMod);
-            fm.sample += fm.modSelfAm * ampMod
-                            * (fm.sample*ampMod - fm.sample);
-            // add to modulation
-            phaseMod += fm.sample * fm.modPhase;
-            freqMod += fm.sample * fm.modFreq;
-            ampMod += fm.sample * fm.modAm;
-            addMod += fm.sample * fm.modAdd;
-        }
-
-        // for each combined unisono voice
-        for (size_t j = 0; j<phase.size(); ++j)
-        {
-            // advance phase counter
-            phase[j] += freq_c[j] + freqMod;
-
-            double sam = waveform(phase[j] + phaseMod);
-            sam += ampMod * (ampMod*sam - sam);
-            s += sam + addMod;
-        }
+        size_t i = 0;
+#ifdef __SSE__
+        for (; i + 4 <= num; i += 4)
+            _mm_storeu_ps(output + i, _mm_add_ps(_mm_loadu_ps(output + i),
+                                                 _mm_loadu_ps(input + i)));
+#endif
+        for (; i < num; ++i)
+            output[i] += input[i];
     }
-    return s;
-}
-
-
 
+} // namespace
 
 // -------------------------- synth private ------------------------------------
 
@@ -205,72 +76,293 @@ public:
         : p             (s),
           voicePolicy   (Synth::VP_QUITEST),
           sampleRate    (44100),
+          curSample     (0),
           props         ("synth"),
           modPropsDef   ("mod-voice"),
           cbStart_      (0),
-          cbEnd_        (0)
+          cbEnd_        (0),
+          pool          (nullptr),
+          ctlGain       (maxSliceLength()),
+          ctlPitch      (maxSliceLength()),
+          jobSteal      (false),
+          modControlRate(1),
+          packIsa       (SynthVoicePack::ISA_NONE)
     {
-        createProperties();
+        createProperties(props, modPropsDef);
     }
 
     ~Private()
     {
-        deleteVoices();
+        endVoices();
+        delete pool;
     }
 
-    void createProperties();
-
-    void deleteVoices()
+    /** Number of voices that are mixed together in one job item */
+    static constexpr size_t voicesPerChunk() { return 4; }
+    /** Maximum length of one mix job in samples */
+    static constexpr size_t maxSliceLength() { return 256; }
+    static size_t numChunks(size_t numVoices)
+        { return (numVoices + voicesPerChunk() - 1) / voicesPerChunk(); }
+    /** Minimum modulator control rate in SynthLoad::Q_CONTROL_RATE */
+    static constexpr size_t shedControlRate() { return 32; }
+    /** Silence threshold in dB in SynthLoad::Q_STEAL_VOICES */
+    static constexpr double stealLevel() { return -50.; }
+
+    static void createProperties(QProps::Properties& props,
+                                 QProps::Properties& modPropsDef);
+    /** Returns @p modPropsDef as seen by modulator voice @p idx */
+    static QProps::Properties modProperties(
+            const QProps::Properties& modPropsDef, size_t idx);
+    /** Copies props into params, except the modulators */
+    void compileParameters();
+    /** Copies modProps[idx] into params.mods[idx] */
+    void compileModParameters(size_t idx);
+
+    /** Sends the end-callback for all active voices */
+    void endVoices()
     {
-        for (auto v : voices)
-        {
-            if (v->p_->active && p->p_->cbEnd_)
-                p->p_->cbEnd_(v);
-            delete v;
-        }
-        voices.clear();
+        if (!cbEnd_)
+            return;
+        for (size_t i=0; i<bank.numVoices(); ++i)
+            if (bank.active[i])
+                cbEnd_(&voices[i]);
     }
 
     void setNumVoices(size_t n)
     {
-        deleteVoices();
-        voices.resize(n);
+        endVoices();
+        events.clear();
+        // a start and a few stops per voice
+        events.reserve(n * 4 + 16);
+        bank.resize(n);
+        alloc.resize(n);
+        chunkMix.assign(numChunks(n) * maxSliceLength(), 0.f);
+        voiceMix.assign(n * maxSliceLength(), 0.f);
+        packOsc.assign(numChunks(n) * voicesPerChunk() * maxSliceLength(), 0.);
+        voiceEnded.assign(n, 0);
+        endedVoices.clear();
+        endedVoices.reserve(n);
+        voices.clear();
+        voices.reserve(n);
         for (size_t i=0; i<n; ++i)
-        {
-            voices[i] = new SynthVoice(p);
-            voices[i]->p_->index = i;
-        }
+            voices.push_back(SynthVoice(p, i));
     }
 
-    SynthVoice * noteOn(size_t startSample, double freq, int note, double velocity,
+    SynthVoice * noteOn(uint64_t startTime, double freq, int note, double velocity,
             size_t numCombinedUnison, void *userData, int64_t userIndex);
-    void noteOff(size_t stopSample, int note);
-    void noteOffByIndex(size_t stopSample, int64_t idx);
-    void notesOff(size_t stopSample);
+    void noteOff(uint64_t stopTime, int note);
+    void noteOffByIndex(uint64_t stopTime, int64_t idx);
+    void notesOff(uint64_t stopTime);
+    /** Schedules the stop of voice @p i if it's playing at @p stopTime */
+    void cueStop(size_t i, uint64_t stopTime);
     void panic();
+    /** Adds an event for voice @p i to the queue.
+        Drops stale events instead of growing the queue,
+        if possible. */
+    void pushEvent(uint64_t time, size_t i, SynthEventQueue::Type type);
+
+    /** Envelope part of the steal key, later states are reused first */
+    int stealRank(size_t i) const
+        { return bank.active[i] ? -int(bank.env[i].state()) : -int(ENV_ATTACK); }
+    /** Policy part of the steal key, smaller values are reused first */
+    double stealValue(size_t i) const;
+    /** Updates the steal keys of the active voices,
+        or of all used voices if @p all is true.
+        A key only moves in the heap when it changed, which for
+        all but VP_QUITEST and VP_LOUDEST means an envelope state change. */
+    void updateStealKeys(bool all);
+    /** Puts the voice back into the free set */
+    void freeVoice(size_t i);
+
+    /** Executes all events up to and including @p time */
+    void applyEvents(uint64_t time);
+    void startVoice(size_t i);
+    void stopVoice(size_t i);
+    /** Returns the position of the next event relative to @p blockStart,
+        or @p bufferLength if there is none in the block */
+    size_t nextEventPos(uint64_t blockStart, size_t bufferLength) const;
+
     /** Mono output */
     void process(float * output, size_t bufferLength);
     /** Multichannel output */
     void process(float ** output, size_t bufferLength);
+    /** Output mixed by userIndex */
+    void process(float ** buses, size_t numBuses, size_t bufferLength);
+    /** Sets the number of render threads */
+    void setNumThreads(size_t num);
+    /** Calls @p func for each chunk of active voices,
+        in parallel if there is a worker pool */
+    void runChunks(SynthWorkerPool::Func func);
+    /** Renders all active voices mixed into @p output */
+    void renderMix(float * output, size_t length);
+    /** Renders all active voices into their channels at @p pos */
+    void renderChannels(float ** outputs, size_t pos, size_t length);
+    /** Renders all active voices mixed into the bus of
+        their userIndex at @p pos */
+    void renderBuses(float ** buses, size_t numBuses,
+                     size_t pos, size_t length);
+    /** Job items for the worker pool */
+    static void mixChunk(void * self, size_t chunk);
+    static void channelChunk(void * self, size_t chunk);
+    static void voiceChunk(void * self, size_t chunk);
+    /** Frees the voices that ended in the last job,
+        in the order of the active voice list */
+    void retireEndedVoices();
+
+    /** Renders the control factors of the next @p length samples,
+        at most maxSliceLength(), into jobGain and jobPitch */
+    void renderControl(size_t length);
+
+    /** Calculates the oscillators of the active voices [begin, end)
+        of @p chunk for the current job, in voice packs where possible.
+        Returns one buffer of maxSliceLength() per voice, or NULL
+        if no voices can be packed. */
+    const double * renderPack(size_t chunk, size_t begin, size_t end);
+
+    /** Renders @p length samples of the active voice @p i into @p output.
+        @p gain is the master gain per sample, @p pitch the frequency
+        factor per sample or NULL. @p osc are the precalculated
+        oscillator samples from renderPack(), or NULL.
+        If @p accumulate is true, the voice is added to the output.
+        @p output may be NULL to just advance the voice.
+        Returns false when the voice has ended; it is not freed, though.
+        Voices do not share any state here, so different voices can
+        be rendered on different threads. */
+    bool renderVoice(size_t i, float * output, size_t length,
+                     const double * gain, const double * pitch,
+                     bool accumulate, const double * osc = nullptr);
+    /** Returns true if voice @p i can only get quieter and it's peak
+        level in the last block was below jobSilence.
+        With jobSteal, any voice past the attack may be silent. */
+    bool isSilent(size_t i) const;
+    /** Calculates jobSilence for the next process() call */
+    void updateSilence();
+
+    /** Sets up the render state for the current quality step */
+    void applyQuality();
+    /** Feeds the time since @p start to the load control */
+    void updateLoad(std::chrono::steady_clock::time_point start,
+                    size_t bufferLength)
+    {
+        const std::chrono::duration<double> sec =
+                std::chrono::steady_clock::now() - start;
+        if (load.update(sec.count(), bufferLength))
+            applyQuality();
+    }
 
     Synth * p;
 
-    std::vector<SynthVoice*> voices;
+    /** State of all voices */
+    SynthVoiceBank bank;
+    /** Handles into bank */
+    std::vector<SynthVoice> voices;
 
     Synth::VoicePolicy voicePolicy;
 
     size_t sampleRate;
+    /** Absolute time of the next sample to render */
+    uint64_t curSample;
+
+    /** Scheduled voice starts and stops */
+    SynthEventQueue events;
+    /** Free set, lookup indices and steal order of the voices */
+    SynthVoiceAllocator alloc;
 
     QProps::Properties props, modPropsDef;
+    Synth::Parameters params;
     std::vector<QProps::Properties> modProps;
 
     NoteFreq<double> noteFreq;
 
+    /** Source of the unisono detuning. Each Synth starts with
+        the same seed, so renderings are repeatable */
+    std::minstd_rand random;
+
+    /** Control-rate LFO and parameter ramps */
+    SynthControl control;
+
+    /** Adaptive quality control */
+    SynthLoad load;
+
     std::function<void(SynthVoice*)>
         cbStart_, cbEnd_;
+
+    // parallel rendering
+
+    SynthWorkerPool * pool;
+    /** One mix buffer of maxSliceLength() per chunk of voices.
+        The chunks are summed in fixed order, so the output does not
+        depend on the number of threads */
+    std::vector<float> chunkMix;
+    /** One buffer of maxSliceLength() per active voice,
+        for the bus output */
+    std::vector<float> voiceMix;
+    /** Flags set by renderVoice() callers, per voice */
+    std::vector<uint8_t> voiceEnded;
+    std::vector<size_t> endedVoices;
+    /** Control factors of the current slice */
+    std::vector<double> ctlGain, ctlPitch;
+    /** Arguments of the current job */
+    float ** jobOutputs;
+    size_t jobPos, jobLength;
+    const double * jobGain, * jobPitch;
+    /** Absolute level below which fading voices are ended */
+    float jobSilence;
+    /** Also end quiet voices that are not fading */
+    bool jobSteal;
+    /** Control rate of the modulator envelopes */
+    size_t modControlRate;
+    /** Instruction set of the voice packs */
+    SynthVoicePack::Isa packIsa;
+    /** Oscillator samples of renderPack(), one maxSliceLength()
+        per voice of each chunk */
+    std::vector<double> packOsc;
 };
 
 
+// ------------------------------------ synthvoice ------------------------------------
+
+SynthVoice::SynthVoice(Synth * synth, size_t index)
+    : p_synth   (synth),
+      p_index   (index)
+{
+}
+
+#define SONOT__BANK p_synth->p_->bank
+
+Synth * SynthVoice::synth() const { return p_synth; }
+size_t SynthVoice::index() const { return p_index; }
+bool SynthVoice::active() const { return SONOT__BANK.active[p_index]; }
+bool SynthVoice::cued() const { return SONOT__BANK.cued[p_index]; }
+int SynthVoice::note() const { return SONOT__BANK.note[p_index]; }
+uint64_t SynthVoice::startSample() const { return SONOT__BANK.startSample[p_index]; }
+double SynthVoice::frequency() const { return SONOT__BANK.freq[p_index]; }
+double SynthVoice::phase() const
+    { return Oscillator::toPeriods(SONOT__BANK.phaseOf(p_index)[0]); }
+double SynthVoice::velocity() const { return SONOT__BANK.velo[p_index]; }
+double SynthVoice::attack() const { return SONOT__BANK.env[p_index].attack(); }
+double SynthVoice::decay() const { return SONOT__BANK.env[p_index].decay(); }
+double SynthVoice::sustain() const { return SONOT__BANK.env[p_index].sustain(); }
+double SynthVoice::release() const { return SONOT__BANK.env[p_index].release(); }
+size_t SynthVoice::numFmVoices() const { return SONOT__BANK.modStride(); }
+
+const EnvelopeGenerator<double>& SynthVoice::envelope() const
+    { return SONOT__BANK.env[p_index]; }
+SynthVoice * SynthVoice::nextUnisonVoice() const
+{
+    const size_t i = SONOT__BANK.nextUnison[p_index];
+    return i == SynthVoiceBank::invalidIndex() ? nullptr : &p_synth->p_->voices[i];
+}
+void * SynthVoice::userData() const { return SONOT__BANK.userData[p_index]; }
+int64_t SynthVoice::userIndex() const { return SONOT__BANK.userIndex[p_index]; }
+
+void SynthVoice::setUserData(void *data) { SONOT__BANK.userData[p_index] = data; }
+
+#undef SONOT__BANK
+
+
+
+
 QProps::Properties::NamedValues Synth::voicePolicyNamedValues()
 {
     QProps::Properties::NamedValues nv;
@@ -299,8 +391,49 @@ QProps::Properties::NamedValues Synth::voicePolicyNamedValues()
 }
 
 
-void Synth::Private::createProperties()
+QProps::Properties::NamedValues Synth::temperamentNamedValues()
+{
+    QProps::Properties::NamedValues nv;
+    nv.set("ratio", tr("equal / ratio"),
+        tr("Equal temperament, or the chain of fifths given by "
+           "numerator and denominator"),
+           (int)NoteFreq<double>::T_RATIO);
+    nv.set("pythagorean", tr("pythagorean"),
+        tr("Pure fifths, starting on the temperament key"),
+           (int)NoteFreq<double>::T_PYTHAGOREAN);
+    nv.set("meantone", tr("quarter-comma meantone"),
+        tr("Fifths narrowed by a quarter comma for pure major thirds, "
+           "starting on the temperament key"),
+           (int)NoteFreq<double>::T_MEANTONE);
+    return nv;
+}
+
+
+QProps::Properties::NamedValues Synth::oscillatorNamedValues()
+{
+    QProps::Properties::NamedValues nv;
+    nv.set("libm", tr("precise"),
+        tr("Sine waves from the standard library, slow but exact"),
+           (int)Oscillator::OT_LIBM);
+    nv.set("table", tr("table"),
+        tr("Interpolated sine table, error below 3.5e-7"),
+           (int)Oscillator::OT_TABLE);
+    nv.set("poly", tr("polynomial"),
+        tr("Polynomial approximation, error below 1e-7"),
+           (int)Oscillator::OT_POLY);
+    nv.set("simd", tr("vectorized"),
+        tr("Vectorized polynomial approximation, error below 1e-7"),
+           (int)Oscillator::OT_SIMD);
+    return nv;
+}
+
+
+void Synth::Private::createProperties(QProps::Properties& props,
+                                      QProps::Properties& modPropsDef)
 {
+    // tuning defaults
+    const NoteFreq<double> noteFreq;
+
     props.set("number-voices", tr("number voices"),
               tr("The number of polyphonic voices"),
               36);
@@ -311,12 +444,70 @@ void Synth::Private::createProperties()
                  "is reached and a new note-on is requested"),
               voicePolicyNamedValues(), (int)VP_OLDEST);
 
+    props.set("oscillator", tr("oscillator"),
+              tr("Sets the calculation method of the sine oscillators, "
+                 "trading accuracy for speed"),
+              oscillatorNamedValues(), (int)Oscillator::OT_SIMD);
+
+    props.set("number-threads", tr("render threads"),
+              tr("The number of threads that render the voices. "
+                 "The output is the same for any number of threads"),
+              1);
+    props.setRange("number-threads", 1, 64);
+
+    props.set("voice-packs", tr("voice packs"),
+              tr("Calculates voices with the same modulation routes "
+                 "together in the vector units of the processor. "
+                 "The output is the same either way"),
+              true);
+
+    props.set("control-rate", tr("control rate"),
+              tr("The number of samples between two updates of the "
+                 "modulator envelopes, the tremulant and the parameter "
+                 "ramps. 1 updates everything at audio rate"),
+              1);
+    props.setRange("control-rate", 1, 256);
+
     props.set("volume", tr("master volume"),
               tr("Master volume of all played voices"),
               1.);
     props.setMin("volume", 0.);
     props.setStep("volume", 0.01);
 
+    props.set("silence-level", tr("silence threshold"),
+              tr("Voices that fade out are ended as soon as their level "
+                 "falls below this threshold in decibel, relative to "
+                 "the master volume"),
+              -100., -200., 0., 1.);
+
+    props.set("adaptive-quality", tr("adaptive quality"),
+              tr("Lowers the sound quality in steps when rendering "
+                 "gets close to the real-time limit, and raises it "
+                 "again when the load is low"),
+              false);
+
+    props.set("load-limit", tr("load limit"),
+              tr("Fraction of the real-time budget above which "
+                 "the adaptive quality is lowered"),
+              .8, .1, 2., .05);
+
+    props.set("ramp-time", tr("parameter ramp"),
+              tr("Time in seconds for changes of the master volume "
+                 "and the tremulant depths to take effect"),
+              0., 0., 10., 0.01);
+
+    props.set("lfo-freq", tr("tremulant speed"),
+              tr("Frequency of the tremulant/vibrato in Hertz"),
+              6., 0., 100., 0.1);
+
+    props.set("lfo-amp", tr("tremulant depth"),
+              tr("Amount of amplitude modulation of the tremulant"),
+              0., 0., 1., 0.01);
+
+    props.set("lfo-pitch", tr("vibrato depth"),
+              tr("Amount of pitch modulation of the tremulant in cents"),
+              0., 0., 1200., 1.);
+
     props.set("number-unisono-voices", tr("unisono voices"),
               tr("The number of unisono voices that will be played "
                  "for one note"),
@@ -360,6 +551,17 @@ void Synth::Private::createProperties()
               noteFreq.pythagoeanDenom());
     props.setMin("mean-denominator", 0);
 
+    props.set("mean-temperament", tr("temperament"),
+              tr("Historical temperament for twelve notes per octave, "
+                 "replaces the numerator and denominator"),
+              temperamentNamedValues(), (int)NoteFreq<double>::T_RATIO);
+
+    props.set("mean-key", tr("temperament key"),
+              tr("The note on which the chain of fifths of the temperament "
+                 "starts, 0 is C. The default E flat puts the wolf fifth "
+                 "between G sharp and E flat"),
+              3, 0, 11, 1);
+
     props.set("attack", tr("attack"),
               tr("Attack time of envelope in seconds"),
               0.02, 0., 10000., 0.01);
@@ -443,393 +645,720 @@ void Synth::Private::createProperties()
     modPropsDef.setStep("mod-self-pm", 0.01);
 }
 
+QProps::Properties Synth::Private::modProperties(
+        const QProps::Properties& modPropsDef, size_t idx)
+{
+    auto p = modPropsDef;
+    // the first stage has no previous one
+    if (idx == 0)
+    {
+        p.setVisible("mod-self-am", false);
+        p.setVisible("mod-self-fm", false);
+        p.setVisible("mod-self-pm", false);
+    }
+    return p;
+}
+
 
 SynthVoice * Synth::Private::noteOn(
-        size_t startSample, double freq, int note, double velocity,
+        uint64_t startTime, double freq, int note, double velocity,
         size_t numCombinedUnison, void * userData, int64_t userIndex)
 {
     if (voices.empty())
         return 0;
 
     // find free (non-active & non-cued) voice
-    auto i = voices.begin();
-    for (; i!=voices.end(); ++i)
-        if (!(*i)->p_->active && !(*i)->p_->cued) break;
+    size_t i = alloc.takeFree();
 
     // none free?
-    if (i == voices.end())
+    if (i == SynthVoiceAllocator::invalidIndex())
     {
         if (voicePolicy == Synth::VP_FORGET)
             return nullptr;
 
-        SONOT_DEBUG_SYNTH("Synth::noteOn() looking for voice to reuse");
+        // the steal order is kept by the allocator
+        i = alloc.top();
+        alloc.unuse(i);
 
-        i = voices.begin();
+        SONOT_DEBUG_SYNTH("Synth::noteOn(): reusing voice " << i);
+    }
 
-        // policy doesn't matter for monophonic synth
-        if (voices.size()>1)
-        {
-            // decide which to overwrite
-
-            // this macro compares the value__s of each voice
-            // and returns the voice to reuse in 'i'
-            // it also checks for the envelope state and
-            // rather reuses voices that are at a later state
-            #define MO__FIND_VOICE_ENV(value__, operator__)                 \
-            {                                                               \
-                auto j = i;                                                 \
-                auto val1 = (*i)->p_->value__;                              \
-                auto val2 = val1;                                           \
-                ++j;                                                        \
-                for (; j != voices.end(); ++j)                              \
-                {                                                           \
-                    auto val = (*j)->p_->value__;                           \
-                    if (val operator__ val1                                 \
-                        && (*j)->p_->env.state() > (*i)->p_->env.state())   \
-                    {                                                       \
-                        val1 = val;                                         \
-                        i = j;                                              \
-                    }                                                       \
-                    else if (val operator__ val2)                           \
-                    {                                                       \
-                        val2 = val;                                         \
-                        i = j;                                              \
-                    }                                                       \
-                }                                                           \
-            }
+    // (re-)init voice
 
-            // same as above but does not care for envelope states
-            #define MO__FIND_VOICE_NO_ENV(value__, operator__)              \
-            {                                                               \
-                auto j = i;                                                 \
-                auto val1 = (*i)->p_->value__;                              \
-                ++j;                                                        \
-                for (; j != voices.end(); ++j)                              \
-                {                                                           \
-                    auto val = (*j)->p_->value__;                           \
-                    f (val operator__ val1)                                 \
-                    {                                                       \
-                        val1 = val;                                         \
-                        i = j;                                              \
-                    }                                                       \
-                }                                                           \
-            }
+    SONOT_DEBUG_SYNTH("init voice " << i << " f="
+                      << freq << "hz " << " v=" << velocity);
 
-            // XXX place for branching with a yet missing option in Synth
-            #define MO__FIND_VOICE(value__, operator__) \
-                    MO__FIND_VOICE_ENV(value__, operator__)
+    bank.lifetime[i] = 0;
+    bank.peak[i] = 0.f;
+    bank.deactivate(i);
+    bank.cued[i] = true;
+    // invalidate all events of the previous use
+    ++bank.generation[i];
+    bank.note[i] = note;
 
-            switch (voicePolicy)
-            {
-                case Synth::VP_LOWEST:
-                    MO__FIND_VOICE(freq, <);
-                break;
+    bank.freq[i] = freq;
 
-                case Synth::VP_HIGHEST:
-                    MO__FIND_VOICE(freq, >);
-                break;
+    // freq as coefficient
+    const double freqc = freq / sampleRate;
+    bank.reserveUnison(numCombinedUnison);
+    bank.numUnison[i] = numCombinedUnison;
+    uint64_t * ph = bank.phaseOf(i);
+    for (size_t j=0; j<numCombinedUnison; ++j)
+    {
+        bank.setFreqC(i, j, freqc);
+        ph[j] = 0;
+    }
+    bank.velo[i] = velocity;
+    bank.startSample[i] = startTime;
+    bank.stopSample[i] = std::numeric_limits<uint64_t>::max();
+    pushEvent(startTime, i, SynthEventQueue::E_START);
+    EnvelopeGenerator<double>& env = bank.env[i];
+    env.setSampleRate(sampleRate);
+    env.setAttack(params.attack);
+    env.setDecay(params.decay);
+    env.setSustain(params.sustain);
+    env.setRelease(params.release);
+    bank.userData[i] = userData;
+    bank.userIndex[i] = userIndex;
+    bank.nextUnison[i] = SynthVoiceBank::invalidIndex();
+    SynthVoiceBank::FMVoice * fm = bank.fmOf(i);
+    for (size_t j=0; j<bank.modStride(); ++j, ++fm)
+    {
+        const Synth::Parameters::Modulator& m = params.mods[j];
+        fm->env.setSampleRate(double(sampleRate) / modControlRate);
+        fm->setControlRate(modControlRate);
+        fm->env.setAttack(m.attack);
+        fm->env.setDecay(m.decay);
+        fm->env.setSustain(m.sustain);
+        fm->env.setRelease(m.release);
+        fm->freqMul = m.freqMul;
+        fm->modAdd = m.add;
+        fm->modAm = m.am;
+        fm->modFreq = m.fm;
+        fm->modPhase = m.pm;
+        fm->modSelfAm = m.selfAm;
+        fm->modSelfFreq = m.selfFm;
+        fm->modSelfPhase = m.selfPm;
+        fm->phase = 0;
+        fm->velo = velocity * m.amount;
+    }
+    bank.selectKernel(i);
 
-                case Synth::VP_OLDEST:
-                    MO__FIND_VOICE(lifetime, >);
-                break;
+    alloc.use(i, note, userIndex, stealRank(i), stealValue(i));
 
-                case Synth::VP_NEWEST:
-                    MO__FIND_VOICE(lifetime, <);
-                break;
+    return &voices[i];
+}
 
-                case Synth::VP_QUITEST:
-                    MO__FIND_VOICE(curLevel(), <);
-                break;
+void Synth::Private::cueStop(size_t i, uint64_t stopTime)
+{
+    // an earlier stop is already scheduled
+    if (stopTime >= bank.stopSample[i])
+        return;
 
-                case Synth::VP_LOUDEST:
-                    MO__FIND_VOICE(curLevel(), >);
-                break;
+    if (bank.active[i] || (bank.cued[i] && bank.startSample[i] <= stopTime))
+    {
+        bank.stopSample[i] = stopTime;
+        pushEvent(stopTime, i, SynthEventQueue::E_STOP);
+    }
+}
 
-                case Synth::VP_FORGET: break;
-            }
+void Synth::Private::pushEvent(
+        uint64_t time, size_t i, SynthEventQueue::Type type)
+{
+    // remove events of reused voices and stops replaced by an
+    // earlier one, which leaves at most a start and a stop per voice
+    if (events.isFull())
+        events.removeIf([this](const SynthEventQueue::Event& e)
+        {
+            return e.generation != bank.generation[e.voice]
+                || (e.type == SynthEventQueue::E_STOP
+                    && e.time != bank.stopSample[e.voice]);
+        });
 
-            #undef MO__FIND_VOICE
-            #undef MO__FIND_VOICE_ENV
-            #undef MO__FIND_VOICE_NO_ENV
-        }
+    events.push(time, i, bank.generation[i], type);
+}
 
-        SONOT_DEBUG_SYNTH("Synth::noteOn(): reusing voice " << (*i)->p_->index);
-    }
+void Synth::Private::noteOff(uint64_t stopTime, int note)
+{
+    alloc.forEachNote(note, [=](size_t i) { cueStop(i, stopTime); });
+}
 
-    // (re-)init voice
+void Synth::Private::noteOffByIndex(uint64_t stopTime, int64_t idx)
+{
+    alloc.forEachUserIndex(idx, [=](size_t i) { cueStop(i, stopTime); });
+}
 
-    SynthVoice::Private * v = (*i)->p_;
+void Synth::Private::notesOff(uint64_t stopTime)
+{
+    for (size_t i=0; i<bank.numVoices(); ++i)
+        cueStop(i, stopTime);
+}
 
-    SONOT_DEBUG_SYNTH("init voice " << v->index << " f="
-                      << freq << "hz " << " v=" << velocity);
+void Synth::Private::panic()
+{
+    events.clear();
+    alloc.clear();
+    for (size_t i=0; i<bank.numVoices(); ++i)
+    {
+        bank.deactivate(i);
+        bank.cued[i] = false;
+    }
+}
 
-    v->lifetime = 0;
-    v->active = false;
-    v->cued = true;
-    v->cuedForStop = false;
-    v->note = note;
+void Synth::Private::startVoice(size_t i)
+{
+    if (!bank.cued[i])
+        return;
+
+    SONOT_DEBUG_SYNTH("start cued voice " << i << " s=" << bank.startSample[i]);
+
+    bank.env[i].trigger();
+    bank.activate(i);
+    bank.cued[i] = false;
+    SynthVoiceBank::FMVoice * fm = bank.fmOf(i);
+    for (size_t j=0; j<bank.modStride(); ++j)
+        fm[j].env.trigger();
+    if (cbStart_)
+        cbStart_(&voices[i]);
+}
 
-    v->freq = freq;
+void Synth::Private::stopVoice(size_t i)
+{
+    if (!bank.active[i])
+        return;
 
-    // freq as coefficient
-    const double freqc = v->freq / sampleRate;
-    v->freq_c.resize(numCombinedUnison);
-    v->phase.resize(numCombinedUnison);
-    for (size_t i=0; i<numCombinedUnison; ++i)
+    EnvelopeGenerator<double>& env = bank.env[i];
+    if (env.release() > 0.)
     {
-        v->freq_c[i] = freqc;
-        v->phase[i] = 0.0;
+        env.setState(ENV_RELEASE);
     }
-    v->velo = velocity;
-    v->startSample = startSample;
-    v->stopSample = 0;
-    v->env.setSampleRate(sampleRate);
-    v->env.setAttack(p->attack());
-    v->env.setDecay(p->decay());
-    v->env.setSustain(p->sustain());
-    v->env.setRelease(p->release());
-    v->userData = userData;
-    v->userIndex = userIndex;
-    v->nextUnison = nullptr;
-    size_t numMod = p->numberModVoices();
-    v->fmVoices.resize(numMod);
-    for (size_t i=0; i<numMod; ++i)
+    else
     {
-        SynthVoice::Private::FMVoice& fm = v->fmVoices[i];
-        fm.env.setSampleRate(sampleRate);
-        fm.env.setAttack(p->modAttack(i));
-        fm.env.setDecay(p->modDecay(i));
-        fm.env.setSustain(p->modSustain(i));
-        fm.env.setRelease(p->modRelease(i));
-        fm.freqMul = p->modFreqMul(i);
-        fm.modAdd = p->modAdd(i);
-        fm.modAm = p->modAm(i);
-        fm.modFreq = p->modFm(i);
-        fm.modPhase = p->modPm(i);
-        fm.modSelfAm = p->modSelfAm(i);
-        fm.modSelfFreq = p->modSelfFm(i);
-        fm.modSelfPhase = p->modSelfPm(i);
-        fm.phase = 0.;
-        fm.velo = velocity * p->modAmount(i);
+        env.stop();
+        freeVoice(i);
+        if (cbEnd_)
+            cbEnd_(&voices[i]);
     }
+}
 
-    return *i;
+void Synth::Private::compileParameters()
+{
+    Synth::Parameters& q = params;
+    q.numberVoices = props.get("number-voices").toUInt();
+    q.voicePolicy = (Synth::VoicePolicy)props.get("voice-policy").toInt();
+    q.numberModVoices = props.get("number-mod-voices").toUInt();
+    q.oscillator = (Oscillator::Tier)props.get("oscillator").toInt();
+    q.numberThreads = props.get("number-threads").toUInt();
+    q.voicePacks = props.get("voice-packs").toBool();
+    q.controlRate = props.get("control-rate").toUInt();
+    q.volume = props.get("volume").toDouble();
+    q.combinedUnison = !props.get("real-unisono").toBool();
+    q.unisonVoices = props.get("number-unisono-voices").toUInt();
+    q.unisonDetune = props.get("unisono-detune").toDouble();
+    q.unisonNoteStep = props.get("unisono-note-step").toInt();
+    q.attack = props.get("attack").toDouble();
+    q.decay = props.get("decay").toDouble();
+    q.sustain = props.get("sustain").toDouble();
+    q.release = props.get("release").toDouble();
+    q.lfoFreq = props.get("lfo-freq").toDouble();
+    q.lfoAmp = props.get("lfo-amp").toDouble();
+    q.lfoPitch = props.get("lfo-pitch").toDouble();
+    q.rampTime = props.get("ramp-time").toDouble();
+    q.silenceLevel = props.get("silence-level").toDouble();
+    q.adaptiveQuality = props.get("adaptive-quality").toBool();
+    q.loadLimit = props.get("load-limit").toDouble();
+    q.baseFreq = props.get("base-freq").toDouble();
+    q.notesPerOctave = props.get("notes-per-octave").toDouble();
+    q.meanNumerator = props.get("mean-numerator").toInt();
+    q.meanDenominator = props.get("mean-denominator").toInt();
+    q.temperament = (NoteFreq<double>::Temperament)
+            props.get("mean-temperament").toInt();
+    q.temperamentKey = props.get("mean-key").toInt();
 }
 
-void Synth::Private::noteOff(size_t stopSample, int note)
+void Synth::Private::compileModParameters(size_t idx)
 {
-    for (SynthVoice* i : voices)
-    if (i->p_->note == note
-        && (i->p_->active || (i->p_->cued && i->p_->startSample <= stopSample))
-        )
+    const QProps::Properties& mp = modProps[idx];
+    Synth::Parameters::Modulator& m = params.mods[idx];
+    m.attack = mp.get("attack").toDouble();
+    m.decay = mp.get("decay").toDouble();
+    m.sustain = mp.get("sustain").toDouble();
+    m.release = mp.get("release").toDouble();
+    m.amount = mp.get("volume").toDouble();
+    m.add = mp.get("mod-add").toDouble();
+    m.am = mp.get("mod-am").toDouble();
+    m.fm = mp.get("mod-fm").toDouble();
+    m.pm = mp.get("mod-pm").toDouble();
+    m.freqMul = mp.get("freq-mul").toDouble();
+    m.selfAm = mp.get("mod-self-am").toDouble();
+    m.selfFm = mp.get("mod-self-fm").toDouble();
+    m.selfPm = mp.get("mod-self-pm").toDouble();
+}
+
+double Synth::Private::stealValue(size_t i) const
+{
+    switch (voicePolicy)
     {
-        i->p_->cuedForStop = true;
-        i->p_->stopSample = stopSample;
+        case Synth::VP_LOWEST: return bank.freq[i];
+        case Synth::VP_HIGHEST: return -bank.freq[i];
+        // the start time orders like the lifetime but does not change
+        // while the voice plays, cued voices are younger than all others
+        case Synth::VP_OLDEST: return bank.active[i]
+                    ? double(bank.startSample[i])
+                    : std::numeric_limits<double>::max();
+        case Synth::VP_NEWEST: return bank.active[i]
+                    ? -double(bank.startSample[i])
+                    : -std::numeric_limits<double>::max();
+        case Synth::VP_QUITEST: return bank.curLevel(i);
+        case Synth::VP_LOUDEST: return -bank.curLevel(i);
+        case Synth::VP_FORGET: break;
     }
+    return 0.;
 }
 
-void Synth::Private::noteOffByIndex(size_t stopSample, int64_t idx)
+void Synth::Private::updateStealKeys(bool all)
 {
-    for (SynthVoice* i : voices)
-    if (i->p_->userIndex == idx
-        && (i->p_->active || (i->p_->cued && i->p_->startSample <= stopSample))
-        )
+    if (all)
     {
-        i->p_->cuedForStop = true;
-        i->p_->stopSample = stopSample;
+        for (size_t i=0; i<bank.numVoices(); ++i)
+            if (!alloc.isFree(i))
+                alloc.setKey(i, stealRank(i), stealValue(i));
+    }
+    else
+    {
+        // the steal order is never queried
+        if (voicePolicy == Synth::VP_FORGET)
+            return;
+        // except for the level policies the value is constant,
+        // so the heap is only touched when the envelope state changed
+        for (size_t i : bank.activeVoices)
+            alloc.setKey(i, stealRank(i), stealValue(i));
     }
 }
 
-void Synth::Private::notesOff(size_t stopSample)
+void Synth::Private::freeVoice(size_t i)
 {
-    for (SynthVoice* i : voices)
-    if (i->p_->active || (i->p_->cued && i->p_->startSample <= stopSample))
+    bank.deactivate(i);
+    alloc.release(i);
+}
+
+void Synth::Private::applyEvents(uint64_t time)
+{
+    while (!events.isEmpty() && events.top().time <= time)
     {
-        i->p_->cuedForStop = true;
-        i->p_->stopSample = stopSample;
+        const SynthEventQueue::Event e = events.top();
+        events.pop();
+
+        // voice has been reused since
+        if (e.generation != bank.generation[e.voice])
+            continue;
+
+        if (e.type == SynthEventQueue::E_START)
+            startVoice(e.voice);
+        else
+            stopVoice(e.voice);
     }
 }
 
-void Synth::Private::panic()
+size_t Synth::Private::nextEventPos(uint64_t blockStart, size_t bufferLength) const
 {
-    for (auto i : voices)
-        i->p_->active = i->p_->cued = false;
+    if (events.isEmpty() || events.top().time >= blockStart + bufferLength)
+        return bufferLength;
+    return events.top().time - blockStart;
 }
 
 void Synth::Private::process(float *output, size_t bufferLength)
 {
     memset(output, 0, sizeof(float) * bufferLength);
 
-    const double vol = p->volume();
+    updateSilence();
+    const uint64_t blockStart = curSample;
 
-    // for each sample
-    for (size_t sample = 0; sample < bufferLength; ++sample, ++output)
+    // split block at the events
+    size_t pos = 0;
+    while (pos < bufferLength)
     {
-        // for each voice
-        for (SynthVoice * i : voices)
-        {
-            SynthVoice::Private * v = i->p_;
+        applyEvents(blockStart + pos);
+        const size_t next = nextEventPos(blockStart, bufferLength);
 
-            // cued for stop?
-            if (v->cuedForStop && v->stopSample == sample)
-            {
-                //qDebug() << "STOP " << v->note;
-                v->cuedForStop = false;
-                if (v->env.release() > 0.)
-                {
-                    v->env.setState(ENV_RELEASE);
-                }
-                else
-                {
-                    v->env.stop();
-                    v->active = false;
-                    if (cbEnd_)
-                        cbEnd_(i);
-                    continue;
-                }
-            }
+        // render each active voice up to the next event
+        renderMix(output + pos, next - pos);
 
-            // start cued voice
-            if (v->cued && v->startSample == sample)
-            {
-                //qDebug() << "START " << v->note;
-                v->env.trigger();
-                v->active = true;
-                v->cued = false;
-                for (auto& fm : v->fmVoices)
-                    fm.env.trigger();
-                if (cbStart_)
-                    cbStart_(i);
-            }
+        pos = next;
+    }
 
-            if (!v->active)
-                continue;
+    curSample += bufferLength;
+    updateStealKeys(false);
+}
 
-            // count number of samples alive
-            ++(v->lifetime);
+void Synth::Private::process(float ** outputs, size_t bufferLength)
+{
+    for (size_t i = 0; i < bank.numVoices(); ++i)
+        if (outputs[i])
+            memset(outputs[i], 0, sizeof(float) * bufferLength);
 
-            float s = v->calcSample();
-            /*
-            for (size_t j = 0; j<v->phase.size(); ++j)
-            {
-                // advance phase counter
-                v->phase[j] += v->freq_c[j];
-                // get sample
-                s += std::sin(v->phase[j] * 3.14159265 * 2.)
-                     + .3 * std::sin(v->phase[j] * 3.14159265 * 2. * 4);
-            }*/
+    updateSilence();
+    const uint64_t blockStart = curSample;
 
-            // put into buffer
-            *output += s * vol * v->velo * v->env.value();
+    // split block at the events
+    size_t pos = 0;
+    while (pos < bufferLength)
+    {
+        applyEvents(blockStart + pos);
+        const size_t next = nextEventPos(blockStart, bufferLength);
 
-            // process envelope
-            v->env.next();
+        // render each active voice up to the next event
+        renderChannels(outputs, pos, next - pos);
 
-            // check for end of envelope
-            if (!v->env.active())
-            {
-                v->active = false;
-                if (cbEnd_)
-                    cbEnd_(i);
-                continue;
-            }
-        }
+        pos = next;
     }
+
+    curSample += bufferLength;
+    updateStealKeys(false);
 }
 
-void Synth::Private::process(float ** outputs, size_t bufferLength)
+void Synth::Private::process(float ** buses, size_t numBuses,
+                             size_t bufferLength)
 {
-    const double vol = p->volume();
+    for (size_t i = 0; i < numBuses; ++i)
+        if (buses[i])
+            memset(buses[i], 0, sizeof(float) * bufferLength);
 
-    // for each voice
-    for (size_t voicenum = 0; voicenum < voices.size(); ++voicenum)
+    updateSilence();
+    const uint64_t blockStart = curSample;
+
+    // split block at the events
+    size_t pos = 0;
+    while (pos < bufferLength)
     {
-        float * output = outputs[voicenum];
-        if (!output)
-            continue;
+        applyEvents(blockStart + pos);
+        const size_t next = nextEventPos(blockStart, bufferLength);
 
-        SynthVoice::Private * v = voices[voicenum]->p_;
+        // render each active voice up to the next event
+        renderBuses(buses, numBuses, pos, next - pos);
 
-        // if voice is inactive (and won't become active)
-        if (!v->active && !v->cued)
-        {
-            //SONOT_DEBUG_SYNTH("unused " << v->index);
+        pos = next;
+    }
 
-            // clear output buffer
-            memset(output, 0, sizeof(float) * bufferLength);
+    curSample += bufferLength;
+    updateStealKeys(false);
+}
 
-            continue;
+void Synth::Private::setNumThreads(size_t num)
+{
+    const size_t cur = pool ? pool->numThreads() : 1;
+    if (num == cur)
+        return;
+    delete pool;
+    pool = num > 1 ? new SynthWorkerPool(num) : nullptr;
+}
+
+void Synth::Private::runChunks(SynthWorkerPool::Func func)
+{
+    const size_t num = numChunks(bank.activeVoices.size());
+    if (pool)
+        pool->run(num, func, this);
+    else
+        for (size_t c = 0; c < num; ++c)
+            func(this, c);
+}
+
+void Synth::Private::renderControl(size_t length)
+{
+    control.render(ctlGain.data(), ctlPitch.data(), length);
+    jobGain = ctlGain.data();
+    jobPitch = control.hasPitch() ? ctlPitch.data() : nullptr;
+}
+
+void Synth::Private::renderMix(float * output, size_t length)
+{
+    for (size_t pos = 0; pos < length; pos += maxSliceLength())
+    {
+        jobLength = std::min(maxSliceLength(), length - pos);
+        renderControl(jobLength);
+        runChunks(&Private::mixChunk);
+
+        // sum up the chunks in order
+        const size_t num = numChunks(bank.activeVoices.size());
+        for (size_t c = 0; c < num; ++c)
+            addBlock(output + pos, &chunkMix[c * maxSliceLength()], jobLength);
+
+        retireEndedVoices();
+    }
+}
+
+void Synth::Private::renderChannels(float ** outputs, size_t pos, size_t length)
+{
+    jobOutputs = outputs;
+    for (size_t end = pos + length; pos < end; pos += maxSliceLength())
+    {
+        jobPos = pos;
+        jobLength = std::min(maxSliceLength(), end - pos);
+        renderControl(jobLength);
+        runChunks(&Private::channelChunk);
+        retireEndedVoices();
+    }
+}
+
+void Synth::Private::renderBuses(float ** buses, size_t numBuses,
+                                 size_t pos, size_t length)
+{
+    for (size_t end = pos + length; pos < end; pos += maxSliceLength())
+    {
+        jobLength = std::min(maxSliceLength(), end - pos);
+        renderControl(jobLength);
+        runChunks(&Private::voiceChunk);
+
+        // sum up the voices in order
+        for (size_t k = 0; k < bank.activeVoices.size(); ++k)
+        {
+            const int64_t bus = bank.userIndex[bank.activeVoices[k]];
+            if (bus >= 0 && size_t(bus) < numBuses && buses[bus])
+                addBlock(buses[bus] + pos, &voiceMix[k * maxSliceLength()],
+                         jobLength);
         }
 
-        // where to start rendering
-        size_t start = 0;
+        retireEndedVoices();
+    }
+}
 
-        // start voice?
-        if (v->cued)
+void Synth::Private::mixChunk(void * self, size_t chunk)
+{
+    Private * p = static_cast<Private*>(self);
+    float * mix = &p->chunkMix[chunk * maxSliceLength()];
+    memset(mix, 0, sizeof(float) * p->jobLength);
+
+    const size_t
+        begin = chunk * voicesPerChunk(),
+        end = std::min(begin + voicesPerChunk(), p->bank.activeVoices.size());
+    const double * osc = p->renderPack(chunk, begin, end);
+    for (size_t k = begin; k < end; ++k)
+    {
+        const size_t i = p->bank.activeVoices[k];
+        if (!p->renderVoice(i, mix, p->jobLength,
+                            p->jobGain, p->jobPitch, true,
+                            osc ? osc + (k - begin) * maxSliceLength()
+                                : nullptr))
+            p->voiceEnded[i] = 1;
+    }
+}
+
+void Synth::Private::channelChunk(void * self, size_t chunk)
+{
+    Private * p = static_cast<Private*>(self);
+
+    const size_t
+        begin = chunk * voicesPerChunk(),
+        end = std::min(begin + voicesPerChunk(), p->bank.activeVoices.size());
+    const double * osc = p->renderPack(chunk, begin, end);
+    for (size_t k = begin; k < end; ++k)
+    {
+        const size_t i = p->bank.activeVoices[k];
+        float * out = p->jobOutputs[i];
+        if (!p->renderVoice(i, out ? out + p->jobPos : nullptr,
+                            p->jobLength, p->jobGain, p->jobPitch, false,
+                            osc ? osc + (k - begin) * maxSliceLength()
+                                : nullptr))
+            p->voiceEnded[i] = 1;
+    }
+}
+
+void Synth::Private::voiceChunk(void * self, size_t chunk)
+{
+    Private * p = static_cast<Private*>(self);
+
+    const size_t
+        begin = chunk * voicesPerChunk(),
+        end = std::min(begin + voicesPerChunk(), p->bank.activeVoices.size());
+    const double * osc = p->renderPack(chunk, begin, end);
+    for (size_t k = begin; k < end; ++k)
+    {
+        const size_t i = p->bank.activeVoices[k];
+        // zero the rest, if the voice ends early
+        float * out = &p->voiceMix[k * maxSliceLength()];
+        memset(out, 0, sizeof(float) * p->jobLength);
+        if (!p->renderVoice(i, out, p->jobLength,
+                            p->jobGain, p->jobPitch, false,
+                            osc ? osc + (k - begin) * maxSliceLength()
+                                : nullptr))
+            p->voiceEnded[i] = 1;
+    }
+}
+
+const double * Synth::Private::renderPack(size_t chunk, size_t begin,
+                                          size_t end)
+{
+    const size_t lanes = SynthVoicePack::numLanes(packIsa),
+                 num = end - begin;
+    if (!lanes || num < lanes)
+        return nullptr;
+
+    const size_t * v = &bank.activeVoices[begin];
+    bool packed[voicesPerChunk()], any = false;
+    for (size_t l = 0; l + lanes <= num; l += lanes)
+        any |= packed[l] = SynthVoicePack::canPack(bank, v + l, lanes);
+    if (!any)
+        return nullptr;
+
+    // the whole slice, even if a voice ends early,
+    // the kernels do not depend on the block boundaries
+    double * osc = &packOsc[chunk * voicesPerChunk() * maxSliceLength()];
+    for (size_t pos = 0; pos < jobLength; pos += SynthVoiceBank::blockSize())
+    {
+        const size_t len = std::min(SynthVoiceBank::blockSize(),
+                                    jobLength - pos);
+        const double * pitch = jobPitch ? jobPitch + pos : nullptr;
+        size_t l = 0;
+        for (; l + lanes <= num; l += lanes)
         {
-            if (v->startSample < bufferLength)
-            {
-                SONOT_DEBUG_SYNTH("start cued voice "
-                                  << v->index << " s=" << v->startSample);
-
-                // start at specified start-sample
-                start = v->startSample;
-                v->env.trigger();
-                v->active = true;
-                v->cued = false;
-                // send callback
-                if (cbStart_)
-                    cbStart_(voices[voicenum]);
-
-                // clear first part of buffer
-                memset(output, 0, sizeof(float) * start);
-                output += start;
-            }
+            double * out[voicesPerChunk()];
+            for (size_t j = 0; j < lanes; ++j)
+                out[j] = osc + (l + j) * maxSliceLength() + pos;
+            if (packed[l])
+                SynthVoicePack::calcBlock(packIsa, bank, v + l, out, len, pitch);
             else
-            {
-                // if startsample is out of range
-                // don't check again
-                v->cued = false;
-                continue;
-            }
+                for (size_t j = 0; j < lanes; ++j)
+                    bank.calcBlock(v[l + j], out[j], len, pitch);
         }
+        // the rest one by one
+        for (; l < num; ++l)
+            bank.calcBlock(v[l], osc + l * maxSliceLength() + pos, len, pitch);
+    }
+    return osc;
+}
+
+void Synth::Private::retireEndedVoices()
+{
+    for (size_t i : bank.activeVoices)
+        if (voiceEnded[i])
+            endedVoices.push_back(i);
+
+    for (size_t i : endedVoices)
+    {
+        SONOT_DEBUG_SYNTH("voice end " << i);
+
+        voiceEnded[i] = 0;
+        freeVoice(i);
+        if (cbEnd_)
+            cbEnd_(&voices[i]);
+    }
+    endedVoices.clear();
+}
 
-        //MO_DEBUG("process " << v->index << " " << start << "-" << bufferLength);
+bool Synth::Private::isSilent(size_t i) const
+{
+    const EnvelopeGenerator<double>& env = bank.env[i];
+    const bool falling = env.state() == ENV_RELEASE
+            || (env.state() == ENV_DECAY && env.sustain() <= 0.)
+            || (jobSteal && env.state() != ENV_ATTACK);
+    return falling && bank.peak[i] < jobSilence;
+}
+
+void Synth::Private::updateSilence()
+{
+    const double level = jobSteal ? std::max(params.silenceLevel, stealLevel())
+                                  : params.silenceLevel;
+    jobSilence = params.volume * std::pow(10., level / 20.);
+}
 
-        // for each sample
-        for (size_t sample = start; sample < bufferLength; ++sample, ++output)
+void Synth::Private::applyQuality()
+{
+    const SynthLoad::Quality q = load.quality();
+    bank.unisonLimit = q >= SynthLoad::Q_NO_UNISON ? 1 : size_t(-1);
+    const bool cheap = q >= SynthLoad::Q_CHEAP_OSCILLATOR;
+    bank.oscillator = cheap ? Oscillator::fastest(false) : params.oscillator;
+    bank.fixedOscillator = cheap ? Oscillator::fastest(true) : params.oscillator;
+    jobSteal = q >= SynthLoad::Q_STEAL_VOICES;
+
+    const size_t rate = q >= SynthLoad::Q_CONTROL_RATE
+            ? std::max(params.controlRate, shedControlRate())
+            : params.controlRate;
+    if (rate == modControlRate)
+        return;
+    modControlRate = rate;
+
+    // switch the running modulator envelopes, continuing from
+    // their current value
+    for (size_t i=0; i<bank.numVoices(); ++i)
+    {
+        if (alloc.isFree(i))
+            continue;
+        SynthVoiceBank::FMVoice * fm = bank.fmOf(i);
+        for (size_t j=0; j<bank.modStride(); ++j, ++fm)
         {
-            // get oscillator sample
-            float s = v->calcSample();
+            const double e = fm->envRate < 2 ? fm->env.value() : fm->envCur;
+            fm->env.setSampleRate(double(sampleRate) / rate);
+            fm->setControlRate(rate);
+            fm->envCur = fm->envTarget = e;
+        }
+    }
+}
+
+bool Synth::Private::renderVoice(size_t i, float * output, size_t length,
+                                 const double * gain, const double * pitch,
+                                 bool accumulate, const double * osc)
+{
+    EnvelopeGenerator<double>& env = bank.env[i];
+    double block[SynthVoiceBank::blockSize()],
+           envVal[SynthVoiceBank::blockSize() + 1];
+    float mix[SynthVoiceBank::blockSize()];
 
-            // envelope before filter
-            s *= v->env.value();
+    for (size_t pos = 0; pos < length; )
+    {
+        // blocks are aligned to the start of the voice,
+        // so the peak levels do not depend on the buffer sizes
+        const size_t num = std::min(SynthVoiceBank::blockSize()
+                    - bank.lifetime[i] % SynthVoiceBank::blockSize(),
+                                    length - pos);
+        // get oscillator samples
+        const double * o = osc ? osc + pos : block;
+        if (!osc)
+            bank.calcBlock(i, block, num, pitch ? pitch + pos : nullptr);
+
+        // process envelope, which is applied one sample delayed,
+        // up to and including the sample where it ends
+        envVal[0] = env.value();
+        const size_t k = env.processBlock(envVal + 1, num);
+        bool ended = !env.active();
+
+        float peak = bank.peak[i];
+        for (size_t j = 0; j < k; ++j)
+        {
+            float s = o[j];
+            mix[j] = s * gain[pos + j] * bank.velo[i] * envVal[j];
+            peak = std::max(peak, std::abs(mix[j]));
+        }
+        bank.peak[i] = peak;
 
-            // put into buffer
-            *output = s * vol * v->velo;
+        // count number of samples alive
+        bank.lifetime[i] += k;
 
-            // process envelope
-            v->env.next();
-            // check for end of envelope
-            if (!v->env.active())
+        // end of a block: end the voice early if it's inaudible
+        if (bank.lifetime[i] % SynthVoiceBank::blockSize() == 0)
+        {
+            if (!ended && isSilent(i))
             {
-                SONOT_DEBUG_SYNTH("voice end " << v->index << " s=" << sample);
-
-                v->active = false;
-                // clear rest of buffer
-                if (sample < bufferLength - 1)
-                    memset(output+1, 0, sizeof(float) * (bufferLength - sample - 1));
-                // send callback
-                if (cbEnd_)
-                    cbEnd_(voices[voicenum]);
-                break;
+                SONOT_DEBUG_SYNTH("voice silent " << i);
+                env.stop();
+                ended = true;
             }
+            bank.peak[i] = 0.f;
+        }
 
+        // put into buffer
+        if (output)
+        {
+            if (accumulate)
+                addBlock(output + pos, mix, k);
+            else
+                memcpy(output + pos, mix, sizeof(float) * k);
         }
+        pos += k;
 
-        // count number of samples alive
-        v->lifetime += bufferLength - start;
+        if (ended)
+            return false;
     }
+    return true;
 }
 
 
@@ -850,8 +1379,35 @@ Synth::~Synth()
 }
 
 size_t Synth::sampleRate() const { return p_->sampleRate; }
+uint64_t Synth::currentSample() const { return p_->curSample; }
+
+size_t Synth::numActiveVoices() const
+{
+    size_t num = p_->bank.activeVoices.size();
+    for (size_t i=0; i<p_->bank.numVoices(); ++i)
+        if (p_->bank.cued[i] && !p_->bank.active[i])
+            ++num;
+    return num;
+}
+
+size_t Synth::numDroppedEvents() const { return p_->events.numDropped(); }
+
+QProps::Properties Synth::defaultProperties()
+{
+    QProps::Properties props("synth"), modPropsDef("mod-voice");
+    Private::createProperties(props, modPropsDef);
+    return props;
+}
+
+QProps::Properties Synth::defaultModProperties(size_t idx)
+{
+    QProps::Properties props("synth"), modPropsDef("mod-voice");
+    Private::createProperties(props, modPropsDef);
+    return Private::modProperties(modPropsDef, idx);
+}
 
 const QProps::Properties& Synth::props() const { return p_->props; }
+const Synth::Parameters& Synth::parameters() const { return p_->params; }
 const QProps::Properties& Synth::modProps(size_t idx) const
 {
     QPROPS_ASSERT_LT(idx, p_->modProps.size(), "");
@@ -861,6 +1417,7 @@ const QProps::Properties& Synth::modProps(size_t idx) const
 void Synth::setProperties(const QProps::Properties& p)
 {
     p_->props = p;
+    p_->compileParameters();
     p_->noteFreq.setBaseFrequency( baseFreq() );
     if (pythagoreanNum() && pythagoreanDenom())
     {
@@ -872,30 +1429,54 @@ void Synth::setProperties(const QProps::Properties& p)
         p_->noteFreq.setBaseFrequency( baseFreq() );
         p_->noteFreq.setNotesPerOctave( notesPerOctave() );
     }
-    p_->voicePolicy = (VoicePolicy)p_->props.get("voice-policy").toInt();
-    if (numberVoices() != p_->voices.size())
+    p_->noteFreq.setTemperament( temperament(), temperamentKey() );
+    if (voicePolicy() != p_->voicePolicy)
+    {
+        p_->voicePolicy = voicePolicy();
+        p_->updateStealKeys(true);
+    }
+    p_->control.setRate(controlRate());
+    p_->control.setSampleRate(sampleRate());
+    // before the first process() call, there is nothing to ramp from
+    p_->control.setTargets(volume(), lfoAmplitude(), lfoPitch(),
+                           lfoFrequency(), rampTime(),
+                           p_->curSample == 0);
+    if (numberVoices() != p_->bank.numVoices())
         p_->setNumVoices(numberVoices());
+    p_->setNumThreads(numberThreads());
+    p_->packIsa = voicePacks() ? SynthVoicePack::detect()
+                               : SynthVoicePack::ISA_NONE;
+    // preallocate, so noteOn() does not need to
+    p_->bank.reserveUnison(combinedUnison() ? unisonVoices() : 1);
     while (numberModVoices() < p_->modProps.size())
         p_->modProps.pop_back();
     while (numberModVoices() > p_->modProps.size())
-    {
-        if (!p_->modProps.empty())
-            p_->modProps.push_back(p_->modPropsDef);
-        else
-        {
-            auto p = p_->modPropsDef;
-            p.setVisible("mod-self-am", false);
-            p.setVisible("mod-self-fm", false);
-            p.setVisible("mod-self-pm", false);
-            p_->modProps.push_back(p);
-        }
-    }
+        p_->modProps.push_back(Private::modProperties(
+                                   p_->modPropsDef, p_->modProps.size()));
+    p_->params.mods.resize(p_->modProps.size());
+    for (size_t i=0; i<p_->modProps.size(); ++i)
+        p_->compileModParameters(i);
+    p_->bank.setModStride(numberModVoices());
+    p_->load.setSampleRate(sampleRate());
+    p_->load.setLimits(loadLimit(), loadLimit() * .6, 1.);
+    p_->applyQuality();
 }
 
 void Synth::setModProperties(size_t idx, const QProps::Properties& p)
 {
     QPROPS_ASSERT_LT(idx, p_->modProps.size(), "");
     p_->modProps[idx] = p;
+    p_->compileModParameters(idx);
+}
+
+SynthLoad::Quality Synth::quality() const { return p_->load.quality(); }
+const SynthLoad::Stats& Synth::loadStats() const { return p_->load.stats(); }
+void Synth::resetLoadStats() { p_->load.resetStats(); }
+
+void Synth::setQuality(SynthLoad::Quality q)
+{
+    p_->load.setQuality(q);
+    p_->applyQuality();
 }
 
 void Synth::setVoiceStartedCallback(std::function<void (SynthVoice *)> func) { p_->cbStart_ = func; }
@@ -906,7 +1487,15 @@ void Synth::setVoiceEndedCallback(std::function<void (SynthVoice *)> func) { p_-
 SynthVoice * Synth::noteOn(int note, double velocity,
                            size_t startSample, int64_t userIndex, void * userData)
 {
-    SONOT_DEBUG_SYNTH("Synth::noteOn(" << note << ", " << velocity << ", "
+    return noteOnAt(note, velocity, currentSample() + startSample,
+                    userIndex, userData);
+}
+
+SynthVoice * Synth::noteOnAt(int note, double velocity,
+                             uint64_t startSample, int64_t userIndex,
+                             void * userData)
+{
+    SONOT_DEBUG_SYNTH("Synth::noteOnAt(" << note << ", " << velocity << ", "
              << startSample << ", " << userData << ")");
 
     double freq = p_->noteFreq.frequency(note);
@@ -936,18 +1525,19 @@ SynthVoice * Synth::noteOn(int note, double velocity,
             const double maxdetune =
                     unisonDetune() / 200.0
                         // range of one note
-                        * (p_->noteFreq.frequency(note + 1) - freq),
+                        * p_->noteFreq.range(note),
 
-                    detune = (double)rand() / RAND_MAX
+                    detune = (double)p_->random() / p_->random.max()
                              * maxdetune * 2. - maxdetune;
 
-            voice->p_->freq = freq + detune;
-            voice->p_->freq_c[i] = voice->p_->freq / sampleRate();
+            p_->bank.freq[voice->index()] = freq + detune;
+            p_->bank.setFreqC(voice->index(), i, (freq + detune) / sampleRate());
         }
         return voice;
     }
 
-    const size_t numUnison = std::min(numberVoices(), unisonVoices());
+    const size_t numUnison = std::min(numberVoices(),
+                        quality() >= SynthLoad::Q_NO_UNISON ? 1 : unisonVoices());
     if (numUnison)
         velocity /= numUnison;
 
@@ -962,16 +1552,16 @@ SynthVoice * Synth::noteOn(int note, double velocity,
         const double maxdetune =
                 unisonDetune() / 200.0
                     // range of one note
-                    * (p_->noteFreq.frequency(note + 1) - freq),
+                    * p_->noteFreq.range(note),
 
-                detune = (double)rand() / RAND_MAX
+                detune = (double)p_->random() / p_->random.max()
                              * maxdetune * 2. - maxdetune;
 
         SynthVoice * v = p_->noteOn(startSample, freq + detune,
                                     note, velocity, 1, userData, userIndex);
         if (v)
         {
-            lastv->p_->nextUnison = v;
+            p_->bank.nextUnison[lastv->index()] = v->index();
             lastv = v;
         }
         else
@@ -988,15 +1578,30 @@ SynthVoice * Synth::noteOn(int note, double velocity,
 
 void Synth::noteOff(int note, size_t stopSample)
 {
-    p_->noteOff(stopSample, note);
+    p_->noteOff(currentSample() + stopSample, note);
 }
 
 void Synth::noteOffByIndex(int64_t idx, size_t stopSample)
 {
-    p_->noteOffByIndex(stopSample, idx);
+    p_->noteOffByIndex(currentSample() + stopSample, idx);
 }
 
 void Synth::notesOff(size_t stopSample)
+{
+    p_->notesOff(currentSample() + stopSample);
+}
+
+void Synth::noteOffAt(int note, uint64_t stopSample)
+{
+    p_->noteOff(stopSample, note);
+}
+
+void Synth::noteOffByIndexAt(int64_t idx, uint64_t stopSample)
+{
+    p_->noteOffByIndex(stopSample, idx);
+}
+
+void Synth::notesOffAt(uint64_t stopSample)
 {
     p_->notesOff(stopSample);
 }
@@ -1005,12 +1610,44 @@ void Synth::panic() { p_->panic(); }
 
 void Synth::process(float *output, size_t bufferLength)
 {
+    AllocationGuard guard;
+    DenormalGuard denormalGuard;
+    if (!adaptiveQuality())
+    {
+        p_->process(output, bufferLength);
+        return;
+    }
+    const auto start = std::chrono::steady_clock::now();
     p_->process(output, bufferLength);
+    p_->updateLoad(start, bufferLength);
 }
 
 void Synth::process(float ** output, size_t bufferLength)
 {
+    AllocationGuard guard;
+    DenormalGuard denormalGuard;
+    if (!adaptiveQuality())
+    {
+        p_->process(output, bufferLength);
+        return;
+    }
+    const auto start = std::chrono::steady_clock::now();
     p_->process(output, bufferLength);
+    p_->updateLoad(start, bufferLength);
+}
+
+void Synth::process(float ** buses, size_t numBuses, size_t bufferLength)
+{
+    AllocationGuard guard;
+    DenormalGuard denormalGuard;
+    if (!adaptiveQuality())
+    {
+        p_->process(buses, numBuses, bufferLength);
+        return;
+    }
+    const auto start = std::chrono::steady_clock::now();
+    p_->process(buses, numBuses, bufferLength);
+    p_->updateLoad(start, bufferLength);
 }
 
 QJsonObject Synth::toJson() const
@@ -22,6 +22,8 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 #define SONOTSRC_SYNTH_H
 
 #include <cstddef>
+#include <cstdint>
+#include <vector>
 
 #include <QtCore>
 
@@ -29,20 +31,22 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 #include "QProps/JsonInterface.h"
 
 #include "EnvelopeGenerator.h"
+#include "Oscillator.h"
+#include "SynthLoad.h"
 #include "core/NoteFreq.h"
 
 namespace Sonot {
 
 class Synth;
 
-/** One synthesizer voice */
+/** One synthesizer voice.
+    This is a lightweight handle into the voice storage of the Synth. */
 class SynthVoice
 {
     friend class Synth;
 public:
 
-    SynthVoice(Synth *);
-    ~SynthVoice();
+    SynthVoice(Synth *, size_t index);
 
     // ------------ getter -------------
 
@@ -51,7 +55,8 @@ public:
     size_t index() const;
     bool active() const;
     bool cued() const;
-    size_t startSample() const;
+    /** Absolute start time in samples, see Synth::currentSample() */
+    uint64_t startSample() const;
 
     int note() const;
     double frequency() const;
@@ -92,8 +97,8 @@ public:
 
 private:
 
-    class Private;
-    Private * p_;
+    Synth * p_synth;
+    size_t p_index;
 };
 
 
@@ -102,9 +107,13 @@ private:
 class Synth : public QProps::JsonInterface
 {
     Q_DECLARE_TR_FUNCTIONS(Synth)
+    friend class SynthVoice;
 public:
 
-    /** Voice reuse policy when reached max polyphony */
+    /** Voice reuse policy when reached max polyphony.
+        Voices in a later envelope state (e.g. release) are always
+        reused before the policy is applied. Levels and ages are
+        updated once per process() call. */
     enum VoicePolicy
     {
         /** Forget new voice */
@@ -123,6 +132,37 @@ public:
         VP_LOUDEST
     };
     static QProps::Properties::NamedValues voicePolicyNamedValues();
+    static QProps::Properties::NamedValues oscillatorNamedValues();
+    static QProps::Properties::NamedValues temperamentNamedValues();
+
+    /** Flat, typed copy of the properties.
+        It is compiled in setProperties() and setModProperties(),
+        so the note and render code never looks up a QVariant. */
+    struct Parameters
+    {
+        struct Modulator
+        {
+            double attack, decay, sustain, release,
+                   amount, add, am, fm, pm, freqMul,
+                   selfAm, selfFm, selfPm;
+        };
+
+        size_t numberVoices, numberModVoices, unisonVoices, numberThreads,
+               controlRate;
+        VoicePolicy voicePolicy;
+        Oscillator::Tier oscillator;
+        bool combinedUnison, adaptiveQuality, voicePacks;
+        int unisonNoteStep, meanNumerator, meanDenominator,
+            temperamentKey;
+        NoteFreq<double>::Temperament temperament;
+        double volume, unisonDetune,
+               attack, decay, sustain, release,
+               baseFreq, notesPerOctave,
+               lfoFreq, lfoAmp, lfoPitch, rampTime,
+               silenceLevel, loadLimit;
+        /** One entry for each modulator voice */
+        std::vector<Modulator> mods;
+    };
 
     Synth();
     ~Synth();
@@ -134,54 +174,94 @@ public:
 
     // ------------ getter ----------------
 
+    /** The properties of a new Synth, without creating one */
+    static QProps::Properties defaultProperties();
+    /** The properties of a new modulator voice @p idx */
+    static QProps::Properties defaultModProperties(size_t idx);
+
     const QProps::Properties& props() const;
     const QProps::Properties& modProps(size_t idx) const;
 
     size_t sampleRate() const;
 
-    size_t numberVoices() const { return props().get("number-voices").toUInt(); }
-    VoicePolicy voicePolicy() const {
-        return (VoicePolicy)props().get("voice-policy").toInt(); }
-    size_t numberModVoices() const { return props().get("number-mod-voices").toUInt(); }
-
-    double volume() const { return props().get("volume").toDouble(); }
-    bool combinedUnison() const
-        { return !props().get("real-unisono").toBool(); }
-    size_t unisonVoices() const
-        { return props().get("number-unisono-voices").toUInt(); }
-    double unisonDetune() const
-        { return props().get("unisono-detune").toDouble(); }
-    int unisonNoteStep() const
-        { return props().get("unisono-note-step").toInt(); }
-
-    double attack() const { return props().get("attack").toDouble(); }
-    double decay() const { return props().get("decay").toDouble(); }
-    double sustain() const { return props().get("sustain").toDouble(); }
-    double release() const { return props().get("release").toDouble(); }
-
-    double baseFreq() const { return props().get("base-freq").toDouble(); }
-    double notesPerOctave()
-        { return props().get("notes-per-octave").toDouble(); }
-    int pythagoreanNum() const { return props().get("mean-numerator").toInt(); }
-    int pythagoreanDenom() const
-                            { return props().get("mean-denominator").toInt(); }
+    /** Returns the absolute time in samples of the next sample
+        to be generated by process(). Starts at zero and is advanced
+        by the bufferLength of each call to process(). */
+    uint64_t currentSample() const;
+
+    /** Number of voices that are playing or cued to start */
+    size_t numActiveVoices() const;
+
+    /** Number of voice start and stop events that were dropped
+        because the event queue was full, should stay zero */
+    size_t numDroppedEvents() const;
+
+    /** The typed copy of props() and modProps() used by the audio code */
+    const Parameters& parameters() const;
+
+    size_t numberVoices() const { return parameters().numberVoices; }
+    VoicePolicy voicePolicy() const { return parameters().voicePolicy; }
+    size_t numberModVoices() const { return parameters().numberModVoices; }
+    Oscillator::Tier oscillator() const { return parameters().oscillator; }
+    size_t numberThreads() const { return parameters().numberThreads; }
+    /** Render voices with the same kernel together, see SynthVoicePack */
+    bool voicePacks() const { return parameters().voicePacks; }
+    /** Samples between two updates of the modulator envelopes,
+        the LFO and the parameter ramps */
+    size_t controlRate() const { return parameters().controlRate; }
+
+    double volume() const { return parameters().volume; }
+    bool combinedUnison() const { return parameters().combinedUnison; }
+    size_t unisonVoices() const { return parameters().unisonVoices; }
+    double unisonDetune() const { return parameters().unisonDetune; }
+    int unisonNoteStep() const { return parameters().unisonNoteStep; }
+
+    double attack() const { return parameters().attack; }
+    double decay() const { return parameters().decay; }
+    double sustain() const { return parameters().sustain; }
+    double release() const { return parameters().release; }
+
+    /** Tremulant/vibrato frequency in Hertz */
+    double lfoFrequency() const { return parameters().lfoFreq; }
+    /** Tremulant depth [0,1] */
+    double lfoAmplitude() const { return parameters().lfoAmp; }
+    /** Vibrato depth in cents */
+    double lfoPitch() const { return parameters().lfoPitch; }
+    /** Seconds to move volume and LFO depths to new values */
+    double rampTime() const { return parameters().rampTime; }
+    /** Level in dB, relative to the master volume, below which
+        fading voices are ended */
+    double silenceLevel() const { return parameters().silenceLevel; }
+    /** Lower the quality when rendering gets close to real-time */
+    bool adaptiveQuality() const { return parameters().adaptiveQuality; }
+    /** Fraction of the real-time budget that triggers adaptiveQuality() */
+    double loadLimit() const { return parameters().loadLimit; }
+
+    double baseFreq() const { return parameters().baseFreq; }
+    double notesPerOctave() const { return parameters().notesPerOctave; }
+    int pythagoreanNum() const { return parameters().meanNumerator; }
+    int pythagoreanDenom() const { return parameters().meanDenominator; }
+    NoteFreq<double>::Temperament temperament() const
+        { return parameters().temperament; }
+    /** First note of the chain of fifths, 0 is C */
+    int temperamentKey() const { return parameters().temperamentKey; }
 
     // -- modulator voices --
 
-    double modAttack(size_t idx) const { return modProps(idx).get("attack").toDouble(); }
-    double modDecay(size_t idx) const { return modProps(idx).get("decay").toDouble(); }
-    double modSustain(size_t idx) const { return modProps(idx).get("sustain").toDouble(); }
-    double modRelease(size_t idx) const { return modProps(idx).get("release").toDouble(); }
-
-    double modAmount(size_t idx) const { return modProps(idx).get("volume").toDouble(); }
-    double modAdd(size_t idx) const { return modProps(idx).get("mod-add").toDouble(); }
-    double modAm(size_t idx) const { return modProps(idx).get("mod-am").toDouble(); }
-    double modFm(size_t idx) const { return modProps(idx).get("mod-fm").toDouble(); }
-    double modPm(size_t idx) const { return modProps(idx).get("mod-pm").toDouble(); }
-    double modFreqMul(size_t idx) const { return modProps(idx).get("freq-mul").toDouble(); }
-    double modSelfAm(size_t idx) const { return modProps(idx).get("mod-self-am").toDouble(); }
-    double modSelfFm(size_t idx) const { return modProps(idx).get("mod-self-fm").toDouble(); }
-    double modSelfPm(size_t idx) const { return modProps(idx).get("mod-self-pm").toDouble(); }
+    double modAttack(size_t idx) const { return parameters().mods[idx].attack; }
+    double modDecay(size_t idx) const { return parameters().mods[idx].decay; }
+    double modSustain(size_t idx) const { return parameters().mods[idx].sustain; }
+    double modRelease(size_t idx) const { return parameters().mods[idx].release; }
+
+    double modAmount(size_t idx) const { return parameters().mods[idx].amount; }
+    double modAdd(size_t idx) const { return parameters().mods[idx].add; }
+    double modAm(size_t idx) const { return parameters().mods[idx].am; }
+    double modFm(size_t idx) const { return parameters().mods[idx].fm; }
+    double modPm(size_t idx) const { return parameters().mods[idx].pm; }
+    double modFreqMul(size_t idx) const { return parameters().mods[idx].freqMul; }
+    double modSelfAm(size_t idx) const { return parameters().mods[idx].selfAm; }
+    double modSelfFm(size_t idx) const { return parameters().mods[idx].selfFm; }
+    double modSelfPm(size_t idx) const { return parameters().mods[idx].selfPm; }
 
     // ----------- setter -----------------
 
@@ -191,6 +271,23 @@ public:
     void setProperties(const QProps::Properties& p);
     void setModProperties(size_t idx, const QProps::Properties& p);
 
+    // ------- adaptive quality -----------
+
+    /** The current quality step.
+        With adaptiveQuality() enabled, process() lowers it step by
+        step when the rendering time gets close to loadLimit() of
+        the real-time budget, and raises it again once the load
+        stayed low for a second. */
+    SynthLoad::Quality quality() const;
+
+    /** Load measurements and the number of quality transitions */
+    const SynthLoad::Stats& loadStats() const;
+    void resetLoadStats();
+
+    /** Sets the quality step directly.
+        This is not counted as transition in loadStats(). */
+    void setQuality(SynthLoad::Quality q);
+
     // ---------- callbacks ---------------
 
     /** Supplies a function that should be called when a voice was started.
@@ -214,19 +311,29 @@ public:
         (when unisonVoices() > 1 and combinedUnison() == true),
         the additional voices are in SynthVoice::nextUnisonVoice().
         If @p startSample > 0, the start of the voice will be
-        delayed for the given number of samples.
+        delayed for the given number of samples, relative to
+        currentSample(). The delay may span any number of
+        process() calls; the voice starts exactly on that sample.
         The returned voice will be valid but not active yet.
-        Note that startSample must be smaller than the
-        bufferLength parameter in process() to start the voice.
         @p userData and @p userIndex is passed to the SynthVoice. */
     SynthVoice * noteOn(int note, double velocity,
                         size_t startSample = 0,
                         int64_t userIndex = -1,
                         void * userData = 0);
 
+    /** Same as noteOn() but @p startSample is an absolute time,
+        as returned by currentSample(). Times in the past start
+        the voice at the beginning of the next process() call. */
+    SynthVoice * noteOnAt(int note, double velocity,
+                          uint64_t startSample,
+                          int64_t userIndex = -1,
+                          void * userData = 0);
+
     /** Stops all active voices of the given note.
         Depending on their sustain level, they will immidiately stop
-        (sustain==0) or enter into RELEASE envelope state. */
+        (sustain==0) or enter into RELEASE envelope state.
+        Voices that are cued to start before @p stopSample
+        are stopped as well, once they have started. */
     void noteOff(int note, size_t stopSample = 0);
 
     /** Stops all active voices with the given @p userIndex.
@@ -240,10 +347,17 @@ public:
         @see panic() */
     void notesOff(size_t stopSample = 0);
 
-    /** Turn all notes off immediately. */
+    /** Absolute-time versions of the functions above */
+    void noteOffAt(int note, uint64_t stopSample);
+    void noteOffByIndexAt(int64_t userIndex, uint64_t stopSample);
+    void notesOffAt(uint64_t stopSample);
+
+    /** Turn all notes off immediately and drop all scheduled events. */
     void panic();
 
     /** Generates @p bufferLength samples of synthesizer music.
+        Scheduled voice starts and stops are executed on their exact
+        sample; the buffer is rendered in segments between them.
         The output will be mono and @p output is expected to point
         at a buffer of size @p bufferLength. */
     void process(float * output, size_t bufferLength);
@@ -254,6 +368,13 @@ public:
         of size @p bufferLength. */
     void process(float ** output, size_t bufferLength);
 
+    /** Generates @p bufferLength samples of synthesizer music.
+        Each voice is mixed into the buffer @p buses[userIndex],
+        voices with a userIndex outside [0, @p numBuses) are muted.
+        The buses are summed in a fixed order, independent of
+        numberThreads(). Null pointers in @p buses are allowed. */
+    void process(float ** buses, size_t numBuses, size_t bufferLength);
+
 private:
 
     class Private;
@@ -0,0 +1,199 @@
+/***************************************************************************
+
+Copyright (C) 2016  stefan.berke @ modular-audio-graphics.com
+
+This source is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either
+version 3.0 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this software; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+****************************************************************************/
+
+#ifndef SONOTSRC_SYNTHCONTROL_H
+#define SONOTSRC_SYNTHCONTROL_H
+
+#include <cstddef>
+#include <cmath>
+#include <algorithm>
+
+namespace Sonot {
+
+/** Control-rate tier of the Synth.
+
+    Every rate() samples it advances the parameter ramps of the
+    master volume and the LFO depths, and the tremulant/vibrato LFO.
+    The values are linearly interpolated into per-sample gain and
+    pitch factors for the audio kernels.
+    The output only depends on the number of samples rendered,
+    not on how they are split into blocks. */
+class SynthControl
+{
+public:
+
+    SynthControl()
+        : p_rate        (1),
+          p_sampleRate  (44100),
+          p_lfoFreq     (0.),
+          p_lfoPhase    (0.),
+          p_rampSteps   (0.),
+          p_left        (0),
+          p_gain        (1.),
+          p_gainInc     (0.),
+          p_gainTarget  (1.),
+          p_pitch       (1.),
+          p_pitchInc    (0.),
+          p_pitchTarget (1.),
+          p_hasPitch    (false)
+    {
+        p_volume.setTarget(1., 0.);
+    }
+
+    // ------------ getter -------------
+
+    /** Samples between two control steps */
+    size_t rate() const { return p_rate; }
+
+    /** Returns true if the last render() produced a pitch factor
+        other than one */
+    bool hasPitch() const { return p_hasPitch; }
+
+    // ----------- setter --------------
+
+    void setRate(size_t rate) { p_rate = std::max(size_t(1), rate); }
+    void setSampleRate(size_t sr) { p_sampleRate = sr; }
+
+    /** Sets the master volume, the tremulant depth [0,1],
+        the vibrato depth in cents and the LFO frequency in Hertz.
+        Volume and depths move linearly to the new values within
+        @p rampTime seconds, or immediately if @p jump is true. */
+    void setTargets(double volume, double lfoAmp, double lfoCents,
+                    double lfoFreq, double rampTime, bool jump)
+    {
+        p_lfoFreq = lfoFreq;
+        p_rampSteps = rampTime * p_sampleRate / p_rate;
+        p_volume.setTarget(volume, jump ? 0. : p_rampSteps);
+        p_lfoAmp.setTarget(lfoAmp, jump ? 0. : p_rampSteps);
+        p_lfoCents.setTarget(lfoCents, jump ? 0. : p_rampSteps);
+        if (jump)
+        {
+            p_left = 0;
+            p_gain = p_gainTarget = gainValue(1.);
+            p_pitch = p_pitchTarget = 1.;
+            p_gainInc = p_pitchInc = 0.;
+        }
+    }
+
+    // --------- processing ------------
+
+    /** Writes @p num samples of the gain and pitch factors.
+        @p pitch is only written if hasPitch() is true afterwards. */
+    void render(double * gain, double * pitch, size_t num)
+    {
+        p_hasPitch = p_pitch != 1. || p_pitchInc != 0.
+                || p_lfoCents.cur != 0. || p_lfoCents.target != 0.;
+
+        for (size_t k = 0; k < num; )
+        {
+            if (!p_left)
+                step();
+
+            const size_t n = std::min(num - k, p_left);
+            double g = p_gain;
+            for (size_t j = 0; j < n; ++j, g += p_gainInc)
+                gain[k + j] = g;
+            p_gain = g;
+            if (p_hasPitch)
+            {
+                double q = p_pitch;
+                for (size_t j = 0; j < n; ++j, q += p_pitchInc)
+                    pitch[k + j] = q;
+                p_pitch = q;
+            }
+            k += n;
+            p_left -= n;
+        }
+    }
+
+private:
+
+    /** Linear ramp in control steps */
+    struct Ramp
+    {
+        Ramp() : cur(0.), target(0.), inc(0.), left(0) { }
+
+        void setTarget(double t, double steps)
+        {
+            target = t;
+            if (steps < 1.)
+            {
+                cur = t;
+                left = 0;
+                return;
+            }
+            left = size_t(steps);
+            inc = (target - cur) / left;
+        }
+
+        void step()
+        {
+            if (!left)
+                return;
+            cur = --left ? cur + inc : target;
+        }
+
+        double cur, target, inc;
+        size_t left;
+    };
+
+    double gainValue(double lfo) const
+        { return p_volume.cur * (1. - p_lfoAmp.cur * .5 * (1. - lfo)); }
+
+    /** Calculates the values at the end of the next control step
+        and the increments to get there */
+    void step()
+    {
+        p_volume.step();
+        p_lfoAmp.step();
+        p_lfoCents.step();
+
+        double lfo = 1.;
+        if (p_lfoAmp.cur != 0. || p_lfoCents.cur != 0.)
+        {
+            p_lfoPhase += p_lfoFreq * p_rate / p_sampleRate;
+            p_lfoPhase -= std::floor(p_lfoPhase);
+            lfo = std::cos(p_lfoPhase * 6.283185307179586476925);
+        }
+
+        // snap to the last target, so rounding does not accumulate
+        p_gain = p_gainTarget;
+        p_pitch = p_pitchTarget;
+        p_gainTarget = gainValue(lfo);
+        p_pitchTarget = p_lfoCents.cur != 0.
+                ? std::pow(2., p_lfoCents.cur * lfo / 1200.) : 1.;
+        p_gainInc = (p_gainTarget - p_gain) / p_rate;
+        p_pitchInc = (p_pitchTarget - p_pitch) / p_rate;
+        p_left = p_rate;
+    }
+
+    size_t p_rate, p_sampleRate;
+    Ramp p_volume, p_lfoAmp, p_lfoCents;
+    double p_lfoFreq, p_lfoPhase, p_rampSteps;
+    /** Samples left in the current control step */
+    size_t p_left;
+    double p_gain, p_gainInc, p_gainTarget,
+           p_pitch, p_pitchInc, p_pitchTarget;
+    bool p_hasPitch;
+};
+
+} // namespace Sonot
+
+#endif // SONOTSRC_SYNTHCONTROL_H
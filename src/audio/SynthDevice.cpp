@@ -20,56 +20,210 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 
 #include "QProps/JsonInterfaceHelper.h"
 
-#include "SynthDevice.h"
-#include "core/Notes.h"
-#include "core/NoteStream.h"
-
-#if (0)
-#   include <QDebug>
-#   define SONOT_DEBUG_SYNTH(arg__) qDebug() << arg__
-#else
-#   define SONOT_DEBUG_SYNTH(unused__)
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <limits>
+#include <mutex>
+#include <thread>
+
+#if defined(_WIN32)
+#   include <windows.h>
+#elif defined(__unix__) || defined(__APPLE__)
+#   include <pthread.h>
+#   include <sched.h>
 #endif
 
+#include "SynthDevice.h"
+#include "SynthSequencer.h"
+#include "SynthTimeline.h"
+#include "SpscQueue.h"
+#include "SpscRing.h"
+#include "AllocationGuard.h"
+
 namespace Sonot {
 
+namespace {
+
+    /** Samples in the ring, the upper limit for the block size
+        and the lookahead */
+    const size_t kRingSize = 16384;
+
+    /** Raises the priority of the calling thread, if permitted */
+    void setHighPriority()
+    {
+#if defined(_WIN32)
+        SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL);
+#elif defined(__unix__) || defined(__APPLE__)
+        // real-time scheduling needs privileges,
+        // the thread keeps the normal priority otherwise
+        sched_param param;
+        param.sched_priority = sched_get_priority_min(SCHED_FIFO);
+        pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+#endif
+    }
+
+} // namespace
+
 
 struct SynthDevice::Private
 {
     Private(SynthDevice* p)
         : p             (p)
-        , buffer        (1024)
-        , consumed      (0)
+        , ring          (kRingSize)
+        , blockSize     (256)
         , synth         ()
         , playing       (false)
-        , score         (nullptr)
-        , index         ()
+        , timeline      (nullptr)
         , curSample     (0)
-        , curBarTime    (0.)
+        , playPosition  (0)
+        , playNoteIndex (0)
+        , controlScore  (nullptr)
+        , controlBlockSize(blockSize)
+        , commands      (1024)
+        // every queued command can hand back its Properties
+        , trash         (commands.capacity())
+        , timelineTrash (16)
+        , loads         (2)
+        , indices       (64)
+        , threadRunning (false)
+        , threadQuit    (false)
+        , renderingInline(false)
+        , lookahead     (4096)
+        , fill          (0)
+        , lowWatermark  (std::numeric_limits<size_t>::max())
+        , highWatermark (0)
+        , underruns     (0)
+        , underrunSamples(0)
     {
 
     }
 
-    bool fillBuffer();
+    ~Private()
+    {
+        Command c;
+        while (commands.pop(c))
+        {
+            delete c.props;
+            delete c.timeline;
+        }
+        for (Command& c : pending)
+        {
+            delete c.props;
+            delete c.timeline;
+        }
+        emptyTrash();
+        delete timeline;
+    }
 
-    struct PlayNote
+    /** Messages from the GUI thread to the render side */
+    struct Command
     {
+        enum Type
+        {
+            C_PLAY_NOTE,
+            C_PLAYING,
+            C_POSITION,
+            C_SCORE,
+            C_TIMELINE,
+            C_BLOCK_SIZE,
+            C_PROPERTIES,
+            C_MOD_PROPERTIES
+        };
+
+        Command() : props(nullptr), timeline(nullptr) { }
+
+        Type type;
         int8_t note;
-        int64_t idx;
-        double duration, started;
+        bool playing;
+        size_t modIndex;
+        size_t blockSize;
+        double duration;
+        uint64_t sample;
+        /** Owned by the command, handed back through trash */
+        QProps::Properties* props;
+        /** Compiled on the GUI side, owned by the render side
+            and handed back through timelineTrash */
+        SynthTimeline* timeline;
     };
 
+    // --- render side ---
+
+    /** Renders up to one block into the ring,
+        returns the number of samples, 0 if the ring is full */
+    size_t renderBlock();
+    /** Keeps the ring filled up to the lookahead */
+    void renderLoop();
+    /** Executes all commands from the GUI thread */
+    void applyCommands();
+    void apply(Command& c);
+
+    // --- GUI side ---
+
+    /** Queues a command for the render side */
+    void send(const Command& c);
+    /** Deletes the Properties and timelines that the
+        render side is done with */
+    void emptyTrash();
+    /** Sends a copy of controlTimeline to the render side */
+    void sendTimeline(Command::Type type);
+
     SynthDevice* p;
 
-    std::vector<char> buffer;
-    qint64 consumed;
+    // render-side state, only touched in renderBlock()
+    /** Rendered samples that readData() did not request yet */
+    SpscRing ring;
+    size_t blockSize;
     Synth synth;
     bool playing;
-    const Score* score;
-    Score::Index index;
-    uint64_t curSample;
-    double curBarTime;
-    std::list<PlayNote> playNotes;
+    SynthSequencer sequencer;
+    /** The timeline of the sequencer */
+    SynthTimeline* timeline;
+    /** Written by the render side, read by currentSecond() */
+    std::atomic<uint64_t> curSample;
+    /** Written by the render side, read by playSecond() */
+    std::atomic<uint64_t> playPosition;
+    /** Counter for the userIndex of preview notes */
+    int64_t playNoteIndex;
+    /** The last index that was handed over through indices */
+    Score::Index lastIndex;
+
+    // GUI-side state
+    /** Copy of the synth properties for the GUI */
+    SynthSettings control;
+    const Score* controlScore;
+    size_t controlBlockSize;
+    /** Edited along with controlScore, the render side gets copies
+        which share the events of unchanged bars */
+    SynthTimeline controlTimeline;
+    /** Commands that did not fit into the ring */
+    std::deque<Command> pending;
+
+    SpscQueue<Command> commands;
+    SpscQueue<QProps::Properties*> trash;
+    SpscQueue<SynthTimeline*> timelineTrash;
+    /** Load counters from the render side, see loadStats() */
+    SpscQueue<SynthLoad::Stats> loads;
+    SynthLoad::Stats lastLoads;
+    /** Sequencer index changes, emitted by readData() */
+    SpscQueue<Score::Index> indices;
+
+    // optional render thread
+    std::thread thread;
+    std::atomic<bool> threadRunning, threadQuit;
+    /** Set by readData() while it renders without the thread */
+    std::atomic<bool> renderingInline;
+    std::atomic<size_t> lookahead;
+    /** Only for waiting, readData() notifies without locking */
+    std::mutex threadMutex;
+    std::condition_variable threadCond;
+
+    // written by readData(), see bufferStats()
+    std::atomic<size_t> fill, lowWatermark, highWatermark;
+    std::atomic<uint64_t> underruns, underrunSamples;
 };
 
 
@@ -82,235 +236,426 @@ SynthDevice::SynthDevice(QObject* parent)
 
 SynthDevice::~SynthDevice()
 {
+    setRenderThread(false);
     delete p_;
 }
 
 
 qint64 SynthDevice::readData(char *data, qint64 maxlen)
 {
-    qint64 written = 0;
-
-    while (written < maxlen)
+    float* out = reinterpret_cast<float*>(data);
+    const size_t len = size_t(maxlen) / sizeof(float);
+
+    // fill statistics
+    const size_t f = p_->ring.size();
+    p_->fill.store(f, std::memory_order_relaxed);
+    if (f < p_->lowWatermark.load(std::memory_order_relaxed))
+        p_->lowWatermark.store(f, std::memory_order_relaxed);
+    if (f > p_->highWatermark.load(std::memory_order_relaxed))
+        p_->highWatermark.store(f, std::memory_order_relaxed);
+
+    // announce inline rendering before checking for the thread,
+    // setRenderThread() waits for this flag before starting one
+    size_t written = 0;
+    p_->renderingInline.store(true);
+    if (p_->threadRunning.load())
     {
-        if (p_->consumed >= (qint64)p_->buffer.size())
+        p_->renderingInline.store(false);
+        // only drain, the render thread fills up
+        written = p_->ring.read(out, len);
+        p_->threadCond.notify_one();
+        if (written < len)
         {
-            auto oldIdx = p_->index;
-            bool ret = p_->fillBuffer();
-            if (p_->index != oldIdx)
-                emit indexChanged(p_->index);
-            if (!ret)
-                return written;
-
-            p_->consumed = 0;
+            std::memset(out + written, 0, (len - written) * sizeof(float));
+            ++p_->underruns;
+            p_->underrunSamples += len - written;
+            written = len;
         }
-
-        while (written < maxlen && p_->buffer.size() - p_->consumed > 0)
+    }
+    else
+    {
+        while (written < len)
         {
-            *data = p_->buffer[p_->consumed];
-            ++data;
-            ++p_->consumed;
-            ++written;
+            // render whole blocks until the request can be served
+            {
+                AllocationGuard guard;
+                while (p_->ring.size() < len - written && p_->renderBlock())
+                    ;
+            }
+            written += p_->ring.read(out + written, len - written);
         }
+        p_->renderingInline.store(false);
     }
 
-    return written;
+    Score::Index idx;
+    bool changed = false;
+    while (p_->indices.pop(idx))
+        changed = true;
+    if (changed)
+        emit indexChanged(idx);
+
+    return written * sizeof(float);
 }
 
-const Synth& SynthDevice::synth() const { return p_->synth; }
-const Score* SynthDevice::score() const { return p_->score; }
+const SynthSettings& SynthDevice::synth() const { return p_->control; }
+const Score* SynthDevice::score() const { return p_->controlScore; }
 
-size_t SynthDevice::sampleRate() const { return p_->synth.sampleRate(); }
-size_t SynthDevice::bufferSize() const
-    { return p_->buffer.size() / sizeof(float); }
+size_t SynthDevice::sampleRate() const { return p_->control.sampleRate(); }
+size_t SynthDevice::blockSize() const { return p_->controlBlockSize; }
+size_t SynthDevice::lookahead() const { return p_->lookahead; }
+bool SynthDevice::isRenderThread() const { return p_->threadRunning; }
 double SynthDevice::currentSecond() const
     { return double(p_->curSample) / std::max(size_t(1), sampleRate()); }
+const SynthTimeline& SynthDevice::timeline() const
+    { return p_->controlTimeline; }
+double SynthDevice::playSecond() const
+    { return p_->controlTimeline.toSeconds(p_->playPosition); }
+
+SynthLoad::Stats SynthDevice::loadStats() const
+{
+    SynthLoad::Stats s;
+    while (p_->loads.pop(s))
+        p_->lastLoads = s;
+    return p_->lastLoads;
+}
+
+SynthDevice::BufferStats SynthDevice::bufferStats() const
+{
+    BufferStats s;
+    s.fill = p_->fill;
+    s.lowWatermark = p_->lowWatermark.exchange(
+                std::numeric_limits<size_t>::max());
+    s.highWatermark = p_->highWatermark.exchange(0);
+    // no readData() since the last call
+    if (s.lowWatermark > s.highWatermark)
+        s.lowWatermark = s.highWatermark = s.fill;
+    s.underruns = p_->underruns;
+    s.underrunSamples = p_->underrunSamples;
+    s.lookahead = p_->lookahead;
+    s.capacity = p_->ring.capacity();
+    return s;
+}
 
 
 void SynthDevice::setScore(const Score* score)
 {
-    p_->score = score;
-    p_->index = p_->score->index(p_->index.stream(), p_->index.bar(),
-                             p_->index.row(), p_->index.column());
-    p_->synth.notesOff();
-    p_->curSample = 0;
-    p_->curBarTime = 0;
+    p_->controlScore = score;
+    if (score)
+        p_->controlTimeline.compile(*score, sampleRate());
+    p_->sendTimeline(Private::Command::C_SCORE);
 }
 
-void SynthDevice::setIndex(const Score::Index& idx)
+void SynthDevice::updateScore()
 {
-    p_->index = idx;
-    p_->curBarTime = 0;
+    if (!p_->controlScore)
+        return;
+    p_->controlTimeline.compile(*p_->controlScore, sampleRate());
+    p_->sendTimeline(Private::Command::C_TIMELINE);
 }
 
-void SynthDevice::setPlaying(bool e)
+void SynthDevice::updateBars(const QList<Score::Index>& indices)
 {
-    p_->playing = e;
-    p_->synth.notesOff();
+    if (!p_->controlScore)
+        return;
+    for (const Score::Index& idx : indices)
+        p_->controlTimeline.updateBar(idx.stream(), idx.bar());
+    p_->sendTimeline(Private::Command::C_TIMELINE);
 }
 
-void SynthDevice::setSynthProperties(const QProps::Properties& p)
+void SynthDevice::updateStreams(const QList<Score::Index>& indices)
 {
-    p_->synth.setProperties(p);
+    if (!p_->controlScore)
+        return;
+    for (const Score::Index& idx : indices)
+        p_->controlTimeline.updateStream(idx.stream());
+    p_->sendTimeline(Private::Command::C_TIMELINE);
 }
 
-void SynthDevice::setSynthModProperties(size_t idx,
-                                        const QProps::Properties& p)
+void SynthDevice::setIndex(const Score::Index& idx)
 {
-    p_->synth.setModProperties(idx, p);
+    // resolved here, the render side must not read the Score
+    Private::Command c;
+    c.type = Private::Command::C_POSITION;
+    c.sample = p_->controlTimeline.indexSample(idx);
+    p_->send(c);
 }
 
-void SynthDevice::playNote(int8_t note, double duration)
+void SynthDevice::setPosition(double second)
 {
-    Private::PlayNote n;
-    n.note = note;
-    n.started = -1.;
-    n.duration = duration;
-    p_->playNotes.push_back( n );
+    Private::Command c;
+    c.type = Private::Command::C_POSITION;
+    c.sample = p_->controlTimeline.toSample(second);
+    p_->send(c);
 }
 
-bool SynthDevice::Private::fillBuffer()
+void SynthDevice::setBlockSize(size_t samples)
 {
-    // length of dsp buffer in samples
-    double bufferLength = (double)p->bufferSize() / p->sampleRate();
+    size_t b = 16;
+    while (b < samples && b < kRingSize / 2)
+        b <<= 1;
+    p_->controlBlockSize = b;
+
+    Private::Command c;
+    c.type = Private::Command::C_BLOCK_SIZE;
+    c.blockSize = b;
+    p_->send(c);
+}
 
-    if (playing && score && index.isValid() && index.score() == score)
-    {
-        // seconds per bar
-        double barLength = index.getBarLengthSeconds();
-        // seconds in dsp block
-        double procTime = 0.;
+void SynthDevice::setLookahead(size_t samples)
+{
+    p_->lookahead = std::max(size_t(16),
+                             std::min(samples, p_->ring.capacity()));
+    p_->threadCond.notify_one();
+}
 
-        SONOT_DEBUG_SYNTH("--- dsp-block --- " << p->bufferSize());
+void SynthDevice::setRenderThread(bool enable)
+{
+    if (enable == isRenderThread())
+        return;
 
-        while (procTime < bufferLength)
+    // only one of readData() and the thread may render at any time
+    if (enable)
+    {
+        p_->threadQuit = false;
+        p_->threadRunning.store(true);
+        // let a readData() finish that already renders inline
+        while (p_->renderingInline.load())
+            std::this_thread::yield();
+        p_->thread = std::thread([=](){ p_->renderLoop(); });
+    }
+    else
+    {
         {
-            SONOT_DEBUG_SYNTH("while(procTime < bufferLength) "
-                              << "procTime" << procTime
-                              << ", curBarTime" << curBarTime
-                              << ", bufferLength" << bufferLength
-                              << ", barLength" << barLength);
-
-            // go to next bar
-            if (curBarTime >= barLength)
-            {
-                SONOT_DEBUG_SYNTH("next bar");
-                bool enablePause = index.getStream().isPauseOnEnd(),
-                        doPause = index.isLastBar() && enablePause;
-                size_t numRows = index.numRows();
-                if (!index.nextBar())
-                {
-                    // start again
-                    index = score->index(0,0,0,0);
-                    doPause = enablePause;
-                }
-                // note-off at stream end
-                /// @todo this is not timed within the dsp-block!
-                if (doPause)
-                    for (size_t r=0; r<numRows; ++r)
-                        synth.noteOffByIndex(r, 0);
-
-                if (!index.isValid())
-                    barLength = index.getBarLengthSeconds();
-                // wait one bar length
-                curBarTime = doPause ? -barLength : 0.;
-            }
+            std::lock_guard<std::mutex> lock(p_->threadMutex);
+            p_->threadQuit = true;
+        }
+        p_->threadCond.notify_one();
+        p_->thread.join();
+        p_->threadRunning.store(false);
+    }
+}
 
-            Score::Index cursor = index.topLeft();
-            if (!cursor.isValid())
-                break;
+void SynthDevice::setPlaying(bool e)
+{
+    Private::Command c;
+    c.type = Private::Command::C_PLAYING;
+    c.playing = e;
+    p_->send(c);
+}
+
+void SynthDevice::setSynthProperties(const QProps::Properties& p)
+{
+    p_->control.setProperties(p);
+    Private::Command c;
+    c.type = Private::Command::C_PROPERTIES;
+    c.props = new QProps::Properties(p);
+    p_->send(c);
+
+    // timeline is in samples
+    if (p_->controlTimeline.sampleRate() != sampleRate())
+        updateScore();
+}
+
+void SynthDevice::setSynthModProperties(size_t idx,
+                                        const QProps::Properties& p)
+{
+    p_->control.setModProperties(idx, p);
+    Private::Command c;
+    c.type = Private::Command::C_MOD_PROPERTIES;
+    c.modIndex = idx;
+    c.props = new QProps::Properties(p);
+    p_->send(c);
+}
 
-            double windowLength = std::min(bufferLength - procTime,
-                                           barLength - curBarTime);
+void SynthDevice::playNote(int8_t note, double duration)
+{
+    Private::Command c;
+    c.type = Private::Command::C_PLAY_NOTE;
+    c.note = note;
+    c.duration = duration;
+    p_->send(c);
+}
 
-            SONOT_DEBUG_SYNTH("processing bar window "
-                              << curBarTime << " to "
-                              << (curBarTime + windowLength)
-                              << " , len=" << windowLength);
+void SynthDevice::Private::send(const Command& c)
+{
+    emptyTrash();
 
-            KeySignature keysig = cursor.getStream().keySignature();
+    // keep the order of commands that did not fit before
+    while (!pending.empty() && commands.push(pending.front()))
+        pending.pop_front();
 
-            // send all notes in bar window to synth
-            for (size_t r=0; r<cursor.getStream().numRows(); ++r)
-            {
-                const Notes& notes = cursor.getNotes(r);
-                for (size_t c=0; c<notes.length(); ++c)
-                {
-                    Note n = keysig.transform(notes.note(c));
-                    if (!n.isValid())
-                        continue;
-
-                    // window-local time
-                    double ltime = barLength * notes.columnTime(c) - curBarTime;
-                    if (ltime >= 0 && ltime < windowLength)
-                    {
-                        size_t samplePos = (procTime + ltime) * p->sampleRate();
-
-                        // stop prev note
-                        if (n.value() != Note::Space)
-                        {
-                            synth.noteOffByIndex(r, samplePos);
-                        }
-                        if (n.isNote())
-                        {
-                            synth.noteOn(n.value(), 0.1, samplePos, r);
-                        }
-                    }
-                }
-            }
+    if (!pending.empty() || !commands.push(c))
+        pending.push_back(c);
+}
 
-            SONOT_DEBUG_SYNTH("fed " << windowLength);
+void SynthDevice::Private::emptyTrash()
+{
+    QProps::Properties* props;
+    while (trash.pop(props))
+        delete props;
+    SynthTimeline* t;
+    while (timelineTrash.pop(t))
+        delete t;
+}
 
-            curBarTime += windowLength;
-            procTime += windowLength;
-        }
-    }
+void SynthDevice::Private::sendTimeline(Command::Type type)
+{
+    Command c;
+    c.type = type;
+    if (controlScore)
+        c.timeline = new SynthTimeline(controlTimeline);
+    send(c);
+}
 
+void SynthDevice::Private::applyCommands()
+{
+    Command c;
+    while (commands.pop(c))
+        apply(c);
+}
 
-    // also add all PlayNote requests
-    std::list<PlayNote> notes;
-    for (PlayNote& n : playNotes)
+void SynthDevice::Private::apply(Command& c)
+{
+    switch (c.type)
     {
-        if (n.started < 0.)
+        case Command::C_PLAY_NOTE:
         {
-            n.idx = 10000 + playNotes.size();
-            n.started = p->currentSecond();
-            synth.noteOn(n.note, 0.1, 0, n.idx);
+            // keep clear of the row indices used in renderBlock()
+            const int64_t idx = 10000 + (playNoteIndex++ % 10000);
+            synth.noteOn(c.note, 0.1, 0, idx);
+            synth.noteOffByIndex(idx, c.duration * synth.sampleRate());
         }
+        break;
+
+        case Command::C_PLAYING:
+            playing = c.playing;
+            synth.notesOff();
+        break;
+
+        case Command::C_POSITION:
+            sequencer.setPosition(c.sample);
+            playPosition = sequencer.position();
+        break;
+
+        case Command::C_SCORE:
+            std::swap(timeline, c.timeline);
+            sequencer.setTimeline(timeline);
+            synth.notesOff();
+            curSample = 0;
+        break;
+
+        // the score was edited
+        case Command::C_TIMELINE:
+            std::swap(timeline, c.timeline);
+            sequencer.updateTimeline(timeline);
+        break;
+
+        case Command::C_BLOCK_SIZE:
+            blockSize = c.blockSize;
+        break;
+
+        // property changes may resize the voice storage
+        case Command::C_PROPERTIES:
+        {
+            AllocationGuard::Exception allowAlloc;
+            synth.setProperties(*c.props);
+        }
+        break;
 
-        // stop when duration is within this window
-        double d = p->currentSecond() - n.started
-                 - n.duration + bufferLength;
-        if (d > 0. && d < bufferLength)
+        case Command::C_MOD_PROPERTIES:
         {
-            synth.noteOffByIndex(n.idx, std::min(
-                                     p->bufferSize()-1,
-                                     size_t(d * p->sampleRate())));
-            continue;
+            AllocationGuard::Exception allowAlloc;
+            synth.setModProperties(c.modIndex, *c.props);
         }
+        break;
+    }
+
+    // hand back for deletion on the GUI thread
+    if (c.props && !trash.push(c.props))
+    {
+        AllocationGuard::Exception allowFree;
+        delete c.props;
+    }
+    if (c.timeline && !timelineTrash.push(c.timeline))
+    {
+        AllocationGuard::Exception allowFree;
+        delete c.timeline;
+    }
+}
+
+size_t SynthDevice::Private::renderBlock()
+{
+    applyCommands();
+
+    // render straight into the ring, the block is shorter
+    // only at the wrap-around after a block size change
+    size_t len;
+    float* out = ring.writeRegion(&len);
+    len = std::min(len, blockSize);
+    if (!len)
+        return 0;
 
-        notes.push_back(n);
+    if (playing)
+    {
+        sequencer.feed(synth, len);
+        playPosition = sequencer.position();
+    }
+    if (sequencer.index() != lastIndex)
+    {
+        lastIndex = sequencer.index();
+        indices.push(lastIndex);
     }
-    playNotes.swap(notes);
 
     // execute synth block
-    synth.process(reinterpret_cast<float*>(buffer.data()),
-                    p->bufferSize());
-    curSample += p->bufferSize();
+    synth.process(out, len);
+    ring.commit(len);
+    curSample += len;
+
+    // only hand over when the last copy was picked up
+    if (loads.isEmpty())
+        loads.push(synth.loadStats());
 
-    return true;
+    return len;
+}
+
+void SynthDevice::Private::renderLoop()
+{
+    setHighPriority();
+    AllocationGuard guard;
+
+    while (!threadQuit)
+    {
+        while (!threadQuit && ring.size() < lookahead && renderBlock())
+            ;
+
+        // wait until readData() took something,
+        // or for a quarter of the lookahead
+        const auto timeout = std::chrono::microseconds(
+                    std::max(uint64_t(500), uint64_t(lookahead) * 250000
+                             / std::max(size_t(1), synth.sampleRate())));
+        std::unique_lock<std::mutex> lock(threadMutex);
+        if (!threadQuit)
+            threadCond.wait_for(lock, timeout);
+    }
 }
 
 QJsonObject SynthDevice::toJson() const
 {
     QJsonObject o;
-    o.insert("synth", p_->synth.toJson());
+    o.insert("synth", p_->control.toJson());
     return o;
 }
 
 void SynthDevice::fromJson(const QJsonObject& o)
 {
     QProps::JsonInterfaceHelper json("SynthDevice");
-    p_->synth.fromJson( json.expectChildObject(o, "synth") );
+    p_->control.fromJson( json.expectChildObject(o, "synth") );
+
+    // pass on to the render side
+    const SynthSettings& s = p_->control;
+    setSynthProperties(s.props());
+    for (size_t i=0; i<s.numberModVoices(); ++i)
+        setSynthModProperties(i, s.modProps(i));
 }
 
 
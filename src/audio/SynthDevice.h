@@ -24,14 +24,34 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 #include <vector>
 
 #include <QIODevice>
+#include <QList>
 
 #include "QProps/JsonInterface.h"
 
 #include "Synth.h"
+#include "SynthSettings.h"
 #include "core/Score.h"
 
 namespace Sonot {
 
+class SynthTimeline;
+
+/** QIODevice that renders the Score through a Synth.
+
+    readData() runs on the audio pull path. All slots are meant to be
+    called from the GUI thread; they only post commands into a
+    wait-free queue, which readData() executes at the start of each
+    block. The audio path therefore never locks and never touches
+    state that the GUI modifies.
+
+    Rendering happens in blocks of blockSize() into a ring buffer,
+    readData() copies the requested amount out of it, and the rest
+    of the last block stays for the next call.
+
+    With setRenderThread(), a separate high-priority thread keeps
+    the ring filled up to lookahead() and readData() only copies,
+    so an expensive block does not stall the audio pull directly.
+    The lookahead adds latency, bufferStats() helps to choose it. */
 class SynthDevice : public QIODevice
                   , public QProps::JsonInterface
 {
@@ -53,20 +73,79 @@ public:
     QJsonObject toJson() const override;
     void fromJson(const QJsonObject&) override;
 
-    const Synth& synth() const;
+    /** The GUI-side copy of the synth properties */
+    const SynthSettings& synth() const;
     const Score* score() const;
 
     size_t sampleRate() const;
-    size_t bufferSize() const;
+    /** Number of samples rendered at once, independent of the
+        amount that readData() is asked for */
+    size_t blockSize() const;
 
     double currentSecond() const;
 
+    /** The timeline of score(), to map between score
+        indices and seconds, e.g. for a scrub bar */
+    const SynthTimeline& timeline() const;
+    /** Play position in score(), in seconds
+        since the start of the first bar */
+    double playSecond() const;
+
+    /** Load counters of the rendering synth, see Synth::loadStats().
+        They are handed over once per buffer, so they reflect the
+        state shortly after the previous call. */
+    SynthLoad::Stats loadStats() const;
+
+    /** Fill level of the ring buffer, as seen by readData() */
+    struct BufferStats
+    {
+        /** Samples rendered ahead at the last readData() */
+        size_t fill;
+        /** Lowest and highest fill since the last call
+            of bufferStats() */
+        size_t lowWatermark, highWatermark;
+        /** Number of readData() calls that found not enough samples
+            and the number of samples that were replaced by silence,
+            only happens with the render thread */
+        uint64_t underruns, underrunSamples;
+        size_t lookahead, capacity;
+    };
+
+    /** Returns the buffer statistics and resets the watermarks */
+    BufferStats bufferStats() const;
+
+    /** Samples that the render thread keeps ahead */
+    size_t lookahead() const;
+    bool isRenderThread() const;
+
 public slots:
 
     void setScore(const Score* score);
+    /** Recompiles the timeline of score() after it was edited.
+        Playback continues at the same position in the current bar. */
+    void updateScore();
+    /** Recompiles only the bars of the indices, after their
+        notes were edited. Later bars are moved, not recompiled. */
+    void updateBars(const QList<Score::Index>& indices);
+    /** Recompiles the streams of the indices, after bars were
+        inserted or deleted or stream properties changed. */
+    void updateStreams(const QList<Score::Index>& indices);
+    /** Continues playback at the column of @p index */
     void setIndex(const Score::Index& index);
+    /** Continues playback at @p second of score(), see playSecond() */
+    void setPosition(double second);
 
     void setPlaying(bool e);
+    /** Sets the render block size, rounded up to a power of two
+        between 16 and 8192. Larger blocks are more efficient,
+        smaller blocks react faster to commands. */
+    void setBlockSize(size_t samples);
+    /** Sets the number of samples that the render thread keeps ahead,
+        up to the ring capacity of 16384 */
+    void setLookahead(size_t samples);
+    /** Starts or stops the render thread. Call this from the thread
+        that calls readData(), normally the GUI thread in pull mode. */
+    void setRenderThread(bool enable);
 
     void setSynthProperties(const QProps::Properties& p);
     void setSynthModProperties(size_t idx, const QProps::Properties& p);
@@ -0,0 +1,131 @@
+/***************************************************************************
+
+Copyright (C) 2016  stefan.berke @ modular-audio-graphics.com
+
+This source is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either
+version 3.0 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this software; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+****************************************************************************/
+
+#ifndef SONOTSRC_SYNTHEVENTQUEUE_H
+#define SONOTSRC_SYNTHEVENTQUEUE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <vector>
+
+namespace Sonot {
+
+/** Time-ordered queue of voice start/stop events for the Synth.
+
+    Events carry absolute sample times. Events with the same time
+    are returned in the order they were pushed.
+    Each event also carries the generation of the voice at the time
+    it was scheduled, so events for a voice that has been reused
+    in the meantime can be recognized and dropped.
+
+    The reserved capacity is a hard limit, push() never allocates.
+    Events pushed to a full queue are dropped and counted. */
+class SynthEventQueue
+{
+public:
+
+    enum Type
+    {
+        E_START,
+        E_STOP
+    };
+
+    struct Event
+    {
+        uint64_t time, seq;
+        size_t voice;
+        uint32_t generation;
+        Type type;
+    };
+
+    SynthEventQueue() : p_seq(0), p_dropped(0) { }
+
+    // ------------ getter -------------
+
+    bool isEmpty() const { return p_heap.empty(); }
+    size_t size() const { return p_heap.size(); }
+    size_t capacity() const { return p_heap.capacity(); }
+    bool isFull() const { return p_heap.size() >= p_heap.capacity(); }
+    /** Number of events that push() dropped because the queue was full */
+    size_t numDropped() const { return p_dropped; }
+
+    /** The earliest event. Queue must not be empty. */
+    const Event& top() const { return p_heap.front(); }
+
+    // ----------- setter --------------
+
+    /** Sets the capacity, which is kept by clear() */
+    void reserve(size_t num) { p_heap.reserve(num); }
+
+    void clear() { p_heap.clear(); }
+
+    /** Inserts an event, or returns false and drops it if the
+        queue is full. Does not allocate. */
+    bool push(uint64_t time, size_t voice, uint32_t generation, Type type)
+    {
+        if (isFull())
+        {
+            ++p_dropped;
+            return false;
+        }
+        Event e;
+        e.time = time;
+        e.seq = p_seq++;
+        e.voice = voice;
+        e.generation = generation;
+        e.type = type;
+        p_heap.push_back(e);
+        std::push_heap(p_heap.begin(), p_heap.end(), later);
+        return true;
+    }
+
+    /** Removes all events for which @p pred(event) is true.
+        Does not allocate. */
+    template <class Pred>
+    void removeIf(Pred pred)
+    {
+        p_heap.erase(std::remove_if(p_heap.begin(), p_heap.end(), pred),
+                     p_heap.end());
+        std::make_heap(p_heap.begin(), p_heap.end(), later);
+    }
+
+    /** Removes the earliest event */
+    void pop()
+    {
+        std::pop_heap(p_heap.begin(), p_heap.end(), later);
+        p_heap.pop_back();
+    }
+
+private:
+
+    static bool later(const Event& a, const Event& b)
+    {
+        return a.time > b.time || (a.time == b.time && a.seq > b.seq);
+    }
+
+    std::vector<Event> p_heap;
+    uint64_t p_seq;
+    size_t p_dropped;
+};
+
+} // namespace Sonot
+
+#endif // SONOTSRC_SYNTHEVENTQUEUE_H
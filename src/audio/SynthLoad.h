@@ -0,0 +1,178 @@
+/***************************************************************************
+
+Copyright (C) 2016  stefan.berke @ modular-audio-graphics.com
+
+This source is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either
+version 3.0 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this software; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+****************************************************************************/
+
+#ifndef SONOTSRC_SYNTHLOAD_H
+#define SONOTSRC_SYNTHLOAD_H
+
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+
+namespace Sonot {
+
+/** Adaptive quality control of the Synth.
+
+    update() is fed with the time it took to render a block and
+    compares it against the real-time budget of that block.
+    Above the high limit, the quality is lowered by one step per
+    block. It is raised by one step again, once the load stayed
+    below the low limit for the hold time.
+    Every transition is counted in stats(). */
+class SynthLoad
+{
+public:
+
+    /** Quality steps, each one includes the ones before */
+    enum Quality
+    {
+        /** Everything as configured */
+        Q_FULL,
+        /** Only the first unisono voice is rendered */
+        Q_NO_UNISON,
+        /** The cheapest oscillator tier is used */
+        Q_CHEAP_OSCILLATOR,
+        /** Modulator envelopes run at control rate */
+        Q_CONTROL_RATE,
+        /** Quiet voices are ended */
+        Q_STEAL_VOICES
+    };
+    static constexpr size_t numQualities() { return 5; }
+
+    /** Counters for monitoring */
+    struct Stats
+    {
+        Stats() { reset(); }
+        void reset()
+        {
+            blocks = overruns = 0;
+            std::fill(degrades, degrades + numQualities(), 0);
+            std::fill(recoveries, recoveries + numQualities(), 0);
+            load = maxLoad = 0.;
+            quality = Q_FULL;
+        }
+
+        /** Number of measured blocks */
+        uint64_t blocks;
+        /** Number of blocks that took longer than real-time */
+        uint64_t overruns;
+        /** Number of transitions into the quality step */
+        uint64_t degrades[Q_STEAL_VOICES + 1];
+        /** Number of transitions back out of the quality step */
+        uint64_t recoveries[Q_STEAL_VOICES + 1];
+        /** Last and highest load, as fraction of the real-time budget */
+        double load, maxLoad;
+        Quality quality;
+    };
+
+    SynthLoad()
+        : p_sampleRate  (44100),
+          p_high        (.8),
+          p_low         (.5),
+          p_hold        (44100),
+          p_holdSeconds (1.),
+          p_calm        (0)
+    { }
+
+    // ------------ getter -------------
+
+    Quality quality() const { return p_stats.quality; }
+    const Stats& stats() const { return p_stats; }
+
+    // ----------- setter --------------
+
+    void setSampleRate(size_t sr)
+        { p_sampleRate = sr; p_hold = p_holdSeconds * sr; }
+
+    /** Sets the load above which the quality is lowered,
+        the load below which it is raised again after
+        @p holdSeconds, both as fraction of the real-time budget */
+    void setLimits(double high, double low, double holdSeconds)
+    {
+        p_high = high;
+        p_low = std::min(low, high);
+        p_holdSeconds = holdSeconds;
+        p_hold = holdSeconds * p_sampleRate;
+    }
+
+    /** Sets the quality step, without counting a transition */
+    void setQuality(Quality q) { p_stats.quality = q; p_calm = 0; }
+
+    /** Resets the counters, but keeps the quality step */
+    void resetStats()
+    {
+        const Quality q = p_stats.quality;
+        p_stats.reset();
+        p_stats.quality = q;
+    }
+
+    // --------- processing ------------
+
+    /** Feeds the @p seconds it took to render @p num samples.
+        Returns true if the quality step changed */
+    bool update(double seconds, size_t num)
+    {
+        if (!num)
+            return false;
+
+        const double load = seconds * p_sampleRate / num;
+        ++p_stats.blocks;
+        if (load > 1.)
+            ++p_stats.overruns;
+        p_stats.load = load;
+        p_stats.maxLoad = std::max(p_stats.maxLoad, load);
+
+        Quality& q = p_stats.quality;
+        if (load > p_high)
+        {
+            p_calm = 0;
+            if (q == Q_STEAL_VOICES)
+                return false;
+            q = Quality(q + 1);
+            ++p_stats.degrades[q];
+            return true;
+        }
+
+        if (load >= p_low || q == Q_FULL)
+        {
+            p_calm = 0;
+            return false;
+        }
+        p_calm += num;
+        if (p_calm < p_hold)
+            return false;
+
+        p_calm = 0;
+        ++p_stats.recoveries[q];
+        q = Quality(q - 1);
+        return true;
+    }
+
+private:
+
+    size_t p_sampleRate;
+    double p_high, p_low, p_hold, p_holdSeconds;
+    /** Samples rendered below the low limit */
+    double p_calm;
+    Stats p_stats;
+};
+
+} // namespace Sonot
+
+#endif // SONOTSRC_SYNTHLOAD_H
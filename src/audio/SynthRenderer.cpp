@@ -0,0 +1,434 @@
+/***************************************************************************
+
+Copyright (C) 2016  stefan.berke @ modular-audio-graphics.com
+
+This source is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either
+version 3.0 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this software; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+****************************************************************************/
+
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <memory>
+#include <vector>
+
+#include <QFileInfo>
+#include <QDir>
+
+#include "SynthRenderer.h"
+#include "SynthSequencer.h"
+#include "SynthSettings.h"
+#include "SynthTimeline.h"
+#include "SynthWorkerPool.h"
+#include "Synth.h"
+#include "core/Score.h"
+
+namespace Sonot {
+
+struct SynthRenderer::Private
+{
+    Private()
+        : chunkSize (4096)
+        , format    (WavWriter::F_INT16)
+        , maxTail   (10.)
+        , numThreads(1)
+    { }
+
+    /** One row of one stream in the parallel render */
+    struct Part
+    {
+        size_t stream;
+        int row;
+        /** First sample in the output */
+        uint64_t start;
+        std::vector<float> audio;
+        bool done;
+    };
+
+    void render(const Score& score, WavWriter& wav);
+    /** Calls render() or renderStems() and times it */
+    template <class Render>
+    void timed(Render render);
+    void renderSerial(const Score& score, WavWriter& wav);
+    void renderParallel(const Score& score, WavWriter& wav, size_t threads);
+    /** Creates the Part list from the streams of the timeline */
+    void createParts();
+    /** Renders part @p i and mixes all finished parts in order */
+    void renderPart(size_t i);
+    static void renderPartFunc(void* context, size_t i)
+        { static_cast<Private*>(context)->renderPart(i); }
+
+    /** Sets the properties of control to @p synth,
+        @p singleThread disables the voice threads */
+    void setupSynth(Synth& synth, bool singleThread) const;
+    /** Feeds @p sequencer to @p synth until the end of the score
+        and the release tail. Each chunk is rendered and written by
+        @p process(size_t length). Returns the number of samples. */
+    template <class Process>
+    uint64_t renderSequence(Synth& synth, SynthSequencer& sequencer,
+                            Process process) const;
+    /** Renders all rows into the buses of @p stems in one pass */
+    void renderStems(const Score& score, std::vector<WavWriter*>& stems);
+
+    /** A fresh Synth renders each score */
+    SynthSettings control;
+    size_t chunkSize;
+    WavWriter::Format format;
+    double maxTail;
+    size_t numThreads;
+    Stats stats;
+
+    // parallel render state
+    SynthTimeline timeline;
+    std::vector<Part> parts;
+    std::vector<float> mix;
+    /** Index of the next part to mix */
+    size_t nextMix;
+    std::mutex mixMutex;
+    /** The first exception of a worker, rethrown by renderParallel() */
+    std::exception_ptr error;
+};
+
+SynthRenderer::SynthRenderer()
+    : p_    (new Private())
+{
+}
+
+SynthRenderer::~SynthRenderer()
+{
+    delete p_;
+}
+
+const SynthSettings& SynthRenderer::synth() const { return p_->control; }
+size_t SynthRenderer::chunkSize() const { return p_->chunkSize; }
+WavWriter::Format SynthRenderer::format() const { return p_->format; }
+double SynthRenderer::maxTail() const { return p_->maxTail; }
+size_t SynthRenderer::numThreads() const { return p_->numThreads; }
+const SynthRenderer::Stats& SynthRenderer::stats() const { return p_->stats; }
+
+void SynthRenderer::setSynth(const SynthSettings& synth)
+{
+    p_->control = synth;
+}
+
+void SynthRenderer::setSynth(const Synth& synth)
+{
+    p_->control = SynthSettings(synth);
+}
+
+void SynthRenderer::setChunkSize(size_t samples)
+    { p_->chunkSize = std::max(size_t(1), samples); }
+void SynthRenderer::setFormat(WavWriter::Format f) { p_->format = f; }
+void SynthRenderer::setMaxTail(double seconds)
+    { p_->maxTail = std::max(0., seconds); }
+void SynthRenderer::setNumThreads(size_t num) { p_->numThreads = num; }
+
+size_t SynthRenderer::numStems(const Score& score)
+{
+    size_t num = 1;
+    for (size_t i=0; i<score.numNoteStreams(); ++i)
+        num = std::max(num, score.noteStream(i).numRows());
+    return num;
+}
+
+QString SynthRenderer::stemFilename(const QString& filename, size_t row)
+{
+    QFileInfo info(filename);
+    QString name = QString("%1-row%2").arg(info.completeBaseName()).arg(row + 1);
+    if (!info.suffix().isEmpty())
+        name += "." + info.suffix();
+    return info.dir().filePath(name);
+}
+
+const SynthRenderer::Stats& SynthRenderer::renderStems(
+        const Score& score, const QString& filename, StemMode mode)
+{
+    const size_t num = numStems(score);
+    std::vector<std::unique_ptr<WavWriter>> wavs;
+    std::vector<WavWriter*> stems;
+    for (size_t i=0; i<(mode == SM_FILES ? num : 1); ++i)
+    {
+        wavs.emplace_back(new WavWriter());
+        if (mode == SM_FILES)
+            wavs.back()->open(stemFilename(filename, i),
+                              p_->control.sampleRate(), 1, p_->format);
+        else
+            wavs.back()->open(filename,
+                              p_->control.sampleRate(), num, p_->format);
+        stems.push_back(wavs.back().get());
+    }
+
+    p_->timed([&]() { p_->renderStems(score, stems); });
+
+    for (auto& wav : wavs)
+        wav->close();
+    return p_->stats;
+}
+
+const SynthRenderer::Stats& SynthRenderer::renderStems(
+        const Score& score, QIODevice* device)
+{
+    WavWriter wav;
+    wav.open(device, p_->control.sampleRate(), numStems(score), p_->format);
+    std::vector<WavWriter*> stems(1, &wav);
+    p_->timed([&]() { p_->renderStems(score, stems); });
+    wav.close();
+    return p_->stats;
+}
+
+const SynthRenderer::Stats& SynthRenderer::render(
+        const Score& score, const QString& filename)
+{
+    WavWriter wav;
+    wav.open(filename, p_->control.sampleRate(), 1, p_->format);
+    p_->render(score, wav);
+    wav.close();
+    return p_->stats;
+}
+
+const SynthRenderer::Stats& SynthRenderer::render(
+        const Score& score, QIODevice* device)
+{
+    WavWriter wav;
+    wav.open(device, p_->control.sampleRate(), 1, p_->format);
+    p_->render(score, wav);
+    wav.close();
+    return p_->stats;
+}
+
+template <class Render>
+void SynthRenderer::Private::timed(Render render)
+{
+    const auto start = std::chrono::steady_clock::now();
+
+    render();
+
+    const std::chrono::duration<double> sec =
+            std::chrono::steady_clock::now() - start;
+    stats.seconds = double(stats.numSamples) / control.sampleRate();
+    stats.renderSeconds = sec.count();
+}
+
+void SynthRenderer::Private::render(const Score& score, WavWriter& wav)
+{
+    size_t threads = numThreads;
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+
+    timed([&]()
+    {
+        if (threads > 1)
+            renderParallel(score, wav, threads);
+        else
+            renderSerial(score, wav);
+    });
+}
+
+void SynthRenderer::Private::setupSynth(Synth& synth, bool singleThread) const
+{
+    auto props = control.props();
+    // there is no real-time limit offline
+    props.set("adaptive-quality", false);
+    // the parts are already rendered in parallel
+    if (singleThread)
+        props.set("number-threads", 1);
+    synth.setProperties(props);
+    for (size_t i=0; i<control.numberModVoices(); ++i)
+        synth.setModProperties(i, control.modProps(i));
+}
+
+template <class Process>
+uint64_t SynthRenderer::Private::renderSequence(
+        Synth& synth, SynthSequencer& sequencer, Process process) const
+{
+    uint64_t num = 0;
+
+    // the score up to the end of the last bar or pause
+    while (!sequencer.isFinished())
+    {
+        const size_t len = sequencer.feed(synth, chunkSize);
+        process(len);
+        num += len;
+    }
+
+    // release tail
+    const uint64_t tailEnd = num + uint64_t(maxTail * synth.sampleRate());
+    while (num < tailEnd && synth.numActiveVoices())
+    {
+        const size_t len = std::min(uint64_t(chunkSize), tailEnd - num);
+        process(len);
+        num += len;
+    }
+
+    return num;
+}
+
+void SynthRenderer::Private::renderSerial(const Score& score, WavWriter& wav)
+{
+    Synth synth;
+    setupSynth(synth, false);
+
+    SynthSequencer sequencer;
+    sequencer.setLooping(false);
+    sequencer.setIndex(score.index(0,0,0,0));
+    sequencer.setScore(&score, synth.sampleRate());
+
+    std::vector<float> buffer(chunkSize);
+    stats.numSamples = renderSequence(synth, sequencer, [&](size_t len)
+    {
+        synth.process(buffer.data(), len);
+        wav.write(buffer.data(), len);
+    });
+}
+
+void SynthRenderer::Private::renderStems(
+        const Score& score, std::vector<WavWriter*>& stems)
+{
+    Synth synth;
+    setupSynth(synth, false);
+
+    SynthSequencer sequencer;
+    sequencer.setLooping(false);
+    sequencer.setIndex(score.index(0,0,0,0));
+    sequencer.setScore(&score, synth.sampleRate());
+
+    // one bus per row
+    const size_t num = numStems(score);
+    std::vector<float> buses(num * chunkSize), frames;
+    std::vector<float*> ptr;
+    for (size_t i=0; i<num; ++i)
+        ptr.push_back(&buses[i * chunkSize]);
+    if (stems.size() == 1)
+        frames.resize(num * chunkSize);
+
+    stats.numSamples = renderSequence(synth, sequencer, [&](size_t len)
+    {
+        synth.process(ptr.data(), num, len);
+        if (stems.size() == 1)
+        {
+            for (size_t i=0; i<num; ++i)
+                for (size_t j=0; j<len; ++j)
+                    frames[j * num + i] = ptr[i][j];
+            stems[0]->write(frames.data(), len);
+        }
+        else
+            for (size_t i=0; i<num; ++i)
+                stems[i]->write(ptr[i], len);
+    });
+}
+
+void SynthRenderer::Private::createParts()
+{
+    parts.clear();
+    for (size_t i=0; i<timeline.streams().size(); ++i)
+    {
+        const SynthTimeline::Stream& stream = timeline.streams()[i];
+        for (size_t r=0; r<stream.numRows; ++r)
+        {
+            Part part;
+            part.stream = i;
+            part.row = r;
+            part.start = timeline.streamStart(i);
+            part.done = false;
+            parts.push_back(part);
+        }
+    }
+}
+
+void SynthRenderer::Private::renderPart(size_t i)
+{
+    Part& part = parts[i];
+
+    // exceptions must not leave the worker thread
+    try
+    {
+        Synth synth;
+        setupSynth(synth, true);
+
+        SynthSequencer sequencer;
+        sequencer.setLooping(false);
+        sequencer.setSingleStream(true);
+        sequencer.setRow(part.row);
+        sequencer.setIndex(timeline.score()->index(part.stream, 0, 0, 0));
+        sequencer.setTimeline(&timeline);
+
+        std::vector<float> buffer(chunkSize);
+        renderSequence(synth, sequencer, [&](size_t len)
+        {
+            synth.process(buffer.data(), len);
+            part.audio.insert(part.audio.end(),
+                              buffer.data(), buffer.data() + len);
+        });
+    }
+    catch (...)
+    {
+        std::lock_guard<std::mutex> lock(mixMutex);
+        if (!error)
+            error = std::current_exception();
+        return;
+    }
+
+    // mix in the order of the parts, which keeps the
+    // output independent of the number of threads
+    std::lock_guard<std::mutex> lock(mixMutex);
+    part.done = true;
+    for (; nextMix < parts.size() && parts[nextMix].done; ++nextMix)
+    {
+        Part& p = parts[nextMix];
+        const uint64_t end = p.start + p.audio.size();
+        if (mix.size() < end)
+            mix.resize(end, 0.f);
+        float* dst = mix.data() + p.start;
+        for (size_t k=0; k<p.audio.size(); ++k)
+            dst[k] += p.audio[k];
+        std::vector<float>().swap(p.audio);
+    }
+}
+
+void SynthRenderer::Private::renderParallel(
+        const Score& score, WavWriter& wav, size_t threads)
+{
+    timeline.compile(score, control.sampleRate());
+    createParts();
+    mix.clear();
+    nextMix = 0;
+    error = nullptr;
+
+    {
+        SynthWorkerPool pool(std::min(threads, std::max(size_t(1),
+                                                        parts.size())));
+        pool.run(parts.size(), &renderPartFunc, this);
+    }
+
+    if (error)
+    {
+        std::vector<float>().swap(mix);
+        parts.clear();
+        std::exception_ptr e = error;
+        error = nullptr;
+        std::rethrow_exception(e);
+    }
+
+    for (size_t pos = 0; pos < mix.size(); pos += chunkSize)
+        wav.write(mix.data() + pos, std::min(chunkSize, mix.size() - pos));
+
+    stats.numSamples = mix.size();
+    std::vector<float>().swap(mix);
+    parts.clear();
+}
+
+} // namespace Sonot
@@ -0,0 +1,153 @@
+/***************************************************************************
+
+Copyright (C) 2016  stefan.berke @ modular-audio-graphics.com
+
+This source is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either
+version 3.0 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this software; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+****************************************************************************/
+
+#ifndef SONOTSRC_SYNTHRENDERER_H
+#define SONOTSRC_SYNTHRENDERER_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include <QString>
+
+#include "WavWriter.h"
+
+class QIODevice;
+
+namespace Sonot {
+
+class Score;
+class Synth;
+class SynthSettings;
+
+/** Renders a Score through a Synth into a WAV file,
+    as fast as the CPU allows.
+
+    The notes are scheduled by a SynthSequencer, the same way as
+    in SynthDevice, but the score is played only once from the
+    beginning. After the last bar (and it's pause, for streams with
+    @c pause-on-end) all notes are released and the synth runs
+    until the voices have ended, or for at most maxTail() seconds.
+
+    The audio is rendered and written in chunks of chunkSize(),
+    so the memory use does not depend on the length of the score.
+
+    With more than one thread, each row of each NoteStream is
+    rendered by it's own Synth, starting at the time of the first
+    bar of the stream on the SynthTimeline. The notes of a row are released at the end
+    of their stream and ring out into the following one. The parts
+    are mixed in a fixed order, so the output does not depend on
+    the number of threads, but the whole output is kept in memory.
+
+    renderStems() writes each row into it's own stem, for mixing
+    in other software. The voices are routed to the stems by their
+    row index in a single pass, so the first row of every stream
+    ends up in the first stem, and so on.
+    Errors are thrown as QProps::Exception, also those of the
+    render threads, which are rethrown after all threads finished. */
+class SynthRenderer
+{
+public:
+
+    struct Stats
+    {
+        Stats() : numSamples(0), seconds(0.), renderSeconds(0.) { }
+
+        /** Number of rendered samples, including the release tail */
+        uint64_t numSamples;
+        /** Length of the output in seconds */
+        double seconds;
+        /** Wall-clock time of the rendering in seconds */
+        double renderSeconds;
+
+        /** Rendering speed as multiple of real-time */
+        double speed() const
+            { return renderSeconds > 0. ? seconds / renderSeconds : 0.; }
+    };
+
+    /** Layout of the stems */
+    enum StemMode
+    {
+        /** One channel per row in a single file */
+        SM_CHANNELS,
+        /** One mono file per row */
+        SM_FILES
+    };
+
+    SynthRenderer();
+    ~SynthRenderer();
+
+    /** Returns the number of stems of @p score,
+        the maximum number of rows of the NoteStreams */
+    static size_t numStems(const Score& score);
+    /** Returns the name of the file of stem @p row in SM_FILES mode,
+        e.g. "song-row1.wav" for "song.wav" */
+    static QString stemFilename(const QString& filename, size_t row);
+
+    // ---- getter ----
+
+    /** The synth settings used for rendering */
+    const SynthSettings& synth() const;
+    size_t chunkSize() const;
+    WavWriter::Format format() const;
+    /** Maximum length of the release tail in seconds */
+    double maxTail() const;
+    /** Number of threads, 1 renders the whole score in one Synth */
+    size_t numThreads() const;
+
+    /** Statistics of the last render() call */
+    const Stats& stats() const;
+
+    // ---- setter ----
+
+    /** Copies the properties and modulator properties of @p synth */
+    void setSynth(const SynthSettings& synth);
+    void setSynth(const Synth& synth);
+    /** Number of samples rendered and written at once */
+    void setChunkSize(size_t samples);
+    void setFormat(WavWriter::Format f);
+    void setMaxTail(double seconds);
+    /** Sets the number of render threads, 0 for one per core */
+    void setNumThreads(size_t num);
+
+    // ---- render ----
+
+    /** Renders @p score into the file @p filename */
+    const Stats& render(const Score& score, const QString& filename);
+    /** Renders @p score into the opened, seekable @p device */
+    const Stats& render(const Score& score, QIODevice* device);
+
+    /** Renders the rows of @p score into stems, see StemMode */
+    const Stats& renderStems(const Score& score, const QString& filename,
+                             StemMode mode);
+    /** Renders the rows of @p score as channels into @p device */
+    const Stats& renderStems(const Score& score, QIODevice* device);
+
+private:
+
+    SynthRenderer(const SynthRenderer&) = delete;
+    void operator=(const SynthRenderer&) = delete;
+
+    struct Private;
+    Private* p_;
+};
+
+} // namespace Sonot
+
+#endif // SONOTSRC_SYNTHRENDERER_H
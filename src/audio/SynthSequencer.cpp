@@ -0,0 +1,264 @@
+/***************************************************************************
+
+Copyright (C) 2016  stefan.berke @ modular-audio-graphics.com
+
+This source is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either
+version 3.0 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this software; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+****************************************************************************/
+
+#include <algorithm>
+
+#include "SynthSequencer.h"
+#include "SynthTimeline.h"
+#include "Synth.h"
+
+namespace Sonot {
+
+SynthSequencer::SynthSequencer()
+    : p_owned       (nullptr)
+    , p_timeline    (nullptr)
+    , p_pos         (0)
+    , p_begin       (0)
+    , p_end         (0)
+    , p_stop        (0)
+    , p_barStart    (0)
+    , p_event       (0)
+    , p_bar         (0)
+    , p_row         (-1)
+    , p_looping     (true)
+    , p_singleStream(false)
+    , p_finished    (false)
+    , p_inPause     (false)
+    , p_valid       (false)
+{
+}
+
+SynthSequencer::~SynthSequencer()
+{
+    delete p_owned;
+}
+
+void SynthSequencer::setScore(const Score* score, size_t sampleRate)
+{
+    if (!score)
+    {
+        setTimeline(nullptr);
+        return;
+    }
+    if (!p_owned)
+        p_owned = new SynthTimeline();
+    p_owned->compile(*score, sampleRate);
+    setTimeline(p_owned);
+}
+
+void SynthSequencer::setTimeline(const SynthTimeline* timeline)
+{
+    p_timeline = timeline;
+    // same position in the new score
+    if (p_timeline && p_timeline->score())
+        p_index = p_timeline->score()->index(
+                    p_index.stream(), p_index.bar(),
+                    p_index.row(), p_index.column());
+    seekIndex();
+}
+
+void SynthSequencer::updateTimeline(const SynthTimeline* timeline)
+{
+    // position within the current bar
+    size_t stream = p_index.stream(), bar = p_index.bar();
+    uint64_t offset = 0;
+    if (p_valid)
+    {
+        const SynthTimeline::Bar& b = p_timeline->bars()[p_bar];
+        stream = b.stream;
+        bar = b.bar;
+        offset = p_pos - p_barStart;
+    }
+
+    p_timeline = timeline;
+    p_valid = false;
+    if (!p_timeline || p_timeline->isEmpty() || p_finished)
+        return;
+
+    // continue in the same bar, or at the same sample
+    uint64_t pos = p_pos;
+    const size_t i = p_timeline->findBar(stream, bar);
+    if (i < p_timeline->bars().size())
+    {
+        const SynthTimeline::Bar& b = p_timeline->bars()[i];
+        pos = p_timeline->barStart(i)
+                + std::min(offset, b.length + b.pause - 1);
+    }
+    setPosition(pos);
+}
+
+void SynthSequencer::setPosition(uint64_t sample)
+{
+    p_finished = false;
+    p_valid = false;
+    if (!p_timeline || p_timeline->isEmpty())
+        return;
+
+    const size_t stream = p_singleStream
+            ? p_index.stream()
+            : p_timeline->bars()[p_timeline->findBar(sample)].stream;
+    if (!setRange(stream))
+        return;
+    seek(std::max(p_begin, std::min(sample, p_stop - 1)));
+}
+
+void SynthSequencer::setIndex(const Score::Index& idx)
+{
+    p_index = idx;
+    seekIndex();
+}
+
+bool SynthSequencer::setRange(size_t stream)
+{
+    const auto& streams = p_timeline->streams();
+    if (stream >= streams.size())
+        return false;
+
+    const SynthTimeline& t = *p_timeline;
+    p_begin = p_singleStream ? t.streamStart(stream) : 0;
+    p_end = t.streamEnd(p_singleStream ? stream : streams.size() - 1);
+    p_stop = p_singleStream ? t.streamPauseEnd(stream) : t.length();
+    p_valid = p_stop > p_begin;
+    return p_valid;
+}
+
+void SynthSequencer::seekIndex()
+{
+    p_finished = false;
+    p_valid = false;
+    if (!p_timeline || p_timeline->isEmpty()
+            || p_index.score() != p_timeline->score())
+        return;
+
+    const uint64_t pos = p_timeline->indexSample(p_index);
+    if (pos >= p_timeline->length()
+            || !setRange(p_index.stream()))
+        return;
+    seek(pos);
+}
+
+void SynthSequencer::seek(uint64_t sample)
+{
+    p_pos = sample;
+    p_bar = p_timeline->findBar(sample);
+    p_barStart = p_timeline->barStart(p_bar);
+    p_event = p_timeline->findEvent(p_bar, sample - p_barStart);
+    p_inPause = sample >= p_end;
+    updateIndex();
+}
+
+void SynthSequencer::updateIndex()
+{
+    const SynthTimeline::Bar& bar = p_timeline->bars()[p_bar];
+    if (p_index.score() == p_timeline->score()
+            && p_index.stream() == bar.stream && p_index.bar() == bar.bar)
+        return;
+
+    const size_t numRows = p_timeline->streams()[bar.stream].numRows;
+    p_index = p_timeline->score()->index(
+                bar.stream, bar.bar,
+                std::min(p_index.row(), numRows ? numRows - 1 : 0), 0);
+}
+
+size_t SynthSequencer::feed(Synth& synth, size_t length)
+{
+    if (!p_valid || p_finished)
+    {
+        // nothing to play
+        if (!p_looping)
+        {
+            p_finished = true;
+            return 0;
+        }
+        return length;
+    }
+
+    const auto& bars = p_timeline->bars();
+    const size_t oldBar = p_bar;
+
+    size_t done = 0;
+    while (done < length)
+    {
+        // up to the end of the bars, then through the pause
+        const uint64_t limit = p_inPause ? p_stop : p_end,
+                       until = std::min(p_pos + (length - done), limit);
+
+        // send all events in the window to the synth
+        for (;;)
+        {
+            const SynthTimeline::Bar& bar = bars[p_bar];
+            const SynthTimeline::Events& events = *bar.events;
+            for (; p_event < events.size()
+                   && p_barStart + events[p_event].offset < until; ++p_event)
+            {
+                const SynthTimeline::Event& e = events[p_event];
+                if (p_row >= 0 && e.row != uint32_t(p_row))
+                    continue;
+
+                const size_t samplePos = done
+                        + (p_barStart + e.offset - p_pos);
+                if (e.type == SynthTimeline::E_STOP)
+                    synth.noteOffByIndex(e.row, samplePos);
+                else
+                    synth.noteOn(e.note, 0.1, samplePos, e.row);
+            }
+
+            // next bar starts within the window?
+            const uint64_t next = p_barStart + bar.length + bar.pause;
+            if (next >= until || p_bar + 1 >= bars.size())
+                break;
+            p_barStart = next;
+            ++p_bar;
+            p_event = 0;
+        }
+
+        done += until - p_pos;
+        p_pos = until;
+        if (p_pos < limit)
+            continue;
+
+        if (!p_inPause)
+        {
+            // end all notes and wait for the pause
+            if (!p_looping)
+                synth.notesOff(done);
+            p_inPause = true;
+            continue;
+        }
+
+        if (!p_looping)
+        {
+            p_finished = true;
+            if (p_bar != oldBar)
+                updateIndex();
+            return done;
+        }
+
+        // start again
+        seek(p_begin);
+    }
+
+    if (p_bar != oldBar)
+        updateIndex();
+
+    return length;
+}
+
+} // namespace Sonot
@@ -0,0 +1,133 @@
+/***************************************************************************
+
+Copyright (C) 2016  stefan.berke @ modular-audio-graphics.com
+
+This source is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either
+version 3.0 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this software; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+****************************************************************************/
+
+#ifndef SONOTSRC_SYNTHSEQUENCER_H
+#define SONOTSRC_SYNTHSEQUENCER_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "core/Score.h"
+
+namespace Sonot {
+
+class Synth;
+class SynthTimeline;
+
+/** Sends the notes of a Score to a Synth, ahead of each rendered buffer.
+
+    This is the scheduling of SynthDevice, shared with the offline
+    SynthRenderer. The score is compiled into a SynthTimeline and
+    playback is a cursor through it's events, so the cost of feed()
+    only depends on the number of notes in the buffer.
+    Each row of a NoteStream is one monophonic voice,
+    identified by the row index as Synth userIndex. */
+class SynthSequencer
+{
+public:
+    SynthSequencer();
+    ~SynthSequencer();
+
+    // ---- getter ----
+
+    const SynthTimeline* timeline() const { return p_timeline; }
+    /** The current bar */
+    const Score::Index& index() const { return p_index; }
+    /** Current position in samples on the timeline */
+    uint64_t position() const { return p_pos; }
+
+    /** Start again at the beginning after the end of the score */
+    bool isLooping() const { return p_looping; }
+    /** The only row that is played, or -1 for all rows */
+    int row() const { return p_row; }
+    /** Play only the stream of the current index */
+    bool isSingleStream() const { return p_singleStream; }
+
+    /** Returns true if the end of the score, including the pause,
+        was reached while not looping */
+    bool isFinished() const { return p_finished; }
+
+    // ---- setter ----
+
+    /** Compiles a timeline of @p score, which is owned by the
+        sequencer, and continues at the current index.
+        This allocates memory. */
+    void setScore(const Score* score, size_t sampleRate);
+    /** Uses @p timeline, which is not owned, and continues at the
+        current index. Does not allocate. */
+    void setTimeline(const SynthTimeline* timeline);
+    /** Replaces the timeline by an edited version and continues
+        at the same position within the current bar.
+        Does not allocate. */
+    void updateTimeline(const SynthTimeline* timeline);
+    /** Continues at the column of @p idx */
+    void setIndex(const Score::Index& idx);
+    /** Continues at @p sample on the timeline, e.g. from
+        SynthTimeline::indexAt() or SynthTimeline::toSample() */
+    void setPosition(uint64_t sample);
+    void setLooping(bool e) { p_looping = e; }
+    /** Plays only the notes of row @p row, or all rows for -1 */
+    void setRow(int row) { p_row = row; }
+    /** If enabled, the end of the stream of the current index is
+        treated like the end of the score. Takes effect on the
+        next setIndex() or setTimeline(). */
+    void setSingleStream(bool e) { p_singleStream = e; }
+
+    // ---- scheduling ----
+
+    /** Sends all note starts and stops within the next @p length
+        samples to @p synth, relative to Synth::currentSample().
+        Returns the number of these samples that still belong to the
+        score, which is less than @p length only at the end
+        of the score when not looping. */
+    size_t feed(Synth& synth, size_t length);
+
+private:
+
+    SynthSequencer(const SynthSequencer&) = delete;
+    void operator=(const SynthSequencer&) = delete;
+
+    /** Sets the playing range for the current settings,
+        returns false if there is nothing to play */
+    bool setRange(size_t stream);
+    /** Moves the cursor to the column of p_index */
+    void seekIndex();
+    /** Moves the cursor to @p sample within the playing range */
+    void seek(uint64_t sample);
+    /** Updates p_index from the bar cursor */
+    void updateIndex();
+
+    /** Timeline compiled by setScore() */
+    SynthTimeline* p_owned;
+    const SynthTimeline* p_timeline;
+    Score::Index p_index;
+    /** Position and playing range [begin, end) plus pause until stop */
+    uint64_t p_pos, p_begin, p_end, p_stop;
+    /** First sample of the current bar */
+    uint64_t p_barStart;
+    /** Cursors into the timeline, the event is within the bar */
+    size_t p_event, p_bar;
+    int p_row;
+    bool p_looping, p_singleStream, p_finished, p_inPause, p_valid;
+};
+
+} // namespace Sonot
+
+#endif // SONOTSRC_SYNTHSEQUENCER_H
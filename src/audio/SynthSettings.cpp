@@ -0,0 +1,96 @@
+/***************************************************************************
+
+Copyright (C) 2016  stefan.berke @ modular-audio-graphics.com
+
+This source is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either
+version 3.0 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this software; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+****************************************************************************/
+
+#include "QProps/error.h"
+#include "QProps/JsonInterfaceHelper.h"
+
+#include "SynthSettings.h"
+#include "Synth.h"
+
+namespace Sonot {
+
+SynthSettings::SynthSettings()
+    : p_props       (Synth::defaultProperties())
+    , p_sampleRate  (44100)
+{
+    setProperties(p_props);
+}
+
+SynthSettings::SynthSettings(const Synth& synth)
+    : p_props       (synth.props())
+    , p_sampleRate  (synth.sampleRate())
+{
+    for (size_t i=0; i<synth.numberModVoices(); ++i)
+        p_modProps.push_back(synth.modProps(i));
+}
+
+const QProps::Properties& SynthSettings::modProps(size_t idx) const
+{
+    QPROPS_ASSERT_LT(idx, p_modProps.size(), "");
+    return p_modProps[idx];
+}
+
+void SynthSettings::setProperties(const QProps::Properties& p)
+{
+    p_props = p;
+    const size_t num = p_props.get("number-mod-voices").toUInt();
+    if (num < p_modProps.size())
+        p_modProps.resize(num);
+    while (num > p_modProps.size())
+        p_modProps.push_back(Synth::defaultModProperties(p_modProps.size()));
+}
+
+void SynthSettings::setModProperties(size_t idx, const QProps::Properties& p)
+{
+    QPROPS_ASSERT_LT(idx, p_modProps.size(), "");
+    p_modProps[idx] = p;
+}
+
+QJsonObject SynthSettings::toJson() const
+{
+    QJsonObject o;
+    o.insert("master", p_props.toJson());
+    for (size_t i=0; i<numberModVoices(); ++i)
+        o.insert(QString("mod-%1").arg(i),
+                 p_modProps[i].toJson());
+    return o;
+}
+
+void SynthSettings::fromJson(const QJsonObject& o)
+{
+    QProps::JsonInterfaceHelper json("SynthSettings");
+    QProps::Properties master(p_props);
+    master.fromJson( json.expectChildObject(o, "master") );
+
+    std::vector<QProps::Properties> mods;
+    for (int i=0; i<master.get("number-mod-voices").toInt(); ++i)
+    {
+        QProps::Properties mod(Synth::defaultModProperties(i));
+        mod.fromJson( json.expectChildObject(
+                          o, QString("mod-%1").arg(i)) );
+        mods.push_back(mod);
+    }
+
+    setProperties(master);
+    for (size_t i=0; i<numberModVoices(); ++i)
+        setModProperties(i, mods[i]);
+}
+
+} // namespace Sonot
@@ -0,0 +1,78 @@
+/***************************************************************************
+
+Copyright (C) 2016  stefan.berke @ modular-audio-graphics.com
+
+This source is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either
+version 3.0 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this software; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+****************************************************************************/
+
+#ifndef SONOTSRC_SYNTHSETTINGS_H
+#define SONOTSRC_SYNTHSETTINGS_H
+
+#include <cstddef>
+#include <vector>
+
+#include "QProps/Properties.h"
+#include "QProps/JsonInterface.h"
+
+namespace Sonot {
+
+class Synth;
+
+/** The properties of a Synth, without the Synth.
+
+    Holds the master and modulator properties and the sampling rate,
+    with the same json format as Synth. This is the settings copy on
+    the GUI side of SynthDevice and in SynthRenderer, which never
+    render themselves, so a property change does not create voices
+    or worker threads. */
+class SynthSettings : public QProps::JsonInterface
+{
+public:
+    /** Default properties of a new Synth */
+    SynthSettings();
+    /** Copies the properties of @p synth */
+    explicit SynthSettings(const Synth& synth);
+
+    // ------------ io -------------
+
+    QJsonObject toJson() const override;
+    void fromJson(const QJsonObject&) override;
+
+    // ------------ getter ----------------
+
+    const QProps::Properties& props() const { return p_props; }
+    const QProps::Properties& modProps(size_t idx) const;
+    size_t numberModVoices() const { return p_modProps.size(); }
+    size_t sampleRate() const { return p_sampleRate; }
+
+    // ----------- setter -----------------
+
+    /** Sets the master properties and adds or removes
+        modulator voices, like Synth::setProperties() */
+    void setProperties(const QProps::Properties& p);
+    void setModProperties(size_t idx, const QProps::Properties& p);
+    void setSampleRate(size_t sr) { p_sampleRate = sr; }
+
+private:
+
+    QProps::Properties p_props;
+    std::vector<QProps::Properties> p_modProps;
+    size_t p_sampleRate;
+};
+
+} // namespace Sonot
+
+#endif // SONOTSRC_SYNTHSETTINGS_H
@@ -0,0 +1,380 @@
+/***************************************************************************
+
+Copyright (C) 2016  stefan.berke @ modular-audio-graphics.com
+
+This source is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either
+version 3.0 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this software; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+****************************************************************************/
+
+#include <algorithm>
+
+#include "SynthTimeline.h"
+#include "core/Score.h"
+#include "core/NoteStream.h"
+#include "core/Notes.h"
+#include "core/KeySignature.h"
+
+namespace Sonot {
+
+SynthTimeline::SynthTimeline()
+    : p_score           (nullptr)
+    , p_sampleRate      (44100)
+    , p_numScoreStreams (0)
+{
+}
+
+uint64_t SynthTimeline::barStart(size_t i) const
+{
+    uint64_t sum = 0;
+    for (; i > 0; i -= i & (~i + 1))
+        sum += p_tree[i];
+    return sum;
+}
+
+uint64_t SynthTimeline::streamEnd(size_t stream) const
+{
+    const Stream& s = p_streams[stream];
+    const size_t last = s.firstBar + s.numBars - 1;
+    return barStart(last) + p_bars[last].length;
+}
+
+size_t SynthTimeline::findBar(uint64_t sample) const
+{
+    const size_t num = p_bars.size();
+    if (num == 0)
+        return 0;
+
+    // descend the tree to the last bar starting at or before sample
+    size_t step = 1;
+    while (step * 2 <= num)
+        step *= 2;
+    size_t pos = 0;
+    for (; step > 0; step /= 2)
+    {
+        if (pos + step <= num && p_tree[pos + step] <= sample)
+        {
+            pos += step;
+            sample -= p_tree[pos];
+        }
+    }
+    return std::min(pos, num - 1);
+}
+
+size_t SynthTimeline::findBar(size_t stream, size_t bar) const
+{
+    if (stream >= p_streams.size() || bar >= p_streams[stream].numBars)
+        return p_bars.size();
+    return p_streams[stream].firstBar + bar;
+}
+
+size_t SynthTimeline::findEvent(size_t bar, uint64_t offset) const
+{
+    const Events& events = *p_bars[bar].events;
+    return std::lower_bound(events.begin(), events.end(), offset,
+                            [](const Event& e, uint64_t o)
+                            { return e.offset < o; })
+            - events.begin();
+}
+
+uint64_t SynthTimeline::columnOffset(
+        uint64_t length, const Notes& notes, size_t column)
+{
+    return uint64_t(length * notes.columnTime(column) + .5);
+}
+
+uint64_t SynthTimeline::indexSample(const Score::Index& idx) const
+{
+    if (idx.score() != p_score)
+        return length();
+    const size_t i = findBar(idx.stream(), idx.bar());
+    if (i >= p_bars.size())
+        return length();
+
+    const Bar& bar = p_bars[i];
+    const Columns& columns = *bar.columns;
+    if (columns.empty())
+        return barStart(i);
+    const std::vector<uint32_t>& row =
+            columns[std::min(idx.row(), columns.size() - 1)];
+    if (row.empty())
+        return barStart(i);
+    return barStart(i) + (idx.column() < row.size()
+                            ? row[idx.column()] : bar.length);
+}
+
+Score::Index SynthTimeline::indexAt(uint64_t sample, size_t row) const
+{
+    if (isEmpty())
+        return Score::Index();
+
+    const size_t i = findBar(sample);
+    const Bar& bar = p_bars[i];
+    const Columns& columns = *bar.columns;
+    if (columns.empty())
+        return p_score->index(bar.stream, bar.bar, 0, 0);
+    row = std::min(row, columns.size() - 1);
+    const std::vector<uint32_t>& offsets = columns[row];
+
+    // number of columns starting at or before sample
+    const uint64_t offset = sample - std::min(sample, barStart(i));
+    const size_t num = std::upper_bound(offsets.begin(), offsets.end(),
+                                        offset) - offsets.begin();
+    return p_score->index(bar.stream, bar.bar, row, num ? num - 1 : 0);
+}
+
+size_t SynthTimeline::numPlayedBars(const NoteStream& s)
+{
+    if (s.numRows() == 0)
+        return 0;
+    // Score::Index::nextBar() stops at empty bars
+    size_t num = 0;
+    while (num < s.numBars() && !s.notes(num, 0).isEmpty())
+        ++num;
+    return num;
+}
+
+SynthTimeline::Bar SynthTimeline::compileBar(
+        const NoteStream& s, const KeySignature& keysig,
+        size_t stream, size_t bar, bool last) const
+{
+    const double sampleRate = p_sampleRate,
+                 barLength = s.barLengthSeconds(bar);
+    const auto toSample = [=](double sec)
+        { return uint64_t(sec * sampleRate + .5); };
+
+    Bar b;
+    b.length = toSample(barLength);
+    b.pause = 0;
+    b.stream = stream;
+    b.bar = bar;
+
+    auto events = std::make_shared<Events>();
+    auto columns = std::make_shared<Columns>(s.numRows());
+    for (size_t r=0; r<s.numRows(); ++r)
+    {
+        const Notes& notes = s.notes(bar, r);
+        (*columns)[r].resize(notes.length());
+        for (size_t c=0; c<notes.length(); ++c)
+            (*columns)[r][c] = columnOffset(b.length, notes, c);
+
+        for (size_t c=0; c<notes.length(); ++c)
+        {
+            const Note n = keysig.transform(notes.note(c));
+            if (!n.isValid())
+                continue;
+
+            Event e;
+            e.offset = (*columns)[r][c];
+            e.row = r;
+            e.note = n.value();
+            // stop prev note
+            if (n.value() != Note::Space)
+            {
+                e.type = E_STOP;
+                events->push_back(e);
+            }
+            if (n.isNote())
+            {
+                e.type = E_START;
+                events->push_back(e);
+            }
+        }
+    }
+    // rows are independent, keep the order within each row
+    std::stable_sort(events->begin(), events->end(),
+                     [](const Event& a, const Event& b)
+                     { return a.offset < b.offset; });
+
+    // note-off at stream end
+    if (last && s.isPauseOnEnd())
+        for (size_t r=0; r<s.numRows(); ++r)
+        {
+            Event e;
+            e.offset = b.length;
+            e.row = r;
+            e.note = 0;
+            e.type = E_STOP;
+            events->push_back(e);
+        }
+
+    b.events = events;
+    b.columns = columns;
+    return b;
+}
+
+uint64_t SynthTimeline::pauseLength(size_t stream) const
+{
+    if (!p_score->noteStream(stream).isPauseOnEnd())
+        return 0;
+    // wait one bar length
+    const Stream& s = p_streams[stream];
+    return stream + 1 < p_streams.size()
+            ? p_bars[p_streams[stream + 1].firstBar].length
+            : p_bars[s.firstBar + s.numBars - 1].length;
+}
+
+void SynthTimeline::updatePause(size_t stream)
+{
+    const Stream& s = p_streams[stream];
+    Bar bar = p_bars[s.firstBar + s.numBars - 1];
+    bar.pause = pauseLength(stream);
+    setBar(s.firstBar + s.numBars - 1, bar);
+}
+
+void SynthTimeline::setBar(size_t i, Bar bar)
+{
+    // unsigned wrap-around adds negative differences as well
+    const uint64_t diff = (bar.length + bar.pause)
+                        - (p_bars[i].length + p_bars[i].pause);
+    p_bars[i] = bar;
+    for (size_t k = i + 1; k < p_tree.size(); k += k & (~k + 1))
+        p_tree[k] += diff;
+}
+
+void SynthTimeline::buildTree()
+{
+    p_tree.assign(p_bars.size() + 1, 0);
+    for (size_t i=1; i<p_tree.size(); ++i)
+    {
+        p_tree[i] += p_bars[i-1].length + p_bars[i-1].pause;
+        const size_t parent = i + (i & (~i + 1));
+        if (parent < p_tree.size())
+            p_tree[parent] += p_tree[i];
+    }
+}
+
+void SynthTimeline::compile(const Score& score, size_t sampleRate)
+{
+    p_score = &score;
+    p_sampleRate = sampleRate;
+    p_numScoreStreams = score.numNoteStreams();
+    p_bars.clear();
+    p_streams.clear();
+
+    for (size_t i=0; i<score.numNoteStreams(); ++i)
+    {
+        const NoteStream& stream = score.noteStream(i);
+        const size_t num = numPlayedBars(stream);
+        if (num == 0)
+            break;
+
+        const KeySignature keysig = stream.keySignature();
+        Stream s;
+        s.firstBar = p_bars.size();
+        s.numBars = num;
+        s.numRows = stream.numRows();
+        for (size_t b=0; b<num; ++b)
+            p_bars.push_back(compileBar(stream, keysig, i, b, b + 1 == num));
+        p_streams.push_back(s);
+
+        // end of score
+        if (num < stream.numBars())
+            break;
+    }
+
+    for (size_t i=0; i<p_streams.size(); ++i)
+        p_bars[p_streams[i].firstBar + p_streams[i].numBars - 1].pause
+                = pauseLength(i);
+    buildTree();
+}
+
+bool SynthTimeline::updateBar(size_t stream, size_t bar)
+{
+    if (!p_score)
+        return false;
+    if (stream >= p_streams.size()
+            || p_score->numNoteStreams() != p_numScoreStreams)
+    {
+        compile(*p_score, p_sampleRate);
+        return false;
+    }
+
+    const NoteStream& s = p_score->noteStream(stream);
+    const Stream& st = p_streams[stream];
+    if (s.numRows() != st.numRows || numPlayedBars(s) != st.numBars)
+        return updateStream(stream);
+    if (bar >= st.numBars)
+        return true;
+
+    const size_t i = st.firstBar + bar;
+    Bar b = compileBar(s, s.keySignature(), stream, bar,
+                       bar + 1 == st.numBars);
+    b.pause = p_bars[i].pause;
+    setBar(i, b);
+
+    // the length of a first bar is the pause of the previous stream
+    updatePause(stream);
+    if (stream > 0)
+        updatePause(stream - 1);
+    return true;
+}
+
+bool SynthTimeline::updateStream(size_t stream)
+{
+    if (!p_score)
+        return false;
+    if (stream >= p_streams.size()
+            || p_score->numNoteStreams() != p_numScoreStreams)
+    {
+        compile(*p_score, p_sampleRate);
+        return false;
+    }
+
+    const NoteStream& s = p_score->noteStream(stream);
+    const size_t num = numPlayedBars(s);
+    const bool wasNextPlayed = stream + 1 < p_streams.size(),
+               isNextPlayed = num == s.numBars()
+                    && stream + 1 < p_score->numNoteStreams()
+                    && numPlayedBars(p_score->noteStream(stream + 1)) > 0;
+    if (num == 0 || wasNextPlayed != isNextPlayed)
+    {
+        compile(*p_score, p_sampleRate);
+        return false;
+    }
+
+    const KeySignature keysig = s.keySignature();
+    Stream& st = p_streams[stream];
+    if (num == st.numBars)
+    {
+        for (size_t b=0; b<num; ++b)
+        {
+            Bar bar = compileBar(s, keysig, stream, b, b + 1 == num);
+            bar.pause = p_bars[st.firstBar + b].pause;
+            setBar(st.firstBar + b, bar);
+        }
+    }
+    else
+    {
+        // bars inserted or deleted, the following bars move
+        std::vector<Bar> bars;
+        for (size_t b=0; b<num; ++b)
+            bars.push_back(compileBar(s, keysig, stream, b, b + 1 == num));
+        const auto first = p_bars.begin() + st.firstBar;
+        p_bars.erase(first, first + st.numBars);
+        p_bars.insert(p_bars.begin() + st.firstBar, bars.begin(), bars.end());
+        for (size_t i=stream + 1; i<p_streams.size(); ++i)
+            p_streams[i].firstBar = p_streams[i].firstBar + num - st.numBars;
+        st.numBars = num;
+        buildTree();
+    }
+    st.numRows = s.numRows();
+
+    updatePause(stream);
+    if (stream > 0)
+        updatePause(stream - 1);
+    return true;
+}
+
+} // namespace Sonot
@@ -0,0 +1,202 @@
+/***************************************************************************
+
+Copyright (C) 2016  stefan.berke @ modular-audio-graphics.com
+
+This source is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either
+version 3.0 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this software; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+****************************************************************************/
+
+#ifndef SONOTSRC_SYNTHTIMELINE_H
+#define SONOTSRC_SYNTHTIMELINE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "core/Score.h"
+
+namespace Sonot {
+
+class NoteStream;
+class Notes;
+class KeySignature;
+
+/** The notes of a Score as time-sorted events per bar.
+
+    compile() walks the score once, in the order the bars are played,
+    applies the key signatures and converts all times to samples.
+    Playback is then a cursor through the events, see SynthSequencer.
+
+    The event times are relative to their bar. The start of each bar
+    is the sum of the lengths of all previous bars, kept in a
+    binary indexed tree, so an edited bar is recompiled with
+    updateBar() and all following bars move in O(log n).
+    Copies of the timeline share the events of unchanged bars.
+    The same sums, together with the column offsets stored in each
+    bar, map between score indices and time, for seeking and
+    displaying the play position. The time map does not read
+    the Score, so it stays valid while the Score is edited
+    and the timeline is not yet updated.
+
+    Streams with the @c pause-on-end property stop all rows at their
+    end, followed by a pause of the length of the next bar,
+    or of the last bar at the end of the score. */
+class SynthTimeline
+{
+public:
+
+    enum EventType
+    {
+        /** Stops the voice of the row */
+        E_STOP,
+        /** Starts a note in the row */
+        E_START
+    };
+
+    struct Event
+    {
+        /** Samples from the start of the bar */
+        uint32_t offset;
+        uint32_t row;
+        int8_t note;
+        uint8_t type;
+    };
+
+    typedef std::vector<Event> Events;
+    /** Samples from the start of the bar to each column, per row */
+    typedef std::vector<std::vector<uint32_t>> Columns;
+
+    struct Bar
+    {
+        /** Length in samples */
+        uint64_t length;
+        /** Samples of pause after the bar,
+            only at the end of a stream with pause-on-end */
+        uint64_t pause;
+        size_t stream, bar;
+        /** Sorted by offset, never null */
+        std::shared_ptr<const Events> events;
+        /** Column offsets for the time map, never null */
+        std::shared_ptr<const Columns> columns;
+    };
+
+    struct Stream
+    {
+        /** Index of the first Bar */
+        size_t firstBar;
+        /** Number of played bars */
+        size_t numBars;
+        size_t numRows;
+    };
+
+    SynthTimeline();
+
+    // ---- getter ----
+
+    bool isEmpty() const { return p_bars.empty(); }
+    const Score* score() const { return p_score; }
+    size_t sampleRate() const { return p_sampleRate; }
+
+    const std::vector<Bar>& bars() const { return p_bars; }
+    const std::vector<Stream>& streams() const { return p_streams; }
+
+    /** Length including the pause at the end */
+    uint64_t length() const { return barStart(p_bars.size()); }
+
+    /** First sample of Bar @p i, or length() for the end */
+    uint64_t barStart(size_t i) const;
+
+    uint64_t streamStart(size_t stream) const
+        { return barStart(p_streams[stream].firstBar); }
+    /** Sample after the last bar of @p stream */
+    uint64_t streamEnd(size_t stream) const;
+    /** Sample after the pause, equal to streamEnd() without pause */
+    uint64_t streamPauseEnd(size_t stream) const
+        { return barStart(p_streams[stream].firstBar
+                          + p_streams[stream].numBars); }
+
+    /** Index of the Bar that contains @p sample,
+        the last Bar for samples after the end */
+    size_t findBar(uint64_t sample) const;
+    /** Index of the Bar @p bar of NoteStream @p stream,
+        or bars().size() if it is not played */
+    size_t findBar(size_t stream, size_t bar) const;
+    /** Index of the first event of Bar @p bar at or after @p offset */
+    size_t findEvent(size_t bar, uint64_t offset) const;
+
+    // ---- time map ----
+
+    /** Sample position of the column of @p idx,
+        or length() if it's bar is not played */
+    uint64_t indexSample(const Score::Index& idx) const;
+    /** The column of row @p row that plays at @p sample,
+        or an invalid index if the timeline is empty */
+    Score::Index indexAt(uint64_t sample, size_t row = 0) const;
+
+    double toSeconds(uint64_t sample) const
+        { return double(sample) / p_sampleRate; }
+    uint64_t toSample(double seconds) const
+        { return seconds > 0. ? uint64_t(seconds * p_sampleRate + .5) : 0; }
+
+    // ---- compile ----
+
+    /** Creates the events of all bars of @p score that are played,
+        starting at the first bar and ending at the first empty
+        bar or NoteStream, like the SynthSequencer would. */
+    void compile(const Score& score, size_t sampleRate);
+
+    /** Recompiles Bar @p bar of NoteStream @p stream after it's notes
+        have been edited. Falls back to compile() if the bar changes
+        which bars are played at all. Returns false in that case. */
+    bool updateBar(size_t stream, size_t bar);
+
+    /** Recompiles all bars of NoteStream @p stream after bars were
+        inserted or deleted or it's properties changed.
+        Falls back to compile() if streams were inserted or deleted,
+        or the edit changes which streams are played.
+        Returns false in that case. */
+    bool updateStream(size_t stream);
+
+private:
+
+    /** Number of leading bars of @p s that are played */
+    static size_t numPlayedBars(const NoteStream& s);
+    /** Creates the events of one bar, with the note-offs for the
+        pause if @p last is the last played bar of the stream */
+    Bar compileBar(const NoteStream& s, const KeySignature& keysig,
+                   size_t stream, size_t bar, bool last) const;
+    /** Samples from the start of a bar of @p length to @p column */
+    static uint64_t columnOffset(uint64_t length, const Notes& notes,
+                                 size_t column);
+    /** Length of the pause after the last bar of @p stream */
+    uint64_t pauseLength(size_t stream) const;
+    /** Updates the pause after the last bar of @p stream */
+    void updatePause(size_t stream);
+    /** Replaces Bar @p i and moves all following bars */
+    void setBar(size_t i, Bar bar);
+    void buildTree();
+
+    const Score* p_score;
+    size_t p_sampleRate, p_numScoreStreams;
+    std::vector<Bar> p_bars;
+    std::vector<Stream> p_streams;
+    /** Binary indexed tree of the bar lengths plus pause */
+    std::vector<uint64_t> p_tree;
+};
+
+} // namespace Sonot
+
+#endif // SONOTSRC_SYNTHTIMELINE_H
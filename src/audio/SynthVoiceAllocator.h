@@ -0,0 +1,321 @@
+/***************************************************************************
+
+Copyright (C) 2016  stefan.berke @ modular-audio-graphics.com
+
+This source is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either
+version 3.0 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this software; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+****************************************************************************/
+
+#ifndef SONOTSRC_SYNTHVOICEALLOCATOR_H
+#define SONOTSRC_SYNTHVOICEALLOCATOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Sonot {
+
+/** Bookkeeping of used and free voices for the Synth.
+
+    - The free voices are kept in a two-level bitmap, so takeFree()
+      returns the lowest free voice index in constant time
+      (up to 64*64 voices).
+    - Used voices are linked into hash buckets by note and by
+      user index, so voices of a note or index can be visited
+      without looking at any other voice.
+    - Used voices are kept in an indexed heap ordered by their
+      steal key, so the voice to reuse is always at top().
+      use(), unuse() and a changed key cost O(log n), an unchanged
+      key in setKey() is constant time. A plain age ordered list
+      can not replace the heap, since the rank (the envelope state)
+      comes first and voices change their state in any order.
+
+    A steal key consists of a rank and a value. The voice with the
+    smallest rank, then the smallest value, then the smallest index
+    is stolen first. */
+class SynthVoiceAllocator
+{
+public:
+
+    static constexpr size_t invalidIndex() { return size_t(-1); }
+    /** Maximum number of voices */
+    static constexpr size_t maxVoices() { return 64 * 64; }
+
+    SynthVoiceAllocator() : p_numFree(0), p_summary(0) { }
+
+    // ------------ getter -------------
+
+    size_t numVoices() const { return p_noteKey.size(); }
+    size_t numFree() const { return p_numFree; }
+    bool isFree(size_t v) const
+        { return (p_free[v >> 6] >> (v & 63)) & 1; }
+
+    /** Returns the used voice that should be stolen first,
+        or invalidIndex() if all voices are free. */
+    size_t top() const { return p_heap.empty() ? invalidIndex() : p_heap[0]; }
+
+    /** Calls @p func(voice) for each used voice of @p note */
+    template <class F>
+    void forEachNote(int note, F func) const
+    {
+        for (size_t v = p_noteHead[bucket_(note)]; v != invalidIndex(); )
+        {
+            const size_t next = p_noteNext[v];
+            if (p_noteKey[v] == note)
+                func(v);
+            v = next;
+        }
+    }
+
+    /** Calls @p func(voice) for each used voice with @p userIndex */
+    template <class F>
+    void forEachUserIndex(int64_t userIndex, F func) const
+    {
+        for (size_t v = p_userHead[bucket_(userIndex)]; v != invalidIndex(); )
+        {
+            const size_t next = p_userNext[v];
+            if (p_userKey[v] == userIndex)
+                func(v);
+            v = next;
+        }
+    }
+
+    // ----------- setter --------------
+
+    /** Sets the number of voices and marks all as free */
+    void resize(size_t numVoices)
+    {
+        size_t buckets = 16;
+        while (buckets < numVoices * 2)
+            buckets <<= 1;
+        p_mask = buckets - 1;
+
+        p_noteHead.assign(buckets, invalidIndex());
+        p_userHead.assign(buckets, invalidIndex());
+        p_noteNext.assign(numVoices, invalidIndex());
+        p_notePrev.assign(numVoices, invalidIndex());
+        p_userNext.assign(numVoices, invalidIndex());
+        p_userPrev.assign(numVoices, invalidIndex());
+        p_noteKey.assign(numVoices, 0);
+        p_userKey.assign(numVoices, 0);
+        p_rank.assign(numVoices, 0);
+        p_value.assign(numVoices, 0.);
+        p_heapPos.assign(numVoices, invalidIndex());
+        p_heap.clear();
+        p_heap.reserve(numVoices);
+
+        p_free.assign((numVoices + 63) / 64, 0);
+        p_summary = 0;
+        p_numFree = 0;
+        for (size_t v=0; v<numVoices; ++v)
+            setFree_(v);
+    }
+
+    /** Marks all voices as free */
+    void clear() { resize(numVoices()); }
+
+    /** Takes the lowest free voice out of the free set and returns it,
+        or invalidIndex() if there is none. The voice needs to be
+        inserted with use() afterwards. */
+    size_t takeFree()
+    {
+        if (!p_summary)
+            return invalidIndex();
+        const size_t w = ctz_(p_summary),
+                     v = (w << 6) + ctz_(p_free[w]);
+        p_free[w] &= p_free[w] - 1;
+        if (!p_free[w])
+            p_summary &= ~(uint64_t(1) << w);
+        --p_numFree;
+        return v;
+    }
+
+    /** Registers voice @p v as used with the given keys.
+        The voice must have been taken with takeFree() or
+        be removed with unuse() before. */
+    void use(size_t v, int note, int64_t userIndex, int rank, double value)
+    {
+        p_noteKey[v] = note;
+        p_userKey[v] = userIndex;
+        link_(p_noteHead[bucket_(note)], p_noteNext, p_notePrev, v);
+        link_(p_userHead[bucket_(userIndex)], p_userNext, p_userPrev, v);
+
+        p_rank[v] = rank;
+        p_value[v] = value;
+        p_heapPos[v] = p_heap.size();
+        p_heap.push_back(v);
+        siftUp_(p_heap.size() - 1);
+    }
+
+    /** Removes voice @p v from the indices, without freeing it */
+    void unuse(size_t v)
+    {
+        if (p_heapPos[v] == invalidIndex())
+            return;
+        unlink_(p_noteHead[bucket_(p_noteKey[v])], p_noteNext, p_notePrev, v);
+        unlink_(p_userHead[bucket_(p_userKey[v])], p_userNext, p_userPrev, v);
+
+        const size_t pos = p_heapPos[v];
+        p_heapPos[v] = invalidIndex();
+        const size_t last = p_heap.back();
+        p_heap.pop_back();
+        if (last != v)
+        {
+            p_heap[pos] = last;
+            p_heapPos[last] = pos;
+            siftUp_(pos);
+            siftDown_(p_heapPos[last]);
+        }
+    }
+
+    /** Removes voice @p v from the indices and puts it into the free set */
+    void release(size_t v)
+    {
+        if (isFree(v))
+            return;
+        unuse(v);
+        setFree_(v);
+    }
+
+    /** Changes the steal key of the used voice @p v */
+    void setKey(size_t v, int rank, double value)
+    {
+        const size_t pos = p_heapPos[v];
+        if (pos == invalidIndex()
+            || (rank == p_rank[v] && value == p_value[v]))
+            return;
+        p_rank[v] = rank;
+        p_value[v] = value;
+        siftUp_(pos);
+        siftDown_(p_heapPos[v]);
+    }
+
+private:
+
+    static size_t ctz_(uint64_t x)
+    {
+#if defined(__GNUC__)
+        return __builtin_ctzll(x);
+#else
+        size_t n = 0;
+        while (!(x & 1)) { x >>= 1; ++n; }
+        return n;
+#endif
+    }
+
+    size_t bucket_(int64_t key) const
+    {
+        uint64_t h = uint64_t(key) * 0x9e3779b97f4a7c15ull;
+        return size_t(h >> 32) & p_mask;
+    }
+
+    void setFree_(size_t v)
+    {
+        p_free[v >> 6] |= uint64_t(1) << (v & 63);
+        p_summary |= uint64_t(1) << (v >> 6);
+        ++p_numFree;
+    }
+
+    static void link_(size_t& head, std::vector<size_t>& next,
+                      std::vector<size_t>& prev, size_t v)
+    {
+        prev[v] = invalidIndex();
+        next[v] = head;
+        if (head != invalidIndex())
+            prev[head] = v;
+        head = v;
+    }
+
+    static void unlink_(size_t& head, std::vector<size_t>& next,
+                        std::vector<size_t>& prev, size_t v)
+    {
+        if (prev[v] != invalidIndex())
+            next[prev[v]] = next[v];
+        else
+            head = next[v];
+        if (next[v] != invalidIndex())
+            prev[next[v]] = prev[v];
+        next[v] = prev[v] = invalidIndex();
+    }
+
+    bool before_(size_t a, size_t b) const
+    {
+        if (p_rank[a] != p_rank[b])
+            return p_rank[a] < p_rank[b];
+        if (p_value[a] != p_value[b])
+            return p_value[a] < p_value[b];
+        return a < b;
+    }
+
+    void place_(size_t pos, size_t v)
+    {
+        p_heap[pos] = v;
+        p_heapPos[v] = pos;
+    }
+
+    void siftUp_(size_t pos)
+    {
+        const size_t v = p_heap[pos];
+        while (pos > 0)
+        {
+            const size_t parent = (pos - 1) / 2;
+            if (!before_(v, p_heap[parent]))
+                break;
+            place_(pos, p_heap[parent]);
+            pos = parent;
+        }
+        place_(pos, v);
+    }
+
+    void siftDown_(size_t pos)
+    {
+        const size_t v = p_heap[pos], num = p_heap.size();
+        for (;;)
+        {
+            size_t child = pos * 2 + 1;
+            if (child >= num)
+                break;
+            if (child + 1 < num && before_(p_heap[child + 1], p_heap[child]))
+                ++child;
+            if (!before_(p_heap[child], v))
+                break;
+            place_(pos, p_heap[child]);
+            pos = child;
+        }
+        place_(pos, v);
+    }
+
+    // free set
+    std::vector<uint64_t> p_free;
+    size_t p_numFree;
+    uint64_t p_summary;
+
+    // note and user index buckets
+    size_t p_mask;
+    std::vector<size_t>
+        p_noteHead, p_userHead,
+        p_noteNext, p_notePrev, p_userNext, p_userPrev;
+    std::vector<int> p_noteKey;
+    std::vector<int64_t> p_userKey;
+
+    // steal heap
+    std::vector<int> p_rank;
+    std::vector<double> p_value;
+    std::vector<size_t> p_heap, p_heapPos;
+};
+
+} // namespace Sonot
+
+#endif // SONOTSRC_SYNTHVOICEALLOCATOR_H
@@ -0,0 +1,660 @@
+/***************************************************************************
+
+Copyright (C) 2016  stefan.berke @ modular-audio-graphics.com
+
+This source is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either
+version 3.0 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this software; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+****************************************************************************/
+
+#ifndef SONOTSRC_SYNTHVOICEBANK_H
+#define SONOTSRC_SYNTHVOICEBANK_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cmath>
+#include <vector>
+
+#include "EnvelopeGenerator.h"
+#include "Oscillator.h"
+
+namespace Sonot {
+
+/** Contiguous storage for the state of all voices of a Synth.
+
+    Each voice is an index into a set of parallel arrays.
+    The combined-unisono oscillators of voice @c v live at
+    <tt>[v * unisonStride(), v * unisonStride() + numUnison[v])</tt>
+    in freq_c, inc and phase, and it's modulator voices at
+    <tt>[v * modStride(), (v+1) * modStride())</tt> in fm.
+    This way the render loop walks linear memory instead of
+    following pointers for each voice. */
+class SynthVoiceBank
+{
+public:
+
+    static constexpr size_t invalidIndex() { return size_t(-1); }
+
+    /** Maximum number of samples processed by calcBlock() */
+    static constexpr size_t blockSize() { return 64; }
+
+    /** Modulation routes, used to select a specialized kernel */
+    enum Route
+    {
+        R_AM = 1,
+        R_FM = 2,
+        R_PM = 4,
+        R_ADD = 8,
+        /** Any of the self modulation routes */
+        R_SELF = 16,
+        R_ALL = 31
+    };
+
+    /** Block function of one voice, see calcBlock() */
+    typedef void (SynthVoiceBank::*Kernel)(size_t v, double * output, size_t num,
+                                           const double * pitch);
+
+    struct FMVoice
+    {
+        /** Fixed-point phase, see Oscillator */
+        uint64_t phase;
+        double
+            velo, freqMul,
+            modFreq, modPhase, modAm, modAdd,
+            modSelfFreq, modSelfPhase, modSelfAm,
+            sample;
+        EnvelopeGenerator<double> env;
+        /** Control-rate interpolation of the envelope,
+            see modEnvelope() */
+        double envCur, envInc, envTarget;
+        size_t envRate, envLeft;
+
+        /** Starts the envelope interpolation, the envelope itself
+            must run at the sampling rate divided by @p rate */
+        void setControlRate(size_t rate)
+        {
+            envRate = rate;
+            envLeft = 0;
+            envCur = envInc = envTarget = 0.;
+        }
+    };
+
+    SynthVoiceBank()
+        : oscillator    (Oscillator::OT_SIMD),
+          fixedOscillator(Oscillator::OT_SIMD),
+          unisonLimit   (size_t(-1)),
+          p_numVoices   (0),
+          p_unisonStride(1),
+          p_modStride   (0)
+    { }
+
+    // ------------ getter -------------
+
+    size_t numVoices() const { return p_numVoices; }
+    /** Maximum number of combined unisono oscillators per voice */
+    size_t unisonStride() const { return p_unisonStride; }
+    /** Number of modulator voices per voice */
+    size_t modStride() const { return p_modStride; }
+
+    double curLevel(size_t v) const { return velo[v] * env[v].value(); }
+
+    /** Pointer to the first combined-unisono fixed-point phase of voice @p v */
+    uint64_t* phaseOf(size_t v) { return &phase[v * p_unisonStride]; }
+    /** Pointer to the first frequency coefficient of voice @p v */
+    const double* freqCOf(size_t v) const { return &freq_c[v * p_unisonStride]; }
+    /** Pointer to the first fixed-point phase increment of voice @p v */
+    const uint64_t* incOf(size_t v) const { return &inc[v * p_unisonStride]; }
+    /** Pointer to the first modulator of voice @p v */
+    FMVoice* fmOf(size_t v) { return p_modStride ? &fm[v * p_modStride] : nullptr; }
+
+    // ----------- setter --------------
+
+    /** Sets the frequency of the combined-unisono oscillator @p j
+        of voice @p v in periods per sample */
+    void setFreqC(size_t v, size_t j, double freqc)
+    {
+        freq_c[v * p_unisonStride + j] = freqc;
+        inc[v * p_unisonStride + j] = Oscillator::toFixed(freqc);
+    }
+
+    /** Sets the number of voices and resets all voice states. */
+    void resize(size_t numVoices)
+    {
+        p_numVoices = numVoices;
+
+        active.assign(numVoices, 0);
+        cued.assign(numVoices, 0);
+        generation.assign(numVoices, 0);
+        note.assign(numVoices, 0);
+        startSample.assign(numVoices, 0);
+        stopSample.assign(numVoices, 0);
+        lifetime.assign(numVoices, 0);
+        peak.assign(numVoices, 0.f);
+        freq.assign(numVoices, 0.);
+        velo.assign(numVoices, 0.);
+        fenvAmt.assign(numVoices, 0.);
+        env.assign(numVoices, EnvelopeGenerator<double>());
+        nextUnison.assign(numVoices, invalidIndex());
+        userData.assign(numVoices, nullptr);
+        userIndex.assign(numVoices, -1);
+        numUnison.assign(numVoices, 0);
+        activePos.assign(numVoices, invalidIndex());
+        activeVoices.clear();
+        activeVoices.reserve(numVoices);
+
+        freq_c.assign(numVoices * p_unisonStride, 0.);
+        inc.assign(numVoices * p_unisonStride, 0);
+        phase.assign(numVoices * p_unisonStride, 0);
+        fm.resize(numVoices * p_modStride);
+        kernel.assign(numVoices, &SynthVoiceBank::calcBlockCarrier);
+    }
+
+    /** Makes room for at least @p num combined-unisono oscillators
+        per voice. Existing oscillator states are kept. */
+    void reserveUnison(size_t num)
+    {
+        if (num <= p_unisonStride)
+            return;
+        std::vector<double> fc(p_numVoices * num, 0.);
+        std::vector<uint64_t> in(p_numVoices * num, 0),
+                              ph(p_numVoices * num, 0);
+        for (size_t v=0; v<p_numVoices; ++v)
+        for (size_t j=0; j<numUnison[v]; ++j)
+        {
+            fc[v * num + j] = freq_c[v * p_unisonStride + j];
+            in[v * num + j] = inc[v * p_unisonStride + j];
+            ph[v * num + j] = phase[v * p_unisonStride + j];
+        }
+        freq_c.swap(fc);
+        inc.swap(in);
+        phase.swap(ph);
+        p_unisonStride = num;
+    }
+
+    /** Sets the number of modulator voices per voice.
+        Existing modulator states are kept where possible. */
+    void setModStride(size_t num)
+    {
+        if (num == p_modStride)
+            return;
+        std::vector<FMVoice> f(p_numVoices * num);
+        const size_t n = std::min(num, p_modStride);
+        for (size_t v=0; v<p_numVoices; ++v)
+        for (size_t j=0; j<n; ++j)
+            f[v * num + j] = fm[v * p_modStride + j];
+        fm.swap(f);
+        p_modStride = num;
+        for (size_t v=0; v<p_numVoices; ++v)
+            selectKernel(v);
+    }
+
+    /** Returns the routes that the modulators of voice @p v use */
+    unsigned routesOf(size_t v) const
+    {
+        unsigned r = 0;
+        const FMVoice * f = p_modStride ? &fm[v * p_modStride] : nullptr;
+        for (size_t m=0; m<p_modStride; ++m, ++f)
+        {
+            // silent modulator
+            if (f->velo == 0.)
+                continue;
+            if (f->modAm != 0.) r |= R_AM;
+            if (f->modFreq != 0.) r |= R_FM;
+            if (f->modPhase != 0.) r |= R_PM;
+            if (f->modAdd != 0.) r |= R_ADD;
+            if (f->modSelfAm != 0. || f->modSelfFreq != 0.
+                || f->modSelfPhase != 0.)
+                r |= R_SELF;
+        }
+        return r;
+    }
+
+    /** Chooses the kernel for voice @p v from it's modulator settings.
+        Needs to be called when the modulators of the voice change. */
+    void selectKernel(size_t v) { kernel[v] = kernelFor(p_modStride, routesOf(v)); }
+
+    /** Returns the kernel for @p numOps modulators using @p routes */
+    static Kernel kernelFor(size_t numOps, unsigned routes);
+
+    /** Marks voice @p v as active and adds it to activeVoices */
+    void activate(size_t v)
+    {
+        active[v] = true;
+        if (activePos[v] != invalidIndex())
+            return;
+        activePos[v] = activeVoices.size();
+        activeVoices.push_back(v);
+    }
+
+    /** Marks voice @p v as inactive and removes it from activeVoices */
+    void deactivate(size_t v)
+    {
+        active[v] = false;
+        const size_t pos = activePos[v];
+        if (pos == invalidIndex())
+            return;
+        activeVoices[pos] = activeVoices.back();
+        activePos[activeVoices[pos]] = pos;
+        activeVoices.pop_back();
+        activePos[v] = invalidIndex();
+    }
+
+    // --------- processing ------------
+
+    double waveform(double p) const { return Oscillator::sample(oscillator, p); }
+
+    /** Advances all oscillators of voice @p v by one sample
+        and returns the (unenveloped) sum. */
+    double calcSample(size_t v);
+
+    /** Advances all oscillators of voice @p v by @p num samples
+        and writes the (unenveloped) sums into @p output.
+        @p num must not exceed blockSize().
+        The result is the same as calling calcSample() @p num times,
+        but the waveforms are calculated in blocks, by the kernel
+        that was chosen in selectKernel().
+        If @p pitch is not NULL, the frequencies of all oscillators
+        are multiplied by pitch[0..num-1]. */
+    void calcBlock(size_t v, double * output, size_t num,
+                   const double * pitch = nullptr)
+        { (this->*kernel[v])(v, output, num, pitch); }
+
+    /** Writes @p num values of the modulator envelope into @p output.
+        With a control rate above one, the envelope is only forwarded
+        once per control step and linearly interpolated in between. */
+    static void modEnvelope(FMVoice& f, double * output, size_t num);
+
+    /** Kernel without modulation */
+    void calcBlockCarrier(size_t v, double * output, size_t num,
+                          const double * pitch);
+
+    /** Modulation kernel for @p Ops modulators (or modStride() if zero)
+        that only calculates the given @p Routes.
+        Skipped routes have zero amounts, so the result is
+        bit-identical to the generic <tt>calcBlockFm<0, R_ALL></tt>. */
+    template <size_t Ops, unsigned Routes>
+    void calcBlockFm(size_t v, double * output, size_t num,
+                     const double * pitch);
+
+    /** The sine approximation used by all oscillators */
+    Oscillator::Tier oscillator;
+    /** The sine approximation for oscillators without phase modulation,
+        which is usually the same as oscillator */
+    Oscillator::Tier fixedOscillator;
+    /** Maximum number of rendered combined-unisono oscillators.
+        The others keep their phase until the limit is raised again. */
+    size_t unisonLimit;
+
+    // ---------- voice data -----------
+
+    /** @{ */
+    /** Per-voice arrays of size numVoices() */
+    std::vector<uint8_t> active, cued;
+    /** Incremented on each reuse of the voice */
+    std::vector<uint32_t> generation;
+    std::vector<int> note;
+    /** Absolute start time in samples */
+    std::vector<uint64_t> startSample;
+    /** Earliest scheduled stop time in samples */
+    std::vector<uint64_t> stopSample;
+    std::vector<size_t> lifetime;
+    /** Peak output level in the current block of blockSize() samples,
+        counted from the start of the voice */
+    std::vector<float> peak;
+    std::vector<double> freq, velo, fenvAmt;
+    std::vector<EnvelopeGenerator<double>> env;
+    std::vector<size_t> nextUnison;
+    std::vector<void*> userData;
+    std::vector<int64_t> userIndex;
+    /** Number of used combined-unisono oscillators */
+    std::vector<size_t> numUnison;
+    /** Index into activeVoices or invalidIndex() */
+    std::vector<size_t> activePos;
+    /** @} */
+
+    /** Indices of all active voices, in no particular order */
+    std::vector<size_t> activeVoices;
+
+    /** Per-oscillator arrays of size numVoices() * unisonStride().
+        freq_c is the frequency in periods per sample, inc the same
+        as fixed-point phase increment. */
+    std::vector<double> freq_c;
+    std::vector<uint64_t> inc, phase;
+
+    /** Modulators of size numVoices() * modStride() */
+    std::vector<FMVoice> fm;
+
+    /** The block function of each voice */
+    std::vector<Kernel> kernel;
+
+private:
+
+    size_t p_numVoices,
+           p_unisonStride,
+           p_modStride;
+};
+
+
+// ______________________ IMPL ______________________
+
+inline double SynthVoiceBank::calcSample(size_t v)
+{
+    const size_t num = std::min(numUnison[v], unisonLimit);
+    uint64_t * ph = phaseOf(v);
+    const uint64_t * in = incOf(v);
+
+    double s = 0.0;
+    if (!p_modStride)
+    {
+        // for each combined unisono voice
+        for (size_t j = 0; j<num; ++j)
+        {
+            // advance phase counter
+            ph[j] += in[j];
+
+            s += waveform(Oscillator::toPeriods(ph[j]));
+        }
+    }
+    else
+    {
+        double phaseMod = 0.,
+               freqMod = 0.,
+               ampMod = 0.,
+               addMod = 0.;
+        FMVoice * f = fmOf(v);
+        for (size_t k = 0; k<p_modStride; ++k, ++f)
+        {
+            // proc modulator envelope
+            f->env.next();
+            // modulation from previous stage
+            f->phase += Oscillator::toFixed(f->modSelfFreq * freqMod);
+            freq[v] += f->modSelfFreq * freqMod;
+            // get modulator's sample
+            f->phase += Oscillator::toFixed(freqCOf(v)[0] * f->freqMul);
+            f->sample = f->velo * f->env.value()
+                            * waveform(Oscillator::toPeriods(f->phase)
+                                       + f->modSelfPhase * phaseMod);
+            f->sample += f->modSelfAm * ampMod
+                            * (f->sample*ampMod - f->sample);
+            // add to modulation
+            phaseMod += f->sample * f->modPhase;
+            freqMod += f->sample * f->modFreq;
+            ampMod += f->sample * f->modAm;
+            addMod += f->sample * f->modAdd;
+        }
+
+        // for each combined unisono voice
+        const uint64_t fmInc = Oscillator::toFixed(freqMod);
+        for (size_t j = 0; j<num; ++j)
+        {
+            // advance phase counter
+            ph[j] += in[j] + fmInc;
+
+            double sam = waveform(Oscillator::toPeriods(ph[j]) + phaseMod);
+            sam += ampMod * (ampMod*sam - sam);
+            s += sam + addMod;
+        }
+    }
+    return s;
+}
+
+inline void SynthVoiceBank::modEnvelope(FMVoice& f, double * out, size_t num)
+{
+    if (f.envRate < 2)
+    {
+        f.env.process(out, num);
+        return;
+    }
+
+    for (size_t k = 0; k < num; )
+    {
+        // next control step
+        if (!f.envLeft)
+        {
+            f.envCur = f.envTarget;
+            f.envTarget = f.env.next();
+            f.envInc = (f.envTarget - f.envCur) / f.envRate;
+            f.envLeft = f.envRate;
+        }
+
+        const size_t n = std::min(num - k, f.envLeft);
+        double e = f.envCur;
+        for (size_t j = 0; j < n; ++j, e += f.envInc)
+            out[k + j] = e;
+        f.envCur = e;
+        f.envLeft -= n;
+        k += n;
+    }
+}
+
+inline void SynthVoiceBank::calcBlockCarrier(size_t v, double * out, size_t num,
+                                             const double * pitch)
+{
+    const size_t numUni = std::min(numUnison[v], unisonLimit);
+    uint64_t * ph = phaseOf(v);
+    const uint64_t * in = incOf(v);
+    const double * fc = freqCOf(v);
+
+    uint64_t arg[blockSize()];
+    double sam[blockSize()];
+
+    for (size_t k = 0; k<num; ++k)
+        out[k] = 0.;
+
+    // for each combined unisono voice
+    for (size_t j = 0; j<numUni; ++j)
+    {
+        // advance phase counter
+        uint64_t p = ph[j];
+        if (pitch)
+            for (size_t k = 0; k<num; ++k)
+            {
+                p += Oscillator::toFixed(fc[j] * pitch[k]);
+                arg[k] = p;
+            }
+        else
+        {
+            const uint64_t f = in[j];
+            for (size_t k = 0; k<num; ++k)
+            {
+                p += f;
+                arg[k] = p;
+            }
+        }
+        ph[j] = p;
+
+        Oscillator::processFixed(fixedOscillator, arg, sam, num);
+        for (size_t k = 0; k<num; ++k)
+            out[k] += sam[k];
+    }
+}
+
+template <size_t Ops, unsigned Routes>
+void SynthVoiceBank::calcBlockFm(size_t v, double * out, size_t num,
+                                 const double * pitch)
+{
+    const bool
+        doAm = Routes & R_AM,
+        doFm = Routes & R_FM,
+        doPm = Routes & R_PM,
+        doAdd = Routes & R_ADD,
+        doSelf = Routes & R_SELF;
+    const size_t numOps = Ops ? Ops : p_modStride;
+
+    const size_t numUni = std::min(numUnison[v], unisonLimit);
+    uint64_t * ph = phaseOf(v);
+    const uint64_t * in = incOf(v);
+    const double * fc = freqCOf(v);
+
+    uint64_t fixedArg[blockSize()];
+    double arg[blockSize()],
+           phaseMod[blockSize()],
+           freqMod[blockSize()],
+           ampMod[blockSize()],
+           addMod[blockSize()],
+           envVal[blockSize()];
+
+    for (size_t k = 0; k<num; ++k)
+    {
+        out[k] = 0.;
+        if (doPm) phaseMod[k] = 0.;
+        if (doFm) freqMod[k] = 0.;
+        if (doAm) ampMod[k] = 0.;
+        if (doAdd) addMod[k] = 0.;
+    }
+
+    // each modulator stage over the whole block
+    FMVoice * f = fmOf(v);
+    for (size_t m = 0; m<numOps; ++m, ++f)
+    {
+        // proc modulator envelope
+        modEnvelope(*f, envVal, num);
+
+        uint64_t p = f->phase;
+        const double step = fc[0] * f->freqMul;
+        const uint64_t stepFixed = Oscillator::toFixed(step);
+        if (pitch)
+            for (size_t k = 0; k<num; ++k)
+                fixedArg[k] = p += Oscillator::toFixed(step * pitch[k]);
+        else
+            for (size_t k = 0; k<num; ++k)
+                fixedArg[k] = p += stepFixed;
+
+        // modulation from previous stage,
+        // the sums of disabled routes are zero
+        if (doSelf && (doFm || doPm))
+        {
+            if (doFm && f->modSelfFreq != 0.)
+            {
+                double fr = freq[v];
+                uint64_t acc = 0;
+                for (size_t k = 0; k<num; ++k)
+                {
+                    acc += Oscillator::toFixed(f->modSelfFreq * freqMod[k]);
+                    fr += f->modSelfFreq * freqMod[k];
+                    fixedArg[k] += acc;
+                }
+                freq[v] = fr;
+                p += acc;
+            }
+            for (size_t k = 0; k<num; ++k)
+                arg[k] = doPm ? Oscillator::toPeriods(fixedArg[k])
+                                + f->modSelfPhase * phaseMod[k]
+                              : Oscillator::toPeriods(fixedArg[k]);
+            Oscillator::process(oscillator, arg, arg, num);
+        }
+        else
+            Oscillator::processFixed(fixedOscillator, fixedArg, arg, num);
+        f->phase = p;
+
+        double s = f->sample;
+        for (size_t k = 0; k<num; ++k)
+        {
+            // get modulator's sample
+            s = f->velo * envVal[k] * arg[k];
+            if (doSelf && doAm)
+                s += f->modSelfAm * ampMod[k] * (s*ampMod[k] - s);
+            // add to modulation
+            if (doPm) phaseMod[k] += s * f->modPhase;
+            if (doFm) freqMod[k] += s * f->modFreq;
+            if (doAm) ampMod[k] += s * f->modAm;
+            if (doAdd) addMod[k] += s * f->modAdd;
+        }
+        f->sample = s;
+    }
+
+    // frequency modulation as fixed-point increment,
+    // the same for all unisono oscillators
+    uint64_t fmInc[blockSize()];
+    if (doFm)
+        for (size_t k = 0; k<num; ++k)
+            fmInc[k] = Oscillator::toFixed(freqMod[k]);
+
+    // for each combined unisono voice
+    for (size_t j = 0; j<numUni; ++j)
+    {
+        // advance phase counter
+        uint64_t p = ph[j];
+        if (pitch)
+            for (size_t k = 0; k<num; ++k)
+                fixedArg[k] = p += Oscillator::toFixed(fc[j] * pitch[k]);
+        else
+        {
+            const uint64_t f = in[j];
+            for (size_t k = 0; k<num; ++k)
+                fixedArg[k] = p += f;
+        }
+        if (doFm)
+        {
+            uint64_t acc = 0;
+            for (size_t k = 0; k<num; ++k)
+                fixedArg[k] += acc += fmInc[k];
+            p += acc;
+        }
+        ph[j] = p;
+
+        if (doPm)
+        {
+            for (size_t k = 0; k<num; ++k)
+                arg[k] = Oscillator::toPeriods(fixedArg[k]) + phaseMod[k];
+            Oscillator::process(oscillator, arg, arg, num);
+        }
+        else
+            Oscillator::processFixed(fixedOscillator, fixedArg, arg, num);
+
+        for (size_t k = 0; k<num; ++k)
+        {
+            double sam = arg[k];
+            if (doAm)
+                sam += ampMod[k] * (ampMod[k]*sam - sam);
+            out[k] += doAdd ? sam + addMod[k] : sam;
+        }
+    }
+}
+
+inline SynthVoiceBank::Kernel SynthVoiceBank::kernelFor(
+        size_t numOps, unsigned routes)
+{
+    #define SONOT__KERNEL(ops__, r__) &SynthVoiceBank::calcBlockFm<ops__, r__>
+    #define SONOT__KERNELS8(ops__, r__)                                     \
+        SONOT__KERNEL(ops__, r__), SONOT__KERNEL(ops__, r__ + 1),           \
+        SONOT__KERNEL(ops__, r__ + 2), SONOT__KERNEL(ops__, r__ + 3),       \
+        SONOT__KERNEL(ops__, r__ + 4), SONOT__KERNEL(ops__, r__ + 5),       \
+        SONOT__KERNEL(ops__, r__ + 6), SONOT__KERNEL(ops__, r__ + 7)
+    #define SONOT__KERNELS(ops__) {                                         \
+        SONOT__KERNELS8(ops__, 0), SONOT__KERNELS8(ops__, 8),               \
+        SONOT__KERNELS8(ops__, 16), SONOT__KERNELS8(ops__, 24) }
+
+    // first row is for any number of modulators
+    static const Kernel table[5][32] =
+    {
+        SONOT__KERNELS(0), SONOT__KERNELS(1), SONOT__KERNELS(2),
+        SONOT__KERNELS(3), SONOT__KERNELS(4)
+    };
+
+    #undef SONOT__KERNELS
+    #undef SONOT__KERNELS8
+    #undef SONOT__KERNEL
+
+    // no modulation reaches the carrier
+    if (numOps == 0 || (routes & ~unsigned(R_SELF)) == 0)
+        return &SynthVoiceBank::calcBlockCarrier;
+
+    return table[numOps > 4 ? 0 : numOps][routes];
+}
+
+} // namespace Sonot
+
+#endif // SONOTSRC_SYNTHVOICEBANK_H
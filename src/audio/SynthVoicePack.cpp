@@ -0,0 +1,437 @@
+/***************************************************************************
+
+Copyright (C) 2016  stefan.berke @ modular-audio-graphics.com
+
+This source is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either
+version 3.0 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this software; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+****************************************************************************/
+
+#include <algorithm>
+#include <cstdint>
+
+#include "SynthVoicePack.h"
+#include "SynthVoiceBank.h"
+
+#if (defined(__GNUC__) || defined(__clang__)) \
+    && (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__)))
+#   define SONOT_HAVE_VOICE_PACKS
+#endif
+
+// The 32 byte vectors are only passed between the inline functions
+// below, which are all flattened into calcAvx2()
+#if defined(SONOT_HAVE_VOICE_PACKS) && !defined(__clang__)
+#   pragma GCC diagnostic ignored "-Wpsabi"
+#endif
+
+namespace Sonot {
+
+namespace {
+
+    /** The tiers that are calculated on all lanes at once */
+    bool isPoly(Oscillator::Tier t)
+        { return t == Oscillator::OT_POLY || t == Oscillator::OT_SIMD; }
+
+} // namespace
+
+#ifdef SONOT_HAVE_VOICE_PACKS
+
+namespace {
+
+    /** Vectors of @p W doubles or fixed-point phases */
+    template <size_t W> struct Lanes;
+
+    template <> struct Lanes<2>
+    {
+        typedef double D __attribute__((vector_size(16)));
+        typedef uint64_t U __attribute__((vector_size(16)));
+    };
+
+    template <> struct Lanes<4>
+    {
+        typedef double D __attribute__((vector_size(32)));
+        typedef uint64_t U __attribute__((vector_size(32)));
+    };
+
+    /** The lane versions of the Oscillator conversions,
+        with the same operations in the same order */
+    template <size_t W>
+    struct Pack
+    {
+        typedef typename Lanes<W>::D D;
+        typedef typename Lanes<W>::U U;
+
+        static D set(double x) { D r; for (size_t l=0; l<W; ++l) r[l] = x; return r; }
+        static U setU(uint64_t x) { U r; for (size_t l=0; l<W; ++l) r[l] = x; return r; }
+
+        /** Same as Oscillator::toPeriods() */
+        static D toPeriods(const U& p)
+        {
+            return (D)((p >> 12) | setU(0x3FF0000000000000ull)) - set(1.);
+        }
+
+        /** std::floor() for |x| < 2^51 */
+        static D floor(const D& x)
+        {
+            const D magic = set(6755399441055744.);
+            const D r = (x + magic) - magic;
+            // 1.0 where rounding went up
+            return r - (D)((U)(r > x) & (U)set(1.));
+        }
+
+        /** Integer conversion of whole numbers in [0, 2^52) */
+        static U toInt(const D& x)
+        {
+            const D magic = set(4503599627370496.);
+            return (U)(x + magic) - (U)magic;
+        }
+
+        /** Same as Oscillator::toFixed(). The clamped product is split
+            into two exact 32 bit halves, because there is no vector
+            conversion to unsigned 64 bit before AVX-512. */
+        static U toFixed(const D& x)
+        {
+            const D f = x - floor(x),
+                    top = set(18446744073709549568.);
+            D y = f * 18446744073709551616.;
+            const U over = (U)(top < y);
+            y = (D)(((U)top & over) | ((U)y & ~over));
+            const D hi = floor(y * (1. / 4294967296.)),
+                    lo = floor(y - hi * 4294967296.);
+            return (toInt(hi) << 32) + toInt(lo);
+        }
+
+        /** Same as Oscillator::processSimd(), but on all lanes */
+        static D sine(const D& phase)
+        {
+            const D magic = set(6755399441055744.);
+            const U signMask = setU(0x8000000000000000ull);
+            // reduce to [-.5, .5]
+            D x = phase - ((phase + magic) - magic);
+            // fold into [-.25, .25]
+            const D a = (D)((U)x & ~signMask),
+                    xf = (D)((U)set(.5) | ((U)x & signMask)) - x;
+            const U fold = (U)(a > set(.25));
+            x = (D)(((U)xf & fold) | ((U)x & ~fold));
+            // polynomial
+            const D t = x * set(6.283185307179586476925),
+                    t2 = t * t;
+            D p = set(Oscillator::polyC9) + t2 * set(Oscillator::polyC11);
+            p = set(Oscillator::polyC7) + t2 * p;
+            p = set(Oscillator::polyC5) + t2 * p;
+            p = set(Oscillator::polyC3) + t2 * p;
+            p = set(1.) + t2 * p;
+            return t * p;
+        }
+
+        /** Oscillator::process() on @p num interleaved samples */
+        static void process(Oscillator::Tier t, D * arg, size_t num)
+        {
+            if (isPoly(t))
+                for (size_t k = 0; k<num; ++k)
+                    arg[k] = sine(arg[k]);
+            else
+                Oscillator::process(t, (double*)arg, (double*)arg, num * W);
+        }
+
+        /** Oscillator::processFixed() on @p num interleaved samples */
+        static void processFixed(Oscillator::Tier t, const U * phase,
+                                 D * out, size_t num)
+        {
+            if (isPoly(t))
+                for (size_t k = 0; k<num; ++k)
+                    out[k] = sine(toPeriods(phase[k]));
+            else
+                Oscillator::processFixed(t, (const uint64_t*)phase,
+                                         (double*)out, num * W);
+        }
+    };
+
+    /** Returns the routes of the kernel of voice @p v,
+        or all routes for a generic kernel */
+    unsigned kernelRoutes(const SynthVoiceBank& bank, size_t v)
+    {
+        for (unsigned r = 0; r <= SynthVoiceBank::R_ALL; ++r)
+            if (bank.kernel[v] == SynthVoiceBank::kernelFor(bank.modStride(), r))
+                return r;
+        return SynthVoiceBank::R_ALL;
+    }
+
+    /** SynthVoiceBank::calcBlockFm() and calcBlockCarrier()
+        for @p W voices in the lanes */
+    template <size_t W>
+    inline void calcPack(SynthVoiceBank& bank, const size_t* v,
+                         double * const * out, size_t num,
+                         const double * pitch)
+    {
+        typedef Pack<W> P;
+        typedef typename P::D D;
+        typedef typename P::U U;
+        const size_t B = SynthVoiceBank::blockSize();
+
+        const bool carrier = bank.kernel[v[0]]
+                == &SynthVoiceBank::calcBlockCarrier;
+        const unsigned routes = carrier ? 0 : kernelRoutes(bank, v[0]);
+        const bool
+            doAm = routes & SynthVoiceBank::R_AM,
+            doFm = routes & SynthVoiceBank::R_FM,
+            doPm = routes & SynthVoiceBank::R_PM,
+            doAdd = routes & SynthVoiceBank::R_ADD,
+            doSelf = routes & SynthVoiceBank::R_SELF;
+        const size_t
+            numOps = carrier ? 0 : bank.modStride(),
+            numUni = std::min(bank.numUnison[v[0]], bank.unisonLimit);
+
+        U fixedArg[B];
+        D arg[B], sum[B], phaseMod[B], freqMod[B], ampMod[B], addMod[B],
+          envVal[B];
+        double envTmp[B];
+
+        const D zero = P::set(0.);
+        for (size_t k = 0; k<num; ++k)
+        {
+            sum[k] = zero;
+            if (doPm) phaseMod[k] = zero;
+            if (doFm) freqMod[k] = zero;
+            if (doAm) ampMod[k] = zero;
+            if (doAdd) addMod[k] = zero;
+        }
+
+        // each modulator stage over the whole block
+        for (size_t m = 0; m<numOps; ++m)
+        {
+            SynthVoiceBank::FMVoice * f[W];
+            D velo, step, selfFreq, selfPhase, selfAm, s,
+              modPhase, modFreq, modAm, modAdd;
+            U p, stepFixed;
+            bool anySelfFreq = false;
+            for (size_t l = 0; l<W; ++l)
+            {
+                f[l] = bank.fmOf(v[l]) + m;
+                SynthVoiceBank::modEnvelope(*f[l], envTmp, num);
+                for (size_t k = 0; k<num; ++k)
+                    envVal[k][l] = envTmp[k];
+
+                p[l] = f[l]->phase;
+                step[l] = bank.freqCOf(v[l])[0] * f[l]->freqMul;
+                stepFixed[l] = Oscillator::toFixed(step[l]);
+                velo[l] = f[l]->velo;
+                selfFreq[l] = f[l]->modSelfFreq;
+                selfPhase[l] = f[l]->modSelfPhase;
+                selfAm[l] = f[l]->modSelfAm;
+                modPhase[l] = f[l]->modPhase;
+                modFreq[l] = f[l]->modFreq;
+                modAm[l] = f[l]->modAm;
+                modAdd[l] = f[l]->modAdd;
+                s[l] = f[l]->sample;
+                anySelfFreq |= f[l]->modSelfFreq != 0.;
+            }
+
+            if (pitch)
+                for (size_t k = 0; k<num; ++k)
+                    fixedArg[k] = p += P::toFixed(step * pitch[k]);
+            else
+                for (size_t k = 0; k<num; ++k)
+                    fixedArg[k] = p += stepFixed;
+
+            // modulation from previous stage
+            if (doSelf && (doFm || doPm))
+            {
+                // lanes without self-fm add zeros
+                if (doFm && anySelfFreq)
+                {
+                    D fr;
+                    for (size_t l = 0; l<W; ++l)
+                        fr[l] = bank.freq[v[l]];
+                    U acc = P::setU(0);
+                    for (size_t k = 0; k<num; ++k)
+                    {
+                        acc += P::toFixed(selfFreq * freqMod[k]);
+                        fr += selfFreq * freqMod[k];
+                        fixedArg[k] += acc;
+                    }
+                    for (size_t l = 0; l<W; ++l)
+                        if (selfFreq[l] != 0.)
+                            bank.freq[v[l]] = fr[l];
+                    p += acc;
+                }
+                for (size_t k = 0; k<num; ++k)
+                    arg[k] = doPm ? P::toPeriods(fixedArg[k])
+                                    + selfPhase * phaseMod[k]
+                                  : P::toPeriods(fixedArg[k]);
+                P::process(bank.oscillator, arg, num);
+            }
+            else
+                P::processFixed(bank.fixedOscillator, fixedArg, arg, num);
+
+            for (size_t k = 0; k<num; ++k)
+            {
+                s = velo * envVal[k] * arg[k];
+                if (doSelf && doAm)
+                    s += selfAm * ampMod[k] * (s*ampMod[k] - s);
+                if (doPm) phaseMod[k] += s * modPhase;
+                if (doFm) freqMod[k] += s * modFreq;
+                if (doAm) ampMod[k] += s * modAm;
+                if (doAdd) addMod[k] += s * modAdd;
+            }
+
+            for (size_t l = 0; l<W; ++l)
+            {
+                f[l]->phase = p[l];
+                f[l]->sample = s[l];
+            }
+        }
+
+        U fmInc[B];
+        if (doFm)
+            for (size_t k = 0; k<num; ++k)
+                fmInc[k] = P::toFixed(freqMod[k]);
+
+        // for each combined unisono voice
+        for (size_t j = 0; j<numUni; ++j)
+        {
+            U p, inc;
+            D fc;
+            for (size_t l = 0; l<W; ++l)
+            {
+                p[l] = bank.phaseOf(v[l])[j];
+                inc[l] = bank.incOf(v[l])[j];
+                fc[l] = bank.freqCOf(v[l])[j];
+            }
+
+            if (pitch)
+                for (size_t k = 0; k<num; ++k)
+                    fixedArg[k] = p += P::toFixed(fc * pitch[k]);
+            else
+                for (size_t k = 0; k<num; ++k)
+                    fixedArg[k] = p += inc;
+            if (doFm)
+            {
+                U acc = P::setU(0);
+                for (size_t k = 0; k<num; ++k)
+                    fixedArg[k] += acc += fmInc[k];
+                p += acc;
+            }
+            for (size_t l = 0; l<W; ++l)
+                bank.phaseOf(v[l])[j] = p[l];
+
+            if (doPm)
+            {
+                for (size_t k = 0; k<num; ++k)
+                    arg[k] = P::toPeriods(fixedArg[k]) + phaseMod[k];
+                P::process(bank.oscillator, arg, num);
+            }
+            else
+                P::processFixed(bank.fixedOscillator, fixedArg, arg, num);
+
+            for (size_t k = 0; k<num; ++k)
+            {
+                D sam = arg[k];
+                if (doAm)
+                    sam += ampMod[k] * (ampMod[k]*sam - sam);
+                sum[k] += doAdd ? sam + addMod[k] : sam;
+            }
+        }
+
+        for (size_t l = 0; l<W; ++l)
+            for (size_t k = 0; k<num; ++k)
+                out[l][k] = sum[k][l];
+    }
+
+    void calcSse2(SynthVoiceBank& bank, const size_t* v,
+                  double * const * out, size_t num, const double * pitch)
+    {
+        calcPack<2>(bank, v, out, num, pitch);
+    }
+
+    // no FMA, it would change the rounding
+    __attribute__((target("avx2"), flatten))
+    void calcAvx2(SynthVoiceBank& bank, const size_t* v,
+                  double * const * out, size_t num, const double * pitch)
+    {
+        calcPack<4>(bank, v, out, num, pitch);
+    }
+
+} // namespace
+
+#endif // SONOT_HAVE_VOICE_PACKS
+
+
+SynthVoicePack::Isa SynthVoicePack::detect()
+{
+#ifdef SONOT_HAVE_VOICE_PACKS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return ISA_AVX2;
+    return ISA_SSE2;
+#else
+    return ISA_NONE;
+#endif
+}
+
+const char* SynthVoicePack::name(Isa isa)
+{
+    switch (isa)
+    {
+        case ISA_NONE: return "none";
+        case ISA_SSE2: return "sse2";
+        case ISA_AVX2: return "avx2";
+    }
+    return "";
+}
+
+size_t SynthVoicePack::numLanes(Isa isa)
+{
+    switch (isa)
+    {
+        case ISA_NONE: return 0;
+        case ISA_SSE2: return 2;
+        case ISA_AVX2: return 4;
+    }
+    return 0;
+}
+
+bool SynthVoicePack::canPack(const SynthVoiceBank& bank, const size_t* v,
+                             size_t num)
+{
+    // the other tiers are not vectorized across the lanes,
+    // interleaving the voices only adds work
+    if (!num || !isPoly(bank.oscillator)
+             || !isPoly(bank.fixedOscillator))
+        return false;
+    const size_t numUni = std::min(bank.numUnison[v[0]], bank.unisonLimit);
+    for (size_t l = 1; l<num; ++l)
+        if (bank.kernel[v[l]] != bank.kernel[v[0]]
+            || std::min(bank.numUnison[v[l]], bank.unisonLimit) != numUni)
+            return false;
+    return true;
+}
+
+void SynthVoicePack::calcBlock(Isa isa, SynthVoiceBank& bank, const size_t* v,
+                               double * const * output, size_t num,
+                               const double * pitch)
+{
+#ifdef SONOT_HAVE_VOICE_PACKS
+    switch (isa)
+    {
+        case ISA_NONE: break;
+        case ISA_SSE2: calcSse2(bank, v, output, num, pitch); return;
+        case ISA_AVX2: calcAvx2(bank, v, output, num, pitch); return;
+    }
+#else
+    (void)isa; (void)bank; (void)v; (void)output; (void)num; (void)pitch;
+#endif
+}
+
+} // namespace Sonot
@@ -0,0 +1,84 @@
+/***************************************************************************
+
+Copyright (C) 2016  stefan.berke @ modular-audio-graphics.com
+
+This source is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either
+version 3.0 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this software; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+****************************************************************************/
+
+#ifndef SONOTSRC_SYNTHVOICEPACK_H
+#define SONOTSRC_SYNTHVOICEPACK_H
+
+#include <cstddef>
+
+namespace Sonot {
+
+class SynthVoiceBank;
+
+/** Renders several voices of a SynthVoiceBank in lockstep,
+    one voice per vector lane.
+
+    Phases are 64 bit fixed-point and samples are doubles, so a
+    pack holds two voices with SSE2 and four with AVX2. The
+    instruction set is chosen at runtime. The voices of a pack need
+    the same kernel (number of operators and modulation routes) and
+    the same number of unisono oscillators, see canPack().
+    The OT_POLY and OT_SIMD sines are calculated on all lanes at
+    once, the other tiers per sample.
+    The result is bit-identical to SynthVoiceBank::calcBlock(),
+    so it does not matter which voices end up in a pack.
+
+    Packs are only compiled for x86 with GCC or Clang, other
+    targets always use the scalar kernels of SynthVoiceBank. */
+class SynthVoicePack
+{
+public:
+
+    enum Isa
+    {
+        /** No packs, voices are rendered one by one */
+        ISA_NONE,
+        /** Two voices per pack */
+        ISA_SSE2,
+        /** Four voices per pack */
+        ISA_AVX2
+    };
+
+    /** Returns the best instruction set of the running CPU */
+    static Isa detect();
+
+    /** Returns the name of the instruction set */
+    static const char* name(Isa isa);
+
+    /** Returns the number of voices in one pack, or zero for ISA_NONE */
+    static size_t numLanes(Isa isa);
+
+    /** Returns true if the @p num voices @p v can be rendered in one
+        pack, and if that is faster than rendering them one by one,
+        which is only the case for the polynomial oscillators */
+    static bool canPack(const SynthVoiceBank& bank, const size_t* v, size_t num);
+
+    /** Same as SynthVoiceBank::calcBlock() for the numLanes() voices
+        @p v, writing @p num samples to each @p output[lane].
+        @p num must not exceed SynthVoiceBank::blockSize().
+        Does nothing for ISA_NONE. */
+    static void calcBlock(Isa isa, SynthVoiceBank& bank, const size_t* v,
+                          double * const * output, size_t num,
+                          const double * pitch);
+};
+
+} // namespace Sonot
+
+#endif // SONOTSRC_SYNTHVOICEPACK_H
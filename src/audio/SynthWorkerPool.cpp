@@ -0,0 +1,193 @@
+/***************************************************************************
+
+Copyright (C) 2016  stefan.berke @ modular-audio-graphics.com
+
+This source is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either
+version 3.0 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this software; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+****************************************************************************/
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "SynthWorkerPool.h"
+#include "DenormalGuard.h"
+
+namespace Sonot {
+
+namespace {
+
+    /** Number of polls before a worker goes to sleep */
+    const int kSpinCount = 4000;
+
+} // namespace
+
+struct SynthWorkerPool::Private
+{
+    /** The items of one thread, on it's own cache line */
+    struct alignas(64) Range
+    {
+        std::atomic<size_t> next;
+        size_t end;
+    };
+
+    Private(size_t numThreads)
+        : ranges    (numThreads)
+        , func      (nullptr)
+        , context   (nullptr)
+        , epoch     (0)
+        , busy      (0)
+        , sleepers  (0)
+        , quit      (false)
+    { }
+
+    void workerLoop(size_t thread);
+    /** Executes items, own range first */
+    void work(size_t thread);
+
+    std::vector<Range> ranges;
+    std::vector<std::thread> threads;
+
+    Func func;
+    void* context;
+
+    /** Incremented for each job */
+    std::atomic<uint64_t> epoch;
+    /** Number of workers that have not finished the current job */
+    std::atomic<size_t> busy;
+    std::atomic<size_t> sleepers;
+    std::atomic<bool> quit;
+
+    std::mutex mutex;
+    std::condition_variable cond;
+};
+
+
+SynthWorkerPool::SynthWorkerPool(size_t numThreads)
+    : p_    (new Private(std::max(size_t(1), numThreads)))
+{
+    for (size_t i=1; i<p_->ranges.size(); ++i)
+        p_->threads.push_back(std::thread([=](){ p_->workerLoop(i); }));
+}
+
+SynthWorkerPool::~SynthWorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(p_->mutex);
+        p_->quit = true;
+    }
+    p_->cond.notify_all();
+    for (auto& t : p_->threads)
+        t.join();
+    delete p_;
+}
+
+size_t SynthWorkerPool::numThreads() const { return p_->ranges.size(); }
+
+void SynthWorkerPool::run(size_t numItems, Func func, void* context)
+{
+    const size_t num = p_->ranges.size();
+    if (num < 2 || numItems < 2)
+    {
+        for (size_t i=0; i<numItems; ++i)
+            func(context, i);
+        return;
+    }
+
+    // distribute items
+    for (size_t t=0; t<num; ++t)
+    {
+        p_->ranges[t].next.store(numItems * t / num, std::memory_order_relaxed);
+        p_->ranges[t].end = numItems * (t + 1) / num;
+    }
+    p_->func = func;
+    p_->context = context;
+    p_->busy.store(num - 1, std::memory_order_relaxed);
+
+    // publish job
+    // (sequentially consistent, pairs with the sleepers count
+    //  and the epoch check in workerLoop())
+    p_->epoch.fetch_add(1);
+    if (p_->sleepers.load())
+    {
+        // makes sure a worker is either waiting or sees the new epoch
+        { std::lock_guard<std::mutex> lock(p_->mutex); }
+        p_->cond.notify_all();
+    }
+
+    p_->work(0);
+
+    // wait for workers to leave the job
+    while (p_->busy.load(std::memory_order_acquire))
+        std::this_thread::yield();
+}
+
+void SynthWorkerPool::Private::work(size_t thread)
+{
+    const size_t num = ranges.size();
+    for (size_t k=0; k<num; ++k)
+    {
+        Range& r = ranges[(thread + k) % num];
+        for (;;)
+        {
+            const size_t i = r.next.fetch_add(1, std::memory_order_relaxed);
+            if (i >= r.end)
+                break;
+            func(context, i);
+        }
+    }
+}
+
+void SynthWorkerPool::Private::workerLoop(size_t thread)
+{
+    DenormalGuard denormalGuard;
+    uint64_t seen = 0;
+    for (;;)
+    {
+        // wait for next job
+        int spins = 0;
+        uint64_t e;
+        while ((e = epoch.load(std::memory_order_acquire)) == seen)
+        {
+            if (quit)
+                return;
+            if (++spins < kSpinCount)
+            {
+                std::this_thread::yield();
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(mutex);
+            ++sleepers;
+            cond.wait(lock, [&]()
+            {
+                return quit || epoch.load() != seen;
+            });
+            --sleepers;
+            spins = 0;
+        }
+        if (quit)
+            return;
+        seen = e;
+
+        work(thread);
+        busy.fetch_sub(1, std::memory_order_release);
+    }
+}
+
+} // namespace Sonot
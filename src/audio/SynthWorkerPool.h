@@ -0,0 +1,67 @@
+/***************************************************************************
+
+Copyright (C) 2016  stefan.berke @ modular-audio-graphics.com
+
+This source is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either
+version 3.0 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this software; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+****************************************************************************/
+
+#ifndef SONOTSRC_SYNTHWORKERPOOL_H
+#define SONOTSRC_SYNTHWORKERPOOL_H
+
+#include <cstddef>
+
+namespace Sonot {
+
+/** Fixed set of threads that execute the items of a job in parallel.
+
+    The items of each job are split into one contiguous range per
+    thread. A thread works through its own range and then steals
+    items from the ranges of the others, so voices with uneven
+    render cost do not leave threads idle.
+    The calling thread takes part in the work. run() does not
+    allocate; it spins briefly while waiting for the workers and
+    the workers sleep when there is no job for a while. */
+class SynthWorkerPool
+{
+public:
+
+    /** Function called for each item */
+    typedef void (*Func)(void* context, size_t item);
+
+    /** Creates @p numThreads - 1 worker threads */
+    explicit SynthWorkerPool(size_t numThreads);
+    ~SynthWorkerPool();
+
+    /** Number of threads including the calling thread */
+    size_t numThreads() const;
+
+    /** Calls @p func(@p context, i) for each i in [0, @p numItems)
+        and returns when all are done. The order of execution is
+        undefined. Must only be called by one thread at a time. */
+    void run(size_t numItems, Func func, void* context);
+
+private:
+
+    SynthWorkerPool(const SynthWorkerPool&) = delete;
+    void operator=(const SynthWorkerPool&) = delete;
+
+    struct Private;
+    Private* p_;
+};
+
+} // namespace Sonot
+
+#endif // SONOTSRC_SYNTHWORKERPOOL_H
@@ -0,0 +1,298 @@
+/***************************************************************************
+
+Copyright (C) 2016  stefan.berke @ modular-audio-graphics.com
+
+This source is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either
+version 3.0 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this software; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+****************************************************************************/
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <memory>
+
+#include <QFile>
+
+#include "QProps/error.h"
+
+#include "WavWriter.h"
+
+namespace Sonot {
+
+namespace {
+
+    /** Appends @p n little-endian bytes of @p v */
+    void putLE(char*& p, uint64_t v, size_t n)
+    {
+        for (size_t i=0; i<n; ++i, v >>= 8)
+            *p++ = char(v & 0xff);
+    }
+
+    void putTag(char*& p, const char* tag)
+    {
+        std::memcpy(p, tag, 4);
+        p += 4;
+    }
+
+    /** Riff chunk sizes are 32 bit */
+    const uint64_t kMaxRiffSize = 0xffffffffu;
+
+    /** KSDATAFORMAT_SUBTYPE_PCM or _IEEE_FLOAT after the format code */
+    const char kSubFormatGuid[] =
+        "\x00\x00\x00\x00\x10\x00\x80\x00\x00\xaa\x00\x38\x9b\x71";
+
+    /** Clips @p s to [-1,1] and scales to @p maxVal */
+    int32_t toInt(float s, int32_t maxVal)
+    {
+        return int32_t(std::lrint(std::max(-1.f, std::min(1.f, s)) * maxVal));
+    }
+
+} // namespace
+
+
+WavWriter::WavWriter()
+    : p_device      (nullptr)
+    , p_ownDevice   (false)
+    , p_format      (F_INT16)
+    , p_sampleRate  (0)
+    , p_numChannels (0)
+    , p_numFrames   (0)
+    , p_headerPos   (0)
+{
+}
+
+WavWriter::~WavWriter()
+{
+    try
+    {
+        close();
+    }
+    catch (const QProps::Exception&) { }
+}
+
+size_t WavWriter::bytesPerSample(Format f)
+{
+    switch (f)
+    {
+        case F_INT16: return 2;
+        case F_INT24: return 3;
+        case F_FLOAT: return 4;
+    }
+    return 0;
+}
+
+const char* WavWriter::formatName(Format f)
+{
+    switch (f)
+    {
+        case F_INT16: return "int16";
+        case F_INT24: return "int24";
+        case F_FLOAT: return "float";
+    }
+    return "";
+}
+
+void WavWriter::open(const QString& filename, size_t sampleRate,
+                     size_t numChannels, Format format)
+{
+    close();
+    // owned here until the header is written
+    std::unique_ptr<QFile> file(new QFile(filename));
+    if (!file->open(QFile::WriteOnly))
+        QPROPS_IO_ERROR("Could not open '"
+                      << filename << "' for writing,\n"
+                      << file->errorString());
+    open(file.get(), sampleRate, numChannels, format);
+    file.release();
+    p_ownDevice = true;
+}
+
+void WavWriter::open(QIODevice* device, size_t sampleRate,
+                     size_t numChannels, Format format)
+{
+    close();
+    if (device->isSequential())
+        QPROPS_IO_ERROR("Can not write wave file to a sequential device, "
+                        "the header needs to be updated on close()");
+    p_device = device;
+    p_ownDevice = false;
+    p_sampleRate = sampleRate;
+    p_numChannels = numChannels;
+    p_format = format;
+    p_numFrames = 0;
+    p_headerPos = device->pos();
+    try
+    {
+        writeHeader();
+    }
+    catch (const QProps::Exception&)
+    {
+        p_device = nullptr;
+        throw;
+    }
+}
+
+uint64_t WavWriter::dataSize() const
+{
+    return p_numFrames * p_numChannels * bytesPerSample(p_format);
+}
+
+bool WavWriter::isExtensible() const
+{
+    return p_numChannels > 2 || bytesPerSample(p_format) > 2;
+}
+
+uint64_t WavWriter::headerSize() const
+{
+    const bool isFloat = p_format == F_FLOAT;
+    // float needs a fact chunk
+    return 12 + 8 + (isExtensible() ? 40 : isFloat ? 18 : 16)
+            + (isFloat ? 12 : 0) + 8;
+}
+
+void WavWriter::writeHeader()
+{
+    const bool isFloat = p_format == F_FLOAT,
+               isExt = isExtensible();
+    const uint64_t
+            bps = bytesPerSample(p_format),
+            dataSize = this->dataSize(),
+            headerSize = this->headerSize(),
+            // WAVE_FORMAT_PCM or WAVE_FORMAT_IEEE_FLOAT
+            formatCode = isFloat ? 3 : 1;
+
+    char header[96];
+    char* p = header;
+    putTag(p, "RIFF");
+    // including the pad byte of an odd sized data chunk
+    putLE(p, headerSize - 8 + dataSize + (dataSize & 1), 4);
+    putTag(p, "WAVE");
+
+    putTag(p, "fmt ");
+    putLE(p, isExt ? 40 : isFloat ? 18 : 16, 4);
+    // WAVE_FORMAT_EXTENSIBLE carries the format code in the sub format
+    putLE(p, isExt ? 0xfffe : formatCode, 2);
+    putLE(p, p_numChannels, 2);
+    putLE(p, p_sampleRate, 4);
+    putLE(p, p_sampleRate * p_numChannels * bps, 4);
+    putLE(p, p_numChannels * bps, 2);
+    putLE(p, bps * 8, 2);
+    if (isExt)
+    {
+        putLE(p, 22, 2);
+        // valid bits
+        putLE(p, bps * 8, 2);
+        // speaker mask, stems and buses have no speaker positions
+        putLE(p, p_numChannels == 1 ? 0x4 : p_numChannels == 2 ? 0x3 : 0, 4);
+        putLE(p, formatCode, 2);
+        std::memcpy(p, kSubFormatGuid, 14);
+        p += 14;
+    }
+    else if (isFloat)
+        putLE(p, 0, 2);
+
+    if (isFloat)
+    {
+        putTag(p, "fact");
+        putLE(p, 4, 4);
+        putLE(p, p_numFrames, 4);
+    }
+
+    putTag(p, "data");
+    putLE(p, dataSize, 4);
+
+    if (p_device->write(header, p - header) != p - header)
+        QPROPS_IO_ERROR("Could not write wave header,\n"
+                        << p_device->errorString());
+}
+
+void WavWriter::write(const float* samples, size_t numFrames)
+{
+    QPROPS_ASSERT(p_device, "WavWriter::write() without open()");
+
+    const size_t num = numFrames * p_numChannels,
+                 size = num * bytesPerSample(p_format);
+    const uint64_t newSize = dataSize() + size;
+    if (headerSize() - 8 + newSize + (newSize & 1) > kMaxRiffSize)
+        QPROPS_IO_ERROR("Wave data exceeds the 4 GiB limit of RIFF");
+    p_bytes.resize(size);
+    char* p = p_bytes.data();
+    switch (p_format)
+    {
+        case F_INT16:
+            for (size_t i=0; i<num; ++i)
+                putLE(p, uint32_t(toInt(samples[i], 32767)), 2);
+        break;
+        case F_INT24:
+            for (size_t i=0; i<num; ++i)
+                putLE(p, uint32_t(toInt(samples[i], 8388607)), 3);
+        break;
+        case F_FLOAT:
+            for (size_t i=0; i<num; ++i)
+            {
+                uint32_t bits;
+                std::memcpy(&bits, &samples[i], 4);
+                putLE(p, bits, 4);
+            }
+        break;
+    }
+
+    if (p_device->write(p_bytes.data(), qint64(size)) != qint64(size))
+        QPROPS_IO_ERROR("Could not write wave data,\n"
+                        << p_device->errorString());
+    p_numFrames += numFrames;
+}
+
+void WavWriter::close()
+{
+    if (!p_device)
+        return;
+
+    QIODevice* dev = p_device;
+    const bool own = p_ownDevice;
+    p_device = nullptr;
+
+    // odd sized chunks are followed by a pad byte
+    bool ok = true;
+    if (dataSize() & 1)
+        ok = dev->write("\0", 1) == 1;
+
+    // rewrite the header with the final sizes
+    const qint64 end = dev->pos();
+    if (ok)
+        ok = dev->seek(p_headerPos);
+    if (ok)
+    {
+        p_device = dev;
+        try
+        {
+            writeHeader();
+            ok = dev->seek(end);
+        }
+        catch (const QProps::Exception&)
+        {
+            ok = false;
+        }
+        p_device = nullptr;
+    }
+
+    if (own)
+        delete dev;
+
+    if (!ok)
+        QPROPS_IO_ERROR("Could not update wave header");
+}
+
+} // namespace Sonot
@@ -0,0 +1,117 @@
+/***************************************************************************
+
+Copyright (C) 2016  stefan.berke @ modular-audio-graphics.com
+
+This source is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either
+version 3.0 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this software; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+****************************************************************************/
+
+#ifndef SONOTSRC_WAVWRITER_H
+#define SONOTSRC_WAVWRITER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <QString>
+
+class QIODevice;
+
+namespace Sonot {
+
+/** Streams float samples into a RIFF/WAVE file.
+
+    The header is written on open() and it's sizes are updated
+    on close(), so the device needs to be seekable.
+    More than two channels and more than 16 bits use
+    WAVE_FORMAT_EXTENSIBLE. The sample data is limited to the
+    4 GiB of a RIFF file.
+    Errors are thrown as QProps::Exception. */
+class WavWriter
+{
+public:
+
+    enum Format
+    {
+        /** 16 bit integer PCM */
+        F_INT16,
+        /** 24 bit integer PCM */
+        F_INT24,
+        /** 32 bit IEEE float */
+        F_FLOAT
+    };
+
+    WavWriter();
+    /** Calls close() */
+    ~WavWriter();
+
+    static size_t bytesPerSample(Format f);
+    /** Returns a name for the format, e.g. "int16" */
+    static const char* formatName(Format f);
+
+    // ---- getter ----
+
+    bool isOpen() const { return p_device != nullptr; }
+    Format format() const { return p_format; }
+    size_t sampleRate() const { return p_sampleRate; }
+    size_t numChannels() const { return p_numChannels; }
+    /** Number of frames written since open() */
+    uint64_t numFrames() const { return p_numFrames; }
+
+    // ---- io ----
+
+    /** Creates the file @p filename and writes the header */
+    void open(const QString& filename, size_t sampleRate,
+              size_t numChannels, Format format);
+    /** Writes into the opened, seekable @p device, which is not owned.
+        The file starts at the current position of the device. */
+    void open(QIODevice* device, size_t sampleRate,
+              size_t numChannels, Format format);
+
+    /** Writes @p numFrames frames of interleaved samples.
+        Integer formats are clipped to [-1,1].
+        Throws without writing if the file would exceed 4 GiB. */
+    void write(const float* samples, size_t numFrames);
+
+    /** Adds the pad byte after an odd number of sample bytes,
+        updates the header and closes the file */
+    void close();
+
+private:
+
+    WavWriter(const WavWriter&) = delete;
+    void operator=(const WavWriter&) = delete;
+
+    /** Needs WAVE_FORMAT_EXTENSIBLE */
+    bool isExtensible() const;
+    uint64_t headerSize() const;
+    void writeHeader();
+    /** Bytes of sample data written since open() */
+    uint64_t dataSize() const;
+
+    QIODevice* p_device;
+    bool p_ownDevice;
+    Format p_format;
+    size_t p_sampleRate, p_numChannels;
+    uint64_t p_numFrames;
+    /** Device position of the RIFF header */
+    qint64 p_headerPos;
+    /** Converted samples of the last write() */
+    std::vector<char> p_bytes;
+};
+
+} // namespace Sonot
+
+#endif // SONOTSRC_WAVWRITER_H
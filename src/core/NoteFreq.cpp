@@ -30,7 +30,9 @@ NoteFreq<F>::NoteFreq(F notes, F freq)
     : p_notes_per_octave    (notes),
       p_base_freq           (freq),
       p_num                 (0),
-      p_denom               (0)
+      p_denom               (0),
+      p_temperament         (T_RATIO),
+      p_key                 (0)
 {
     recalc_();
 }
@@ -41,6 +43,8 @@ NoteFreq<F>::NoteFreq(int notes, F freq, int nom, int denom)
       p_base_freq           (freq),
       p_num                 (nom),
       p_denom               (denom),
+      p_temperament         (T_RATIO),
+      p_key                 (0),
       p_table               (notes)
 {
     recalc_();
@@ -70,45 +74,90 @@ void NoteFreq<F>::setPythagorean(int n, int d)
     recalc_();
 }
 
+template <typename F>
+void NoteFreq<F>::setTemperament(Temperament t, int key)
+{
+    p_temperament = t;
+    p_key = ((key % 12) + 12) % 12;
+    recalc_();
+}
+
 template <typename F>
 void NoteFreq<F>::recalc_()
 {
+    if (isTempered_())
+        calcTemperament_();
     // equal tuning
-    if (p_num == 0 || p_denom == 0)
+    else if (p_num == 0 || p_denom == 0)
     {
         p_notes_per_octave = std::max(F(0.0000001), p_notes_per_octave);
         p_oct_pow = std::pow(F(2), F(1) / p_notes_per_octave);
-        return;
+    }
+    else
+    {
+        // init table
+        p_notes_per_octave = std::max(F(1), p_notes_per_octave);
+        p_table.resize(size_t(p_notes_per_octave));
+        for (auto& f : p_table)
+            f = 1.;
+
+
+        // -- "pythagorean tuning" --
+
+        double freq = F(1);
+        int k = 0;
+        for (int i=0; i<p_table.size(); ++i)
+        {
+            if (size_t(k) < p_table.size())
+                p_table[size_t(k)] = freq;
+            freq = freq * F(p_num) / F(p_denom);
+            while (freq >= F(2))
+                freq /= F(2);
+            k = (k - 5 + (int)p_table.size()) % p_table.size();
+        }
     }
 
-    // init table
-    p_notes_per_octave = std::max(F(1), p_notes_per_octave);
-    if (p_table.empty())
-        p_table.resize(1);
-    for (auto& f : p_table)
-        f = 1.;
-
-
-    // -- "pythagorean tuning" --
+    // lookup tables
+    p_freq.resize(tableSize() + 1);
+    p_range.resize(tableSize());
+    for (int i=0; i<=tableSize(); ++i)
+        p_freq[i] = calcFrequency_(i);
+    for (int i=0; i<tableSize(); ++i)
+        p_range[i] = p_freq[i+1] - p_freq[i];
+}
 
-    double freq = F(1);
-    int k = 0;
-    for (int i=0; i<p_table.size(); ++i)
+template <typename F>
+void NoteFreq<F>::calcTemperament_()
+{
+    const F fifth = p_temperament == T_PYTHAGOREAN
+            ? F(3) / F(2)
+            : std::pow(F(5), F(1) / F(4));
+
+    // eleven fifths upwards from the key, folded into one octave
+    p_table.resize(12);
+    F freq = F(1);
+    for (int i=0; i<12; ++i)
     {
-        if (size_t(k) < p_table.size())
-            p_table[size_t(k)] = freq;
-        freq = freq * F(p_num) / F(p_denom);
+        p_table[(p_key + 7 * i) % 12] = freq;
+        freq *= fifth;
         while (freq >= F(2))
             freq /= F(2);
-        k = (k - 5 + (int)p_table.size()) % p_table.size();
     }
 
+    // relative to C
+    const F c = p_table[0];
+    for (auto& f : p_table)
+    {
+        f /= c;
+        if (f < F(1))
+            f *= F(2);
+    }
 }
 
 template <typename F>
-F NoteFreq<F>::frequency(int note) const
+F NoteFreq<F>::calcFrequency_(int note) const
 {
-    if (p_num == 0 || p_denom == 0)
+    if (!isTable_())
     {
         return p_base_freq * std::pow(p_oct_pow, note);
     }
@@ -116,7 +165,7 @@ F NoteFreq<F>::frequency(int note) const
     note = std::max(0, note);
     int oct = note / p_table.size(),
         idx = note % p_table.size();
-    return p_base_freq * p_table[idx] * (1 << oct);
+    return std::ldexp(p_base_freq * p_table[idx], oct);
 }
 
 template <typename F>
@@ -25,13 +25,33 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 
 namespace Sonot {
 
+/** Note number to frequency conversion.
+
+    The frequencies of the notes 0 to tableSize() - 1 are calculated
+    whenever the tuning changes, so frequency() and range() are
+    simple lookups in that range. */
 template <typename F>
 class NoteFreq
 {
 public:
 
+    /** Historical temperaments for twelve notes per octave */
+    enum Temperament
+    {
+        /** Equal temperament, or the chain of fifths given by
+            setPythagorean() */
+        T_RATIO,
+        /** Pure 3:2 fifths */
+        T_PYTHAGOREAN,
+        /** Fifths narrowed by a quarter syntonic comma,
+            for pure major thirds */
+        T_MEANTONE
+    };
+
     /** Base C */
     static constexpr F defaultBaseFrequency() { return F(16.35158); }
+    /** Number of precalculated notes */
+    static constexpr int tableSize() { return 128; }
 
     NoteFreq(F notesPerOctave = F(12),
              F baseFrequency = defaultBaseFrequency());
@@ -47,19 +67,38 @@ public:
     F baseFrequency() const { return p_base_freq; }
     int pythagoeanNum() const { return p_num; }
     int pythagoeanDenom() const { return p_denom; }
+    Temperament temperament() const { return p_temperament; }
+    int temperamentKey() const { return p_key; }
 
     // ------- setter -------
 
     void setNotesPerOctave(F notes);
     void setNotesPerOctave(int notes);
-    void setBaseFrequency(F f) { p_base_freq = f; }
+    void setBaseFrequency(F f) { p_base_freq = f; recalc_(); }
     void setPythagorean(int nom, int denom);
+    /** Sets a temperament, where the chain of eleven fifths starts
+        on @p key (0 = C, 3 = E flat). The base frequency stays the
+        frequency of C. The temperament is only used with twelve
+        notes per octave, T_RATIO applies otherwise. */
+    void setTemperament(Temperament t, int key = 0);
 
     // ----- conversion -----
 
     /** Returns the frequency for the given note.
-        @p note is lower-clamped to 0 */
-    F frequency(int note) const;
+        @p note is lower-clamped to 0, except for equal temperament */
+    F frequency(int note) const
+    {
+        return note >= 0 && note < tableSize() ? p_freq[note]
+                                               : calcFrequency_(note);
+    }
+
+    /** Returns the distance in Hertz to the next note */
+    F range(int note) const
+    {
+        return note >= 0 && note < tableSize()
+                ? p_range[note]
+                : calcFrequency_(note + 1) - calcFrequency_(note);
+    }
 
     /** Returns the octave of the frequency */
     F octave(F freq) const;
@@ -67,13 +106,26 @@ public:
 private:
 
     void recalc_();
+    /** Fills p_table with the ratios of the temperament */
+    void calcTemperament_();
+    F calcFrequency_(int note) const;
+    /** p_table is used instead of p_oct_pow */
+    bool isTable_() const
+        { return (p_num != 0 && p_denom != 0) || isTempered_(); }
+    bool isTempered_() const
+        { return p_temperament != T_RATIO && p_notes_per_octave == F(12); }
 
     F p_notes_per_octave,
       p_base_freq,
       p_oct_pow;
     int p_num,
         p_denom;
+    Temperament p_temperament;
+    int p_key;
+    /** Ratios within one octave */
     std::vector<F> p_table;
+    /** Frequencies and distances of the first tableSize() notes */
+    std::vector<F> p_freq, p_range;
 };
 
 
@@ -181,7 +181,8 @@ double NoteStream::beatsPerMinute(size_t idx) const
     QPROPS_ASSERT_LT(idx, numBars(), "in NoteStream::beatsPerMinute("
                      << idx << ")");
 
-    return std::max(1., p_props_.get("bpm", defaultBpm_).toDouble());
+    return std::max(1., p_props_.get(QStringLiteral("bpm"),
+                                     defaultBpm_).toDouble());
 }
 
 double NoteStream::barLengthSeconds(size_t idx) const
@@ -76,7 +76,7 @@ public:
 
     bool isEmpty() const { return p_data_.empty(); }
     bool isPauseOnEnd() const
-        { return props().get("pause-on-end").toBool(); }
+        { return props().get(QStringLiteral("pause-on-end")).toBool(); }
     /** Number of Bars in this collection */
     size_t numBars() const { return p_data_.size(); }
 
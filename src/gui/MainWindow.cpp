@@ -44,6 +44,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 #include "AllPropertiesView.h"
 #include "audio/SamplePlayer.h"
 #include "audio/SynthDevice.h"
+#include "audio/SynthRenderer.h"
 #include "core/NoteStream.h"
 #include "core/Score.h"
 #include "core/ScoreEditor.h"
@@ -88,6 +89,8 @@ struct MainWindow::Private
     bool saveFile(const QString& filename, const QString& text);
     bool exportMusicXML();
     bool exportShadertoy(bool toFile);
+    bool exportWav(WavWriter::Format format);
+    bool exportWavStems(SynthRenderer::StemMode mode);
 
     //void setEditProperties(const QString& s);
     //void applyProperties();
@@ -147,6 +150,10 @@ MainWindow::MainWindow(QWidget *parent)
         "shadertoy", "Shadertoy", "../sonot/export",
         QStringList() << ".glsl",
         QStringList() << "GLSL (*.glsl)"));
+    QProps::FileTypes::addFileType(QProps::FileType(
+        "wav", "Wave", "../sonot/export",
+        QStringList() << ".wav",
+        QStringList() << "Wave audio (*.wav)"));
 }
 
 MainWindow::~MainWindow()
@@ -214,6 +221,21 @@ void MainWindow::Private::createObjects()
     {
         setChanged(true);
     });
+    // patch the playback timeline
+    connect(document->editor(), &ScoreEditor::noteValuesChanged,
+            synthStream, &SynthDevice::updateBars);
+    connect(document->editor(), &ScoreEditor::notesDeleted,
+            synthStream, &SynthDevice::updateBars);
+    connect(document->editor(), &ScoreEditor::barsChanged,
+            synthStream, &SynthDevice::updateBars);
+    connect(document->editor(), &ScoreEditor::barsDeleted,
+            synthStream, &SynthDevice::updateStreams);
+    connect(document->editor(), &ScoreEditor::streamsChanged,
+            synthStream, &SynthDevice::updateStreams);
+    connect(document->editor(), &ScoreEditor::streamsDeleted,
+            synthStream, &SynthDevice::updateStreams);
+    connect(document->editor(), &ScoreEditor::streamPropertiesChanged,
+            synthStream, &SynthDevice::updateStreams);
     connect(document->editor(), &ScoreEditor::scoreReset,
             [=](Score* s)
     {
@@ -304,6 +326,30 @@ void MainWindow::Private::createMenu()
             a = subsub->addAction(tr("to clipboard"));
             connect(a, &QAction::triggered, [=](){ exportShadertoy(false); });
 
+        subsub = sub->addMenu(tr("Wave audio"));
+
+            a = subsub->addAction(tr("16 bit"));
+            connect(a, &QAction::triggered, [=]()
+                { exportWav(WavWriter::F_INT16); });
+
+            a = subsub->addAction(tr("24 bit"));
+            connect(a, &QAction::triggered, [=]()
+                { exportWav(WavWriter::F_INT24); });
+
+            a = subsub->addAction(tr("32 bit float"));
+            connect(a, &QAction::triggered, [=]()
+                { exportWav(WavWriter::F_FLOAT); });
+
+            subsub->addSeparator();
+
+            a = subsub->addAction(tr("24 bit stems, one file per row"));
+            connect(a, &QAction::triggered, [=]()
+                { exportWavStems(SynthRenderer::SM_FILES); });
+
+            a = subsub->addAction(tr("24 bit stems, one channel per row"));
+            connect(a, &QAction::triggered, [=]()
+                { exportWavStems(SynthRenderer::SM_CHANNELS); });
+
     menu->addSeparator();
 
     a = menu->addAction(tr("Load Synth settings"));
@@ -388,6 +434,15 @@ void MainWindow::Private::createMenu()
         synthStream->setPlaying(false);
     });
 
+    menu->addSeparator();
+
+    a = menu->addAction(tr("Render ahead in own thread"));
+    a->setCheckable(true);
+    a->connect(a, &QAction::triggered, [=](bool e)
+    {
+        synthStream->setRenderThread(e);
+    });
+
 
     menu = p->menuBar()->addMenu(tr("Settings"));
 
@@ -590,6 +645,71 @@ bool MainWindow::Private::exportShadertoy(bool toFile)
     return true;
 }
 
+bool MainWindow::Private::exportWav(WavWriter::Format format)
+{
+    QString filename = QProps::FileTypes::getSaveFilename("wav", p);
+    if (filename.isEmpty())
+        return false;
+
+    try
+    {
+        SynthRenderer renderer;
+        renderer.setSynth(synthStream->synth());
+        renderer.setFormat(format);
+        // one thread per core
+        renderer.setNumThreads(0);
+        QApplication::setOverrideCursor(Qt::WaitCursor);
+        const SynthRenderer::Stats& stats =
+                renderer.render(*document->score(), filename);
+        QApplication::restoreOverrideCursor();
+        p->statusBar()->showMessage(
+                    tr("Rendered %1 seconds at %2 times real-time")
+                    .arg(stats.seconds, 0, 'f', 1)
+                    .arg(stats.speed(), 0, 'f', 1));
+        return true;
+    }
+    catch (QProps::Exception e)
+    {
+        QApplication::restoreOverrideCursor();
+        QMessageBox::critical(p, tr("export wave"),
+                              tr("Could not render score to\n%1\n%2")
+                              .arg(filename).arg(e.what()));
+    }
+    return false;
+}
+
+bool MainWindow::Private::exportWavStems(SynthRenderer::StemMode mode)
+{
+    QString filename = QProps::FileTypes::getSaveFilename("wav", p);
+    if (filename.isEmpty())
+        return false;
+
+    try
+    {
+        SynthRenderer renderer;
+        renderer.setSynth(synthStream->synth());
+        renderer.setFormat(WavWriter::F_INT24);
+        QApplication::setOverrideCursor(Qt::WaitCursor);
+        const SynthRenderer::Stats& stats =
+                renderer.renderStems(*document->score(), filename, mode);
+        QApplication::restoreOverrideCursor();
+        p->statusBar()->showMessage(
+                    tr("Rendered %1 stems of %2 seconds at %3 times real-time")
+                    .arg(SynthRenderer::numStems(*document->score()))
+                    .arg(stats.seconds, 0, 'f', 1)
+                    .arg(stats.speed(), 0, 'f', 1));
+        return true;
+    }
+    catch (QProps::Exception e)
+    {
+        QApplication::restoreOverrideCursor();
+        QMessageBox::critical(p, tr("export wave"),
+                              tr("Could not render score to\n%1\n%2")
+                              .arg(filename).arg(e.what()));
+    }
+    return false;
+}
+
 bool MainWindow::Private::loadSynth(const QString& fn)
 {
     try
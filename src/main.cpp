@@ -18,12 +18,108 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 
 ****************************************************************************/
 
+#include <cstdio>
+
 #include <QApplication>
+#include <QCommandLineParser>
+
+#include "QProps/error.h"
+#include "audio/SynthDevice.h"
+#include "audio/SynthRenderer.h"
+#include "core/Score.h"
 #include "gui/MainWindow.h"
 
+/** Renders a score to a wave file without opening a window, e.g.
+    @code
+    sonot --render out.wav --format int24 organistisch6.sonot.json
+    @endcode */
+int renderScore(const QStringList& arguments)
+{
+    using namespace Sonot;
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    parser.addPositionalArgument("score", "The .sonot.json file to render");
+    parser.addOption(QCommandLineOption(
+        "render", "Renders the score into the wave <file>", "file"));
+    parser.addOption(QCommandLineOption(
+        "synth", "Loads the synth settings from <file>", "file"));
+    parser.addOption(QCommandLineOption(
+        "format", "Sample format int16, int24 or float", "format", "int16"));
+    parser.addOption(QCommandLineOption(
+        "stems", "Renders each row into a stem, <mode> is \"files\" "
+                 "for one file or \"channels\" for one channel per row",
+        "mode"));
+    parser.addOption(QCommandLineOption(
+        "threads", "Renders the rows of the streams in <num> threads, "
+                   "0 for one per core", "num", "1"));
+    parser.process(arguments);
+
+    if (parser.positionalArguments().size() != 1)
+        parser.showHelp(1);
+
+    SynthRenderer renderer;
+    bool formatFound = false;
+    for (int f = WavWriter::F_INT16; f <= WavWriter::F_FLOAT; ++f)
+        if (parser.value("format") == WavWriter::formatName(WavWriter::Format(f)))
+        {
+            renderer.setFormat(WavWriter::Format(f));
+            formatFound = true;
+        }
+    if (!formatFound)
+        parser.showHelp(1);
+
+    bool threadsOk;
+    renderer.setNumThreads(parser.value("threads").toUInt(&threadsOk));
+    if (!threadsOk)
+        parser.showHelp(1);
+
+    try
+    {
+        if (parser.isSet("synth"))
+        {
+            SynthDevice device;
+            device.loadJsonFile(parser.value("synth"));
+            renderer.setSynth(device.synth());
+        }
+
+        Score score;
+        score.loadJsonFile(parser.positionalArguments()[0]);
+
+        const QString stems = parser.value("stems");
+        if (!stems.isEmpty() && stems != "files" && stems != "channels")
+            parser.showHelp(1);
+
+        const SynthRenderer::Stats& stats = stems.isEmpty()
+            ? renderer.render(score, parser.value("render"))
+            : renderer.renderStems(score, parser.value("render"),
+                                   stems == "files"
+                                   ? SynthRenderer::SM_FILES
+                                   : SynthRenderer::SM_CHANNELS);
+        std::printf("rendered %.1f seconds in %.2f seconds, "
+                    "%.1f times real-time\n",
+                    stats.seconds, stats.renderSeconds, stats.speed());
+    }
+    catch (const QProps::Exception& e)
+    {
+        std::fprintf(stderr, "%s\n", e.text().toLocal8Bit().constData());
+        return 1;
+    }
+    return 0;
+}
+
 #if 1
 int main(int argc, char *argv[])
 {
+    // headless rendering
+    for (int i=1; i<argc; ++i)
+        if (QString(argv[i]) == "--render"
+            || QString(argv[i]).startsWith("--render="))
+        {
+            QCoreApplication a(argc, argv);
+            return renderScore(a.arguments());
+        }
+
     QApplication a(argc, argv);
     Sonot::MainWindow w;
     w.show();
@@ -0,0 +1,1890 @@
+/***************************************************************************
+
+Copyright (C) 2016  stefan.berke @ modular-audio-graphics.com
+
+This source is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either
+version 3.0 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this software; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+****************************************************************************/
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <QString>
+#include <QBuffer>
+#include <QElapsedTimer>
+#include <QtTest>
+
+#include "audio/Oscillator.h"
+#include "audio/AllocationGuard.h"
+#include "audio/DenormalGuard.h"
+#include "audio/EnvelopeGenerator.h"
+#include "audio/Synth.h"
+#include "audio/SynthControl.h"
+#include "audio/SynthDevice.h"
+#include "audio/SynthEventQueue.h"
+#include "audio/SynthLoad.h"
+#include "audio/SynthVoiceAllocator.h"
+#include "audio/SynthVoiceBank.h"
+#include "audio/SynthVoicePack.h"
+#include "audio/SynthRenderer.h"
+#include "audio/SynthSequencer.h"
+#include "audio/SynthSettings.h"
+#include "audio/SynthTimeline.h"
+#include "audio/WavWriter.h"
+#include "core/Score.h"
+#include "core/NoteStream.h"
+#include "core/Bar.h"
+#include "QProps/error.h"
+
+using namespace Sonot;
+
+
+class SonotAudioTest : public QObject
+{
+    Q_OBJECT
+
+public:
+    SonotAudioTest() { }
+
+    static std::vector<double> createRandomPhases(size_t num, double range);
+    /** Renders a fixed note schedule in blocks of @p blockSize */
+    static std::vector<float> renderSchedule(size_t blockSize);
+    /** Sets up one of the test configurations of testRenderUnchanged() */
+    static void setupSynth(Synth& synth, int config);
+
+private slots:
+
+    void testOscillatorAccuracy_data();
+    void testOscillatorAccuracy();
+
+    void benchmarkOscillator_data();
+    void benchmarkOscillator();
+
+    void testEventTiming_data();
+    void testEventTiming();
+
+    void testVoiceAllocator_data();
+    void testVoiceAllocator();
+
+    void testParameters();
+    void testRenderUnchanged_data();
+    void testRenderUnchanged();
+
+    void testNoAllocation_data();
+    void testNoAllocation();
+    void testDeviceNoAllocation();
+    void testDeviceBlockSize();
+    void testDeviceRenderThread();
+    void testDeviceScoreEdit();
+
+    void testThreadsBitIdentical_data();
+    void testThreadsBitIdentical();
+
+    void testFmKernels_data();
+    void testFmKernels();
+    void testLongSustain();
+
+    void testEnvelopeBlock_data();
+    void testEnvelopeBlock();
+    void testEnvelopeRate();
+
+    void testControlRamp();
+    void testControlRate_data();
+    void testControlRate();
+
+    void testSilenceCulling_data();
+    void testSilenceCulling();
+    void testDenormalGuard();
+
+    void testLoadHysteresis();
+    void testQualitySteps();
+
+    void testVoicePacks_data();
+    void testVoicePacks();
+    void testSynthVoicePacks_data();
+    void testSynthVoicePacks();
+
+    void testWavWriter_data();
+    void testWavWriter();
+    void testParallelRender();
+    void testSynthBuses();
+    void testSynthSettings();
+    void testSynthTimeline();
+    void testSynthTimeMap();
+};
+
+
+std::vector<double> SonotAudioTest::createRandomPhases(size_t num, double range)
+{
+    std::vector<double> phase(num);
+    for (auto& p : phase)
+        p = (double(rand()) / RAND_MAX * 2. - 1.) * range;
+    return phase;
+}
+
+
+
+void SonotAudioTest::testOscillatorAccuracy_data()
+{
+    QTest::addColumn<int>("tier");
+    QTest::addColumn<double>("range");
+
+    for (int t = Oscillator::OT_TABLE; t <= Oscillator::OT_SIMD; ++t)
+    {
+        QTest::newRow(QString("%1 small").arg(Oscillator::name(
+                        Oscillator::Tier(t))).toUtf8().constData())
+                << t << 4.;
+        QTest::newRow(QString("%1 large").arg(Oscillator::name(
+                        Oscillator::Tier(t))).toUtf8().constData())
+                << t << double(1 << 20);
+    }
+}
+
+void SonotAudioTest::testOscillatorAccuracy()
+{
+    QFETCH(int, tier);
+    QFETCH(double, range);
+    const auto t = Oscillator::Tier(tier);
+
+    auto phase = createRandomPhases(100000, range);
+    std::vector<double> ref(phase.size()), out(phase.size());
+    Oscillator::processLibm(phase.data(), ref.data(), phase.size());
+    Oscillator::process(t, phase.data(), out.data(), phase.size());
+
+    double maxErr = 0.;
+    for (size_t i=0; i<phase.size(); ++i)
+    {
+        maxErr = std::max(maxErr, std::abs(out[i] - ref[i]));
+        // block and single-sample versions must agree
+        QVERIFY(std::abs(Oscillator::sample(t, phase[i]) - out[i]) < 1e-12);
+    }
+    qDebug() << Oscillator::name(t) << "max error" << maxErr;
+    QVERIFY(maxErr <= Oscillator::maxError(t));
+
+    // fixed-point phases
+    std::vector<uint64_t> fixed(phase.size());
+    for (size_t i=0; i<phase.size(); ++i)
+        fixed[i] = Oscillator::toFixed(phase[i]);
+    Oscillator::processFixed(t, fixed.data(), out.data(), fixed.size());
+    for (size_t i=0; i<phase.size(); ++i)
+        QVERIFY(std::abs(out[i] - ref[i]) <= Oscillator::maxError(t) + 1e-9);
+}
+
+
+void SonotAudioTest::benchmarkOscillator_data()
+{
+    QTest::addColumn<int>("tier");
+
+    for (int t = Oscillator::OT_LIBM; t <= Oscillator::OT_SIMD; ++t)
+        QTest::newRow(Oscillator::name(Oscillator::Tier(t))) << t;
+}
+
+void SonotAudioTest::benchmarkOscillator()
+{
+    QFETCH(int, tier);
+    const auto t = Oscillator::Tier(tier);
+
+    auto phase = createRandomPhases(1 << 16, 1000.);
+    std::vector<double> out(phase.size());
+
+    QBENCHMARK
+    {
+        Oscillator::process(t, phase.data(), out.data(), phase.size());
+    }
+}
+
+
+std::vector<float> SonotAudioTest::renderSchedule(size_t blockSize)
+{
+    const size_t length = 20000;
+
+    // the unisono detune is random
+    srand(1);
+
+    Synth synth;
+    synth.noteOnAt(60, .5, 1000, 1);
+    synth.noteOnAt(64, .5, 3333, 2);
+    synth.noteOffByIndexAt(1, 5000);
+    synth.noteOnAt(67, .5, 7001, 3);
+    synth.notesOffAt(9000);
+
+    std::vector<float> out(length + blockSize);
+    for (size_t pos = 0; pos < length; pos += blockSize)
+        synth.process(&out[pos], blockSize);
+    out.resize(length);
+    return out;
+}
+
+void SonotAudioTest::testEventTiming_data()
+{
+    QTest::addColumn<int>("blockSize");
+
+    QTest::newRow("1") << 1;
+    QTest::newRow("64") << 64;
+    QTest::newRow("256") << 256;
+    QTest::newRow("1000") << 1000;
+    QTest::newRow("4097") << 4097;
+}
+
+void SonotAudioTest::testEventTiming()
+{
+    QFETCH(int, blockSize);
+
+    const auto ref = renderSchedule(20000),
+               out = renderSchedule(blockSize);
+
+    // nothing before the first note
+    for (size_t i=0; i<=1000; ++i)
+        QCOMPARE(out[i], 0.f);
+    QVERIFY(out[1001] != 0.f);
+
+    // independent of the block size
+    for (size_t i=0; i<ref.size(); ++i)
+        QVERIFY(std::abs(out[i] - ref[i]) < 1e-6);
+}
+
+
+void SonotAudioTest::testVoiceAllocator_data()
+{
+    QTest::addColumn<int>("numVoices");
+
+    QTest::newRow("1") << 1;
+    QTest::newRow("65") << 65;
+    QTest::newRow("1024") << 1024;
+}
+
+void SonotAudioTest::testVoiceAllocator()
+{
+    QFETCH(int, numVoices);
+    const size_t num = numVoices,
+                 invalid = SynthVoiceAllocator::invalidIndex();
+
+    SynthVoiceAllocator alloc;
+    alloc.resize(num);
+
+    // plain copy of the state to compare against
+    std::vector<bool> used(num, false);
+    std::vector<int> note(num), rank(num);
+    std::vector<double> value(num);
+
+    srand(3);
+    for (int it = 0; it < 20000; ++it)
+    {
+        const size_t v = rand() % num;
+        switch (rand() % 3)
+        {
+            case 0:
+            {
+                size_t expect = invalid;
+                for (size_t i=0; i<num && expect == invalid; ++i)
+                    if (!used[i])
+                        expect = i;
+                const size_t f = alloc.takeFree();
+                QCOMPARE(f, expect);
+                if (f != invalid)
+                {
+                    used[f] = true;
+                    note[f] = rand() % 20;
+                    rank[f] = -(rand() % 4);
+                    value[f] = rand() % 5;
+                    alloc.use(f, note[f], note[f] / 2, rank[f], value[f]);
+                }
+            }
+            break;
+
+            case 1:
+                if (used[v])
+                {
+                    used[v] = false;
+                    alloc.release(v);
+                }
+            break;
+
+            case 2:
+                if (used[v])
+                {
+                    rank[v] = -(rand() % 4);
+                    value[v] = rand() % 5;
+                    alloc.setKey(v, rank[v], value[v]);
+                }
+            break;
+        }
+
+        // steal order
+        size_t best = invalid;
+        for (size_t i=0; i<num; ++i)
+            if (used[i] && (best == invalid || rank[i] < rank[best]
+                    || (rank[i] == rank[best] && value[i] < value[best])))
+                best = i;
+        QCOMPARE(alloc.top(), best);
+
+        // note and user index lookup
+        const int n = rand() % 20;
+        size_t count = 0, countIdx = 0;
+        alloc.forEachNote(n, [&](size_t i)
+        {
+            QVERIFY(used[i] && note[i] == n);
+            ++count;
+        });
+        alloc.forEachUserIndex(n / 2, [&](size_t i)
+        {
+            QVERIFY(used[i] && note[i] / 2 == n / 2);
+            ++countIdx;
+        });
+        size_t expect = 0, expectIdx = 0;
+        for (size_t i=0; i<num; ++i)
+            if (used[i])
+            {
+                expect += note[i] == n;
+                expectIdx += note[i] / 2 == n / 2;
+            }
+        QCOMPARE(count, expect);
+        QCOMPARE(countIdx, expectIdx);
+    }
+}
+
+
+void SonotAudioTest::setupSynth(Synth& synth, int config)
+{
+    auto p = synth.props();
+    // no random detune
+    p.set("unisono-detune", 0.);
+    if (config == 1)
+    {
+        p.set("real-unisono", false);
+        p.set("unisono-note-step", 7);
+        p.set("number-mod-voices", 2u);
+    }
+    if (config == 2)
+    {
+        p.set("number-voices", 8u);
+        p.set("voice-policy", (int)Synth::VP_LOWEST);
+        p.set("attack", .05);
+        p.set("release", .3);
+        p.set("number-mod-voices", 1u);
+    }
+    if (config == 3)
+    {
+        p.set("number-unisono-voices", 1u);
+        p.set("base-freq", 415.);
+        p.set("sustain", .3);
+        p.set("volume", .7);
+    }
+    synth.setProperties(p);
+
+    for (size_t i=0; i<synth.numberModVoices(); ++i)
+    {
+        auto m = synth.modProps(i);
+        m.set("mod-fm", 0.002 * (i + 1));
+        m.set("mod-am", .2);
+        m.set("freq-mul", 1.5 + i);
+        m.set("volume", .8);
+        m.set("mod-self-pm", .1);
+        synth.setModProperties(i, m);
+    }
+}
+
+void SonotAudioTest::testParameters()
+{
+    for (int config = 0; config < 4; ++config)
+    {
+        Synth synth;
+        setupSynth(synth, config);
+
+        const Synth::Parameters& q = synth.parameters();
+        const auto& p = synth.props();
+        QCOMPARE(q.numberVoices, size_t(p.get("number-voices").toUInt()));
+        QCOMPARE(int(q.voicePolicy), p.get("voice-policy").toInt());
+        QCOMPARE(q.numberModVoices, size_t(p.get("number-mod-voices").toUInt()));
+        QCOMPARE(q.combinedUnison, !p.get("real-unisono").toBool());
+        QCOMPARE(q.unisonVoices, size_t(p.get("number-unisono-voices").toUInt()));
+        QCOMPARE(q.unisonNoteStep, p.get("unisono-note-step").toInt());
+        QCOMPARE(q.volume, p.get("volume").toDouble());
+        QCOMPARE(q.attack, p.get("attack").toDouble());
+        QCOMPARE(q.sustain, p.get("sustain").toDouble());
+        QCOMPARE(q.release, p.get("release").toDouble());
+        QCOMPARE(q.baseFreq, p.get("base-freq").toDouble());
+
+        QCOMPARE(q.mods.size(), q.numberModVoices);
+        for (size_t i=0; i<q.mods.size(); ++i)
+        {
+            const auto& m = synth.modProps(i);
+            QCOMPARE(q.mods[i].amount, m.get("volume").toDouble());
+            QCOMPARE(q.mods[i].am, m.get("mod-am").toDouble());
+            QCOMPARE(q.mods[i].fm, m.get("mod-fm").toDouble());
+            QCOMPARE(q.mods[i].freqMul, m.get("freq-mul").toDouble());
+            QCOMPARE(q.mods[i].selfPm, m.get("mod-self-pm").toDouble());
+        }
+    }
+}
+
+void SonotAudioTest::testRenderUnchanged_data()
+{
+    QTest::addColumn<int>("config");
+    QTest::addColumn<double>("energy");
+    QTest::addColumn<double>("absSum");
+
+    // rendered with the QVariant based implementation
+    QTest::newRow("default") << 0 << 1378.37579 << 3671.15137;
+    QTest::newRow("combined fm") << 1 << 7772.08965 << 9856.1167;
+    QTest::newRow("8 voices") << 2 << 91.6207413 << 1032.13665;
+    QTest::newRow("no unisono") << 3 << 1131.1228 << 3786.36103;
+}
+
+void SonotAudioTest::testRenderUnchanged()
+{
+    QFETCH(int, config);
+    QFETCH(double, energy);
+    QFETCH(double, absSum);
+
+    Synth synth;
+    setupSynth(synth, config);
+
+    for (int n=0; n<24; ++n)
+        synth.noteOnAt(48 + (n * 5) % 24, .3, n * 700, n % 4);
+    for (int n=0; n<8; ++n)
+        synth.noteOffByIndexAt(n % 4, 1500 + n * 1900);
+
+    std::vector<float> out(20000);
+    for (size_t pos = 0; pos < out.size(); pos += 500)
+        synth.process(&out[pos], 500);
+
+    double e = 0., a = 0.;
+    for (float f : out)
+    {
+        e += f * f;
+        a += std::abs(f);
+    }
+    QVERIFY(std::abs(e - energy) < energy * 1e-6);
+    QVERIFY(std::abs(a - absSum) < absSum * 1e-6);
+}
+
+
+void SonotAudioTest::testNoAllocation_data()
+{
+    QTest::addColumn<int>("config");
+
+    QTest::newRow("default") << 0;
+    QTest::newRow("combined fm") << 1;
+    QTest::newRow("8 voices") << 2;
+}
+
+void SonotAudioTest::testNoAllocation()
+{
+    if (!AllocationGuard::isEnabled())
+        QSKIP("needs SONOT_ALLOCATION_GUARD");
+
+    QFETCH(int, config);
+
+    Synth synth;
+    setupSynth(synth, config);
+
+    const size_t len = 256;
+    std::vector<float> buf(len);
+    std::vector<std::vector<float>> channels(
+                synth.numberVoices(), std::vector<float>(len));
+    std::vector<float*> outputs;
+    for (auto& c : channels)
+        outputs.push_back(c.data());
+
+    SynthEventQueue queue;
+    queue.reserve(8);
+
+    AllocationGuard::resetViolations();
+    {
+        AllocationGuard guard;
+        // enough notes to steal voices
+        for (int b = 0; b < 1000; ++b)
+        {
+            for (int k = 0; k < 3; ++k)
+                synth.noteOn(40 + (b * 7 + k) % 30, .2,
+                             (b * 13 + k * 50) % len, b % 7);
+            synth.noteOffByIndex((b + 3) % 7, (b * 5) % 300);
+            if (b % 50 == 0)
+                synth.notesOff(10);
+            if (b % 2)
+                synth.process(buf.data(), len);
+            else
+                synth.process(outputs.data(), len);
+        }
+
+        // each earlier stop leaves a live event of the same voice
+        for (int b = 0; b < 100; ++b)
+        {
+            for (size_t k = 0; k < synth.numberVoices(); ++k)
+                synth.noteOn(40 + k, .2, len + k);
+            for (int k = 100; k > 0; --k)
+                synth.notesOff(len * 2 + k);
+            synth.process(buf.data(), len);
+        }
+
+        // a queue full of live events
+        for (size_t i = 0; i < 20; ++i)
+            queue.push(i, i, 0, SynthEventQueue::E_START);
+    }
+    QCOMPARE(AllocationGuard::violations(), size_t(0));
+    QCOMPARE(queue.size(), size_t(8));
+    QCOMPARE(queue.numDropped(), size_t(12));
+    QCOMPARE(queue.top().voice, size_t(0));
+    QCOMPARE(synth.numDroppedEvents(), size_t(0));
+}
+
+void SonotAudioTest::testDeviceNoAllocation()
+{
+    if (!AllocationGuard::isEnabled())
+        QSKIP("needs SONOT_ALLOCATION_GUARD");
+
+    SynthDevice dev;
+    std::vector<char> data(dev.blockSize() * sizeof(float) * 3);
+
+    // property changes are allowed to allocate
+    auto p = dev.synth().props();
+    p.set("number-voices", 12u);
+    dev.setSynthProperties(p);
+
+    AllocationGuard::resetViolations();
+    for (int i = 0; i < 100; ++i)
+    {
+        dev.playNote(50 + i % 20, .1);
+        QCOMPARE(dev.readData(data.data(), data.size()),
+                 qint64(data.size()));
+    }
+    QCOMPARE(AllocationGuard::violations(), size_t(0));
+}
+
+
+void SonotAudioTest::testDeviceBlockSize()
+{
+    // same blocks, different request sizes
+    SynthDevice dev[2];
+    std::vector<float> out[2];
+    const size_t request[2] = { 100, 3000 };
+    for (int i = 0; i < 2; ++i)
+    {
+        dev[i].setBlockSize(500);
+        QCOMPARE(dev[i].blockSize(), size_t(512));
+        dev[i].playNote(50, .2);
+
+        std::vector<float> data(request[i]);
+        while (out[i].size() < 30000)
+        {
+            const qint64 len = data.size() * sizeof(float);
+            QCOMPARE(dev[i].readData(reinterpret_cast<char*>(data.data()),
+                                     len), len);
+            out[i].insert(out[i].end(), data.begin(), data.end());
+        }
+        out[i].resize(30000);
+    }
+    QVERIFY(out[0] == out[1]);
+
+    float peak = 0.f;
+    for (float f : out[0])
+        peak = std::max(peak, std::abs(f));
+    QVERIFY(peak > 0.f);
+}
+
+void SonotAudioTest::testDeviceRenderThread()
+{
+    SynthDevice dev;
+    dev.setBlockSize(256);
+    dev.setLookahead(4096);
+    QCOMPARE(dev.lookahead(), size_t(4096));
+    dev.playNote(50, .2);
+    dev.setRenderThread(true);
+    QVERIFY(dev.isRenderThread());
+
+    std::vector<float> data(1000);
+    const qint64 len = data.size() * sizeof(float);
+    float peak = 0.f;
+    for (int i = 0; i < 50; ++i)
+    {
+        QTest::qWait(2);
+        // always serves the full request, with silence on underrun
+        QCOMPARE(dev.readData(reinterpret_cast<char*>(data.data()), len),
+                 len);
+        for (float f : data)
+            peak = std::max(peak, std::abs(f));
+    }
+    QVERIFY(peak > 0.f);
+
+    const SynthDevice::BufferStats s = dev.bufferStats();
+    QCOMPARE(s.lookahead, size_t(4096));
+    QVERIFY(s.lowWatermark <= s.highWatermark);
+    QVERIFY(s.highWatermark <= s.capacity);
+    QVERIFY(s.underrunSamples >= s.underruns);
+
+    // renders inline again
+    dev.setRenderThread(false);
+    QVERIFY(!dev.isRenderThread());
+    QCOMPARE(dev.readData(reinterpret_cast<char*>(data.data()), len), len);
+    QCOMPARE(dev.bufferStats().underruns, s.underruns);
+
+    // toggle while the audio thread pulls
+    std::atomic<bool> quit(false);
+    std::atomic<int> shortReads(0);
+    std::thread audio([&]()
+    {
+        std::vector<float> buf(256);
+        const qint64 blen = buf.size() * sizeof(float);
+        while (!quit)
+            if (dev.readData(reinterpret_cast<char*>(buf.data()), blen) != blen)
+                ++shortReads;
+    });
+    for (int i = 0; i < 200; ++i)
+    {
+        dev.setRenderThread(i % 2 == 0);
+        dev.playNote(50 + i % 12, .05);
+    }
+    quit = true;
+    audio.join();
+    QCOMPARE(shortReads.load(), 0);
+    QVERIFY(!dev.isRenderThread());
+}
+
+void SonotAudioTest::testDeviceScoreEdit()
+{
+    Score score;
+    for (int st = 0; st < 3; ++st)
+    {
+        NoteStream stream;
+        for (int b = 0; b < 4; ++b)
+        {
+            Notes notes(4);
+            for (size_t c = 0; c < notes.length(); ++c)
+                notes.setNote(c, Note(Note::Name(c % 7), 4));
+            stream.appendBar(notes);
+        }
+        score.appendNoteStream(stream);
+    }
+
+    SynthDevice dev;
+    dev.setBlockSize(64);
+    dev.setScore(&score);
+    dev.setIndex(score.index(0,0,0,0));
+    dev.setPlaying(true);
+    dev.setRenderThread(true);
+
+    // the render thread only sees the timelines and sample positions
+    std::vector<float> data(256);
+    const qint64 len = data.size() * sizeof(float);
+    for (int i = 0; i < 200; ++i)
+    {
+        NoteStream& stream = score.noteStream(i % score.numNoteStreams());
+        if (i % 3 == 0 && stream.numBars() > 1)
+            stream.removeBar(stream.numBars() - 1);
+        else
+        {
+            Notes notes(2 + i % 5);
+            for (size_t c = 0; c < notes.length(); ++c)
+                notes.setNote(c, Note(Note::Name((i + c) % 7), 4));
+            stream.appendBar(notes);
+        }
+        dev.updateStreams(QList<Score::Index>()
+                          << score.index(i % score.numNoteStreams(), 0,0,0));
+
+        if (i % 50 == 25)
+        {
+            score.removeNoteStream(score.numNoteStreams() - 1);
+            score.appendNoteStream(NoteStream(score.noteStream(0)));
+            dev.updateScore();
+        }
+
+        dev.setIndex(score.index(i % score.numNoteStreams(),
+                                 i % 2, 0, i % 4));
+        QCOMPARE(dev.readData(reinterpret_cast<char*>(data.data()), len),
+                 len);
+    }
+    dev.setRenderThread(false);
+
+    // inline rendering applies the last commands
+    QCOMPARE(dev.readData(reinterpret_cast<char*>(data.data()), len), len);
+    QVERIFY(dev.playSecond() <= dev.timeline().toSeconds(
+                                    dev.timeline().length()));
+}
+
+void SonotAudioTest::testThreadsBitIdentical_data()
+{
+    QTest::addColumn<int>("threads");
+    QTest::addColumn<bool>("multiChannel");
+
+    for (int t : { 2, 3, 8 })
+    {
+        QTest::newRow(QString("%1 mono").arg(t).toUtf8().constData())
+                << t << false;
+        QTest::newRow(QString("%1 multi").arg(t).toUtf8().constData())
+                << t << true;
+    }
+}
+
+void SonotAudioTest::testThreadsBitIdentical()
+{
+    QFETCH(int, threads);
+    QFETCH(bool, multiChannel);
+
+    const size_t len = 512, numVoices = 128;
+
+    std::vector<float> ref;
+    for (int t : { 1, threads })
+    {
+        Synth synth;
+        setupSynth(synth, 1);
+        auto p = synth.props();
+        p.set("real-unisono", true);
+        p.set("number-voices", uint(numVoices));
+        p.set("number-threads", t);
+        synth.setProperties(p);
+
+        std::vector<float> out, buf(len);
+        std::vector<std::vector<float>> channels(
+                    numVoices, std::vector<float>(len));
+        std::vector<float*> outputs;
+        for (auto& c : channels)
+            outputs.push_back(c.data());
+
+        for (int b = 0; b < 100; ++b)
+        {
+            for (int k = 0; k < 4; ++k)
+                synth.noteOn(36 + (b * 7 + k * 5) % 48, .1,
+                             (b * 31 + k * 100) % len, b % 13);
+            synth.noteOffByIndex((b + 5) % 13, (b * 17) % len);
+
+            if (!multiChannel)
+                synth.process(buf.data(), len);
+            else
+            {
+                synth.process(outputs.data(), len);
+                for (size_t i=0; i<len; ++i)
+                {
+                    buf[i] = 0.f;
+                    for (auto& c : channels)
+                        buf[i] += c[i];
+                }
+            }
+            out.insert(out.end(), buf.begin(), buf.end());
+        }
+
+        if (t == 1)
+            ref.swap(out);
+        else
+            for (size_t i=0; i<ref.size(); ++i)
+                QCOMPARE(out[i], ref[i]);
+    }
+}
+
+
+void SonotAudioTest::testFmKernels_data()
+{
+    QTest::addColumn<int>("numOps");
+
+    for (int ops = 1; ops <= 5; ++ops)
+        QTest::newRow(QString("%1 ops").arg(ops).toUtf8().constData())
+                << ops;
+}
+
+void SonotAudioTest::testFmKernels()
+{
+    QFETCH(int, numOps);
+
+    const size_t len = SynthVoiceBank::blockSize();
+
+    // every combination of routes on every modulator
+    for (unsigned routes = 0; routes < 32; ++routes)
+    {
+        // voice 0 uses the selected kernel, voice 1 the generic one
+        SynthVoiceBank bank;
+        bank.oscillator = Oscillator::OT_POLY;
+        bank.resize(2);
+        bank.reserveUnison(2);
+        bank.setModStride(numOps);
+        for (size_t v = 0; v < 2; ++v)
+        {
+            bank.numUnison[v] = 2;
+            bank.freq[v] = 220.;
+            bank.setFreqC(v, 0, 220. / 44100.);
+            bank.setFreqC(v, 1, 221. / 44100.);
+            SynthVoiceBank::FMVoice * f = bank.fmOf(v);
+            for (int m = 0; m < numOps; ++m, ++f)
+            {
+                f->env.setSampleRate(44100);
+                f->env.setAttack(.01);
+                f->env.setDecay(.1);
+                f->env.setSustain(.5);
+                f->env.setRelease(.2);
+                f->env.trigger();
+                f->velo = .8;
+                f->freqMul = 1.5 + m;
+                f->phase = 0;
+                f->modAm = routes & SynthVoiceBank::R_AM ? .3 : 0.;
+                f->modFreq = routes & SynthVoiceBank::R_FM ? .002 : 0.;
+                f->modPhase = routes & SynthVoiceBank::R_PM ? .4 : 0.;
+                f->modAdd = routes & SynthVoiceBank::R_ADD ? .2 : 0.;
+                const bool self = routes & SynthVoiceBank::R_SELF;
+                f->modSelfPhase = self ? .1 : 0.;
+                f->modSelfFreq = self ? .001 : 0.;
+                f->modSelfAm = self ? .2 : 0.;
+            }
+        }
+        bank.selectKernel(0);
+        QCOMPARE(bank.routesOf(0), routes);
+        bank.kernel[1] = &SynthVoiceBank::calcBlockFm<0, SynthVoiceBank::R_ALL>;
+
+        std::vector<double> out0(len), out1(len);
+        for (int b = 0; b < 20; ++b)
+        {
+            bank.calcBlock(0, out0.data(), len);
+            bank.calcBlock(1, out1.data(), len);
+            for (size_t i = 0; i < len; ++i)
+                QCOMPARE(out0[i], out1[i]);
+        }
+    }
+}
+
+void SonotAudioTest::testLongSustain()
+{
+    // one hour of a sustained 440 Hz oscillator,
+    // the first and last ten seconds are timed
+    const uint64_t sr = 44100, freq = 440,
+                   block = SynthVoiceBank::blockSize(),
+                   len = sr * 3600 / block * block,
+                   timed = sr * 10 / block * block;
+
+    SynthVoiceBank bank;
+    bank.oscillator = Oscillator::OT_SIMD;
+    bank.resize(1);
+    bank.numUnison[0] = 1;
+    bank.setFreqC(0, 0, double(freq) / sr);
+
+    std::vector<double> out(block);
+    QElapsedTimer timer;
+    qint64 first = 0, last = 0;
+    for (uint64_t pos = 0; pos < len; pos += block)
+    {
+        if (pos == 0 || pos == len - timed)
+            timer.start();
+        bank.calcBlock(0, out.data(), block);
+        if (pos + block == timed)
+            first = timer.nsecsElapsed();
+    }
+    last = timer.nsecsElapsed();
+
+    // the phase of sample n is exactly (n+1) * freq / sr periods
+    double maxErr = 0.;
+    for (size_t k = 0; k < block; ++k)
+    {
+        const uint64_t n = len - block + k + 1;
+        const double ref = std::sin(double((n * freq) % sr) / sr
+                                    * 6.283185307179586476925);
+        maxErr = std::max(maxErr, std::abs(out[k] - ref));
+    }
+    qDebug() << "error after one hour" << maxErr
+             << "ns/sample first" << double(first) / timed
+             << "last" << double(last) / timed;
+    QVERIFY(maxErr < Oscillator::maxError(Oscillator::OT_SIMD) + 1e-9);
+    // generous, to not depend on the machine's load
+    QVERIFY(last < first * 4);
+}
+
+void SonotAudioTest::testEnvelopeBlock_data()
+{
+    QTest::addColumn<int>("blockSize");
+    QTest::addColumn<double>("sustain");
+
+    for (int b : { 1, 7, 64, 1000 })
+    {
+        QTest::newRow(QString("%1 sustain").arg(b).toUtf8().constData())
+                << b << .4;
+        QTest::newRow(QString("%1 no sustain").arg(b).toUtf8().constData())
+                << b << 0.;
+    }
+}
+
+void SonotAudioTest::testEnvelopeBlock()
+{
+    QFETCH(int, blockSize);
+    QFETCH(double, sustain);
+
+    const int len = 30000, releaseAt = 12345;
+
+    EnvelopeGenerator<double> ref, env;
+    for (auto e : { &ref, &env })
+    {
+        e->setAttack(.03);
+        e->setDecay(.2);
+        e->setSustain(sustain);
+        e->setRelease(.1);
+        e->trigger();
+    }
+
+    std::vector<double> out(len);
+    for (int i = 0; i < len; )
+    {
+        if (i == releaseAt)
+            env.setState(ENV_RELEASE);
+        int num = std::min(blockSize, len - i);
+        if (i < releaseAt)
+            num = std::min(num, releaseAt - i);
+        env.process(&out[i], num);
+        i += num;
+    }
+
+    for (int i = 0; i < len; ++i)
+    {
+        if (i == releaseAt)
+            ref.setState(ENV_RELEASE);
+        const double r = ref.next();
+        // same segment ends
+        QCOMPARE(r == 0., out[i] == 0.);
+        QVERIFY(std::abs(out[i] - r) < 1e-9);
+    }
+    QCOMPARE(env.active(), ref.active());
+    QCOMPARE(env.state(), ref.state());
+}
+
+
+void SonotAudioTest::testEnvelopeRate()
+{
+    // 48000 / 256, the modulator envelope rate at the largest
+    // control rate, is not an integer
+    EnvelopeGenerator<double> a, b;
+    a.setSampleRate(48000. / 256);
+    QCOMPARE(a.sampleRate(), 187.5);
+    a.setAttack(1.);
+    a.setDecay(2.);
+    a.setSustain(.5);
+    // same times in samples
+    b.setSampleRate(375.);
+    b.setAttack(.5);
+    b.setDecay(1.);
+    b.setSustain(.5);
+
+    a.trigger();
+    b.trigger();
+    for (int i = 0; i < 1000; ++i)
+        QCOMPARE(a.next(), b.next());
+    QCOMPARE(a.state(), ENV_SUSTAIN);
+}
+
+void SonotAudioTest::testControlRamp()
+{
+    const size_t rate = 16, len = 4410;
+
+    SynthControl ctl;
+    ctl.setRate(rate);
+    ctl.setSampleRate(44100);
+    ctl.setTargets(1., 0., 0., 6., .05, true);
+
+    std::vector<double> gain(len), pitch(len);
+    ctl.render(gain.data(), pitch.data(), 100);
+    for (size_t i = 0; i < 100; ++i)
+        QCOMPARE(gain[i], 1.);
+    QVERIFY(!ctl.hasPitch());
+
+    // 50ms ramp down to .5
+    ctl.setTargets(.5, 0., 0., 6., .05, false);
+    ctl.render(gain.data(), pitch.data(), len);
+    for (size_t i = 1; i < len; ++i)
+        QVERIFY(gain[i] <= gain[i-1]);
+    QVERIFY(gain[0] > .99);
+    QVERIFY(gain[2205 - rate] > .5);
+    QCOMPARE(gain[2205 + 2 * rate], .5);
+    QCOMPARE(gain[len - 1], .5);
+
+    // vibrato stays within +/- 100 cents
+    ctl.setTargets(.5, 0., 100., 6., 0., false);
+    ctl.render(gain.data(), pitch.data(), len);
+    QVERIFY(ctl.hasPitch());
+    double mi = 2., ma = 0.;
+    for (double q : pitch)
+    {
+        mi = std::min(mi, q);
+        ma = std::max(ma, q);
+    }
+    QVERIFY(mi >= std::pow(2., -1./12.) - 1e-9);
+    QVERIFY(ma <= std::pow(2., 1./12.) + 1e-9);
+    QVERIFY(ma - mi > .1);
+}
+
+void SonotAudioTest::testControlRate_data()
+{
+    QTest::addColumn<int>("controlRate");
+
+    QTest::newRow("1") << 1;
+    QTest::newRow("16") << 16;
+    QTest::newRow("32") << 32;
+}
+
+void SonotAudioTest::testControlRate()
+{
+    QFETCH(int, controlRate);
+
+    const size_t len = 30000;
+
+    // same output for any block size
+    std::vector<float> ref;
+    for (size_t blockSize : { 1000, 60, 7 })
+    {
+        srand(1);
+        Synth synth;
+        auto p = synth.props();
+        p.set("unisono-detune", 0.);
+        p.set("number-mod-voices", 2u);
+        p.set("control-rate", controlRate);
+        p.set("lfo-amp", .5);
+        p.set("lfo-pitch", 30.);
+        p.set("ramp-time", .1);
+        synth.setProperties(p);
+
+        for (int n = 0; n < 10; ++n)
+            synth.noteOnAt(48 + n * 3, .3, n * 900, n);
+
+        std::vector<float> out(len);
+        for (size_t pos = 0; pos < len; pos += blockSize)
+        {
+            // change ramped parameters at sample 15050
+            if (pos <= 15050 && pos + blockSize > 15050)
+            {
+                const size_t n = 15050 - pos;
+                synth.process(&out[pos], n);
+                p.set("volume", .3);
+                p.set("lfo-amp", 0.);
+                synth.setProperties(p);
+                synth.process(&out[pos + n], std::min(blockSize, len - pos) - n);
+            }
+            else
+                synth.process(&out[pos], std::min(blockSize, len - pos));
+        }
+
+        if (ref.empty())
+            ref.swap(out);
+        else
+            for (size_t i = 0; i < len; ++i)
+                QCOMPARE(out[i], ref[i]);
+    }
+}
+
+
+void SonotAudioTest::testSilenceCulling_data()
+{
+    QTest::addColumn<double>("level");
+    QTest::addColumn<bool>("culled");
+
+    QTest::newRow("-40 dB") << -40. << true;
+    QTest::newRow("-60 dB") << -60. << true;
+    QTest::newRow("off") << -200. << false;
+}
+
+void SonotAudioTest::testSilenceCulling()
+{
+    QFETCH(double, level);
+    QFETCH(bool, culled);
+
+    const size_t len = 44100 * 4;
+
+    // the last audible sample must not depend on the block size
+    size_t lastSample = 0;
+    for (size_t blockSize : { 1000, 64, 7 })
+    {
+        Synth synth;
+        auto p = synth.props();
+        p.set("number-unisono-voices", 1u);
+        p.set("release", 4.);
+        p.set("silence-level", level);
+        synth.setProperties(p);
+
+        bool ended = false;
+        synth.setVoiceEndedCallback([&](SynthVoice*) { ended = true; });
+
+        synth.noteOn(60, .5, 0, 1);
+        synth.noteOffByIndex(1, 1000);
+
+        std::vector<float> out(len);
+        for (size_t pos = 0; pos < len; pos += blockSize)
+            synth.process(&out[pos], std::min(blockSize, len - pos));
+
+        size_t last = len;
+        while (last > 0 && out[last-1] == 0.f)
+            --last;
+
+        // the envelope alone would still be playing
+        QCOMPARE(ended, culled);
+        QCOMPARE(last < len, culled);
+
+        if (!lastSample)
+            lastSample = last;
+        QCOMPARE(last, lastSample);
+    }
+}
+
+void SonotAudioTest::testDenormalGuard()
+{
+#ifdef SONOT_HAVE_MXCSR
+    volatile double tiny = 1e-300, r;
+    {
+        DenormalGuard guard;
+        r = tiny * 1e-10;
+        QCOMPARE(double(r), 0.);
+    }
+    r = tiny * 1e-10;
+    QVERIFY(r != 0.);
+#else
+    QSKIP("no SSE control register");
+#endif
+}
+
+
+void SonotAudioTest::testLoadHysteresis()
+{
+    SynthLoad load;
+    load.setSampleRate(1000);
+    load.setLimits(.8, .5, 1.);
+
+    // 100 samples = 100ms budget per block
+    QVERIFY(!load.update(.07, 100));
+    QCOMPARE(load.quality(), SynthLoad::Q_FULL);
+
+    // one step per block over the limit
+    for (size_t q = 1; q < SynthLoad::numQualities(); ++q)
+    {
+        QVERIFY(load.update(.09, 100));
+        QCOMPARE(size_t(load.quality()), q);
+        QCOMPARE(load.stats().degrades[q], uint64_t(1));
+    }
+    QVERIFY(!load.update(.2, 100));
+    QCOMPARE(load.quality(), SynthLoad::Q_STEAL_VOICES);
+    QCOMPARE(load.stats().overruns, uint64_t(1));
+    QVERIFY(load.stats().maxLoad > 1.99);
+
+    // between the limits nothing happens
+    for (int i = 0; i < 20; ++i)
+        QVERIFY(!load.update(.06, 100));
+    QCOMPARE(load.quality(), SynthLoad::Q_STEAL_VOICES);
+
+    // a second below the low limit raises one step
+    for (int i = 0; i < 9; ++i)
+        QVERIFY(!load.update(.04, 100));
+    // an interruption restarts the hold time
+    QVERIFY(!load.update(.06, 100));
+    for (int i = 0; i < 9; ++i)
+        QVERIFY(!load.update(.04, 100));
+    QVERIFY(load.update(.04, 100));
+    QCOMPARE(load.quality(), SynthLoad::Q_CONTROL_RATE);
+    QCOMPARE(load.stats().recoveries[SynthLoad::Q_STEAL_VOICES], uint64_t(1));
+
+    for (int i = 0; i < 30; ++i)
+        load.update(.04, 100);
+    QCOMPARE(load.quality(), SynthLoad::Q_FULL);
+    for (size_t q = 1; q < SynthLoad::numQualities(); ++q)
+        QCOMPARE(load.stats().recoveries[q], uint64_t(1));
+    QCOMPARE(load.stats().blocks, uint64_t(76));
+
+    // forced steps are not counted
+    load.setQuality(SynthLoad::Q_CHEAP_OSCILLATOR);
+    QCOMPARE(load.stats().degrades[SynthLoad::Q_CHEAP_OSCILLATOR], uint64_t(1));
+    load.resetStats();
+    QCOMPARE(load.quality(), SynthLoad::Q_CHEAP_OSCILLATOR);
+    QCOMPARE(load.stats().blocks, uint64_t(0));
+}
+
+void SonotAudioTest::testQualitySteps()
+{
+    const size_t len = 4410;
+
+    auto render = [=](int unison, int osc, SynthLoad::Quality q,
+                      double velocity)
+    {
+        Synth synth;
+        auto p = synth.props();
+        p.set("number-unisono-voices", unison);
+        p.set("real-unisono", false);
+        p.set("unisono-detune", 30.);
+        p.set("oscillator", osc);
+        p.set("attack", .01);
+        p.set("sustain", 1.);
+        synth.setProperties(p);
+        synth.setQuality(q);
+
+        synth.noteOn(60, velocity);
+        std::vector<float> out(len);
+        synth.process(out.data(), len);
+        return out;
+    };
+
+    // only the first unisono oscillator
+    QVERIFY(render(3, Oscillator::OT_LIBM, SynthLoad::Q_FULL, .5)
+            != render(1, Oscillator::OT_LIBM, SynthLoad::Q_FULL, .5));
+    QVERIFY(render(3, Oscillator::OT_LIBM, SynthLoad::Q_NO_UNISON, .5)
+            == render(1, Oscillator::OT_LIBM, SynthLoad::Q_FULL, .5));
+
+    // cheaper, but still accurate oscillator
+    const std::vector<float>
+            precise = render(1, Oscillator::OT_LIBM, SynthLoad::Q_FULL, .5),
+            cheap = render(1, Oscillator::OT_LIBM,
+                           SynthLoad::Q_CHEAP_OSCILLATOR, .5);
+    QVERIFY(precise != cheap);
+    for (size_t i = 0; i < len; ++i)
+        QVERIFY(std::abs(precise[i] - cheap[i]) < 1e-6);
+
+    // a quiet sustained voice is ended
+    const std::vector<float>
+            quiet = render(1, Oscillator::OT_LIBM, SynthLoad::Q_FULL, .001),
+            stolen = render(1, Oscillator::OT_LIBM,
+                            SynthLoad::Q_STEAL_VOICES, .001);
+    QVERIFY(quiet[len-1] != 0.f);
+    QCOMPARE(stolen[len-1], 0.f);
+}
+
+void SonotAudioTest::testVoicePacks_data()
+{
+    QTest::addColumn<int>("numOps");
+
+    for (int ops = 0; ops <= 5; ++ops)
+        QTest::newRow(QString("%1 ops").arg(ops).toUtf8().constData())
+                << ops;
+}
+
+void SonotAudioTest::testVoicePacks()
+{
+    QFETCH(int, numOps);
+
+    const SynthVoicePack::Isa best = SynthVoicePack::detect();
+    if (best == SynthVoicePack::ISA_NONE)
+        QSKIP("no voice packs on this platform");
+
+    const size_t len = SynthVoiceBank::blockSize();
+    std::vector<double> pitch(len);
+    for (size_t i = 0; i < len; ++i)
+        pitch[i] = 1. + .01 * std::sin(i * .1);
+
+    for (int isa = SynthVoicePack::ISA_SSE2; isa <= best; ++isa)
+    for (unsigned routes = 0; routes < (numOps ? 32u : 1u); ++routes)
+    for (int usePitch = 0; usePitch < 2; ++usePitch)
+    {
+        const size_t lanes = SynthVoicePack::numLanes(SynthVoicePack::Isa(isa));
+
+        // bank 0 renders in packs, bank 1 voice by voice
+        SynthVoiceBank bank[2];
+        for (SynthVoiceBank& b : bank)
+        {
+            b.oscillator = Oscillator::OT_POLY;
+            b.fixedOscillator = Oscillator::OT_SIMD;
+            b.resize(lanes);
+            b.reserveUnison(2);
+            b.setModStride(numOps);
+            for (size_t v = 0; v < lanes; ++v)
+            {
+                b.numUnison[v] = 2;
+                b.freq[v] = 220. + 50. * v;
+                b.setFreqC(v, 0, b.freq[v] / 44100.);
+                b.setFreqC(v, 1, (b.freq[v] + 1.) / 44100.);
+                SynthVoiceBank::FMVoice * f = b.fmOf(v);
+                for (int m = 0; m < numOps; ++m, ++f)
+                {
+                    f->env.setSampleRate(44100);
+                    f->env.setAttack(.01);
+                    f->env.setDecay(.1 + .05 * v);
+                    f->env.setSustain(.5);
+                    f->env.setRelease(.2);
+                    f->env.trigger();
+                    f->setControlRate(v % 2 ? 16 : 1);
+                    f->velo = .8;
+                    f->freqMul = 1.5 + m;
+                    f->phase = uint64_t(v) << 60;
+                    f->sample = 0.;
+                    // the amounts differ, but not the routes
+                    const double amt = 1. + .1 * v;
+                    f->modAm = routes & SynthVoiceBank::R_AM ? .3 * amt : 0.;
+                    f->modFreq = routes & SynthVoiceBank::R_FM ? .002 * amt : 0.;
+                    f->modPhase = routes & SynthVoiceBank::R_PM ? .4 * amt : 0.;
+                    f->modAdd = routes & SynthVoiceBank::R_ADD ? .2 * amt : 0.;
+                    const bool self = routes & SynthVoiceBank::R_SELF;
+                    f->modSelfPhase = self ? .1 * amt : 0.;
+                    // one lane without self-fm
+                    f->modSelfFreq = self && v ? .001 * amt : 0.;
+                    f->modSelfAm = self ? .2 * amt : 0.;
+                }
+                b.selectKernel(v);
+            }
+        }
+
+        std::vector<size_t> voices;
+        for (size_t v = 0; v < lanes; ++v)
+            voices.push_back(v);
+        QVERIFY(SynthVoicePack::canPack(bank[0], voices.data(), lanes));
+
+        std::vector<std::vector<double>> out0(lanes, std::vector<double>(len)),
+                                         out1 = out0;
+        std::vector<double*> ptr;
+        for (auto& o : out0)
+            ptr.push_back(o.data());
+        for (int b = 0; b < 20; ++b)
+        {
+            // odd block sizes, too
+            const size_t num = len - (b % 3) * 9;
+            const double * pi = usePitch ? pitch.data() : nullptr;
+            SynthVoicePack::calcBlock(SynthVoicePack::Isa(isa), bank[0],
+                                      voices.data(), ptr.data(), num, pi);
+            for (size_t v = 0; v < lanes; ++v)
+                bank[1].calcBlock(v, out1[v].data(), num, pi);
+            for (size_t v = 0; v < lanes; ++v)
+                for (size_t i = 0; i < num; ++i)
+                    QCOMPARE(out0[v][i], out1[v][i]);
+        }
+        for (size_t v = 0; v < lanes; ++v)
+            QCOMPARE(bank[0].freq[v], bank[1].freq[v]);
+    }
+}
+
+void SonotAudioTest::testSynthVoicePacks_data()
+{
+    QTest::addColumn<int>("config");
+    QTest::addColumn<bool>("multiChannel");
+
+    for (int config = 0; config < 4; ++config)
+    {
+        QTest::newRow(QString("cfg%1 mono").arg(config).toUtf8().constData())
+                << config << false;
+        QTest::newRow(QString("cfg%1 multi").arg(config).toUtf8().constData())
+                << config << true;
+    }
+}
+
+void SonotAudioTest::testSynthVoicePacks()
+{
+    QFETCH(int, config);
+    QFETCH(bool, multiChannel);
+
+    if (SynthVoicePack::detect() == SynthVoicePack::ISA_NONE)
+        QSKIP("no voice packs on this platform");
+
+    const size_t len = 300, numVoices = 32;
+
+    std::vector<float> ref;
+    for (bool packs : { false, true })
+    {
+        Synth synth;
+        setupSynth(synth, config);
+        auto p = synth.props();
+        p.set("number-voices", uint(numVoices));
+        p.set("voice-packs", packs);
+        // vibrato
+        p.set("lfo-pitch", config % 2 ? 20. : 0.);
+        synth.setProperties(p);
+
+        std::vector<float> out, buf(len);
+        std::vector<std::vector<float>> channels(
+                    numVoices, std::vector<float>(len));
+        std::vector<float*> outputs;
+        for (auto& c : channels)
+            outputs.push_back(c.data());
+
+        for (int b = 0; b < 50; ++b)
+        {
+            for (int k = 0; k < 3; ++k)
+                synth.noteOn(36 + (b * 7 + k * 5) % 48, .1 + .1 * k,
+                             (b * 31 + k * 100) % len, b % 13);
+            synth.noteOffByIndex((b + 5) % 13, (b * 17) % len);
+
+            if (!multiChannel)
+                synth.process(buf.data(), len);
+            else
+            {
+                synth.process(outputs.data(), len);
+                for (size_t i=0; i<len; ++i)
+                {
+                    buf[i] = 0.f;
+                    for (auto& c : channels)
+                        buf[i] += c[i];
+                }
+            }
+            out.insert(out.end(), buf.begin(), buf.end());
+        }
+
+        if (!packs)
+            ref.swap(out);
+        else
+            for (size_t i=0; i<ref.size(); ++i)
+                QCOMPARE(out[i], ref[i]);
+    }
+}
+
+
+void SonotAudioTest::testWavWriter_data()
+{
+    QTest::addColumn<int>("format");
+    QTest::addColumn<int>("channels");
+
+    for (int f = 0; f < 3; ++f)
+        for (int c : { 2, 3 })
+            QTest::newRow(QString("%1 %2ch")
+                          .arg(WavWriter::formatName(WavWriter::Format(f)))
+                          .arg(c).toUtf8().constData()) << f << c;
+}
+
+void SonotAudioTest::testWavWriter()
+{
+    QFETCH(int, format);
+    QFETCH(int, channels);
+
+    const WavWriter::Format f = WavWriter::Format(format);
+    const bool isFloat = f == WavWriter::F_FLOAT;
+    const size_t bps = WavWriter::bytesPerSample(f),
+                 num = 3 * channels;
+    // WAVE_FORMAT_EXTENSIBLE above 2 channels or 16 bits
+    auto headerSize = [&](int numChannels)
+    {
+        const bool ext = numChannels > 2 || bps > 2;
+        return size_t(12 + 8 + (ext ? 40 : isFloat ? 18 : 16)
+                      + (isFloat ? 12 : 0) + 8);
+    };
+    const size_t header = headerSize(channels);
+    // three frames, some samples are clipped
+    const float values[] = { 0.f, .5f, -.25f, 1.f, 2.f, -2.f, .75f, -.5f, .125f };
+    std::vector<float> samples(num);
+    for (size_t i = 0; i < num; ++i)
+        samples[i] = values[i % 9];
+
+    QBuffer buffer;
+    buffer.open(QIODevice::ReadWrite);
+    WavWriter wav;
+    wav.open(&buffer, 48000, channels, f);
+    // written in two calls
+    wav.write(samples.data(), 1);
+    wav.write(samples.data() + channels, 2);
+    QCOMPARE(wav.numFrames(), uint64_t(3));
+    wav.close();
+    QVERIFY(!wav.isOpen());
+
+    const QByteArray data = buffer.data();
+    // little-endian unsigned of @p num bytes
+    auto u32 = [&](int pos, int num = 4)
+    {
+        uint32_t v = 0;
+        for (int i = 0; i < num; ++i)
+            v |= uint32_t(uint8_t(data[pos + i])) << (i * 8);
+        return v;
+    };
+    QCOMPARE(size_t(data.size()), header + num * bps);
+    QCOMPARE(data.mid(0, 4), QByteArray("RIFF"));
+    QCOMPARE(u32(4), uint32_t(data.size() - 8));
+    QCOMPARE(data.mid(8, 8), QByteArray("WAVEfmt "));
+    QCOMPARE(u32(22, 2), uint32_t(channels));
+    QCOMPARE(u32(24), uint32_t(48000));
+    QCOMPARE(u32(28), uint32_t(48000 * channels * bps));
+    QCOMPARE(u32(34, 2), uint32_t(bps * 8));
+    if (channels > 2 || bps > 2)
+    {
+        QCOMPARE(u32(16), uint32_t(40));
+        QCOMPARE(u32(20, 2), uint32_t(0xfffe));
+        // valid bits and the format code of the sub format
+        QCOMPARE(u32(38, 2), uint32_t(bps * 8));
+        QCOMPARE(u32(44, 2), uint32_t(isFloat ? 3 : 1));
+        QCOMPARE(data.mid(46, 14), QByteArray::fromHex(
+                     "000000001000800000aa00389b71"));
+    }
+    else
+        QCOMPARE(u32(20, 2), uint32_t(1));
+    QCOMPARE(data.mid(header - 8, 4), QByteArray("data"));
+    QCOMPARE(u32(header - 4), uint32_t(num * bps));
+
+    for (size_t i = 0; i < num; ++i)
+    {
+        const int pos = header + i * bps;
+        const float x = std::max(-1.f, std::min(1.f, samples[i]));
+        switch (f)
+        {
+            case WavWriter::F_INT16:
+                QCOMPARE(int16_t(u32(pos, 2)), int16_t(std::lrint(x * 32767.f)));
+            break;
+            case WavWriter::F_INT24:
+                QCOMPARE(int32_t(u32(pos, 3) << 8) >> 8,
+                         int32_t(std::lrint(x * 8388607.f)));
+            break;
+            case WavWriter::F_FLOAT:
+            {
+                const uint32_t bits = u32(pos);
+                float y;
+                std::memcpy(&y, &bits, 4);
+                QCOMPARE(y, samples[i]);
+            }
+            break;
+        }
+    }
+
+    // mono, odd sized data is followed by a pad byte
+    QBuffer mono;
+    mono.open(QIODevice::ReadWrite);
+    wav.open(&mono, 48000, 1, f);
+    wav.write(samples.data(), 3);
+    wav.close();
+    const QByteArray odd = mono.data();
+    const size_t size = 3 * bps, monoHeader = headerSize(1);
+    QCOMPARE(size_t(odd.size()), monoHeader + size + (size & 1));
+    QCOMPARE(uint32_t(uint8_t(odd[4])) | uint32_t(uint8_t(odd[5])) << 8,
+             uint32_t(odd.size() - 8));
+    QCOMPARE(uint32_t(uint8_t(odd[monoHeader - 4])), uint32_t(size));
+
+    // the file starts at the device position
+    QBuffer offset;
+    offset.open(QIODevice::ReadWrite);
+    offset.write("abc", 3);
+    wav.open(&offset, 48000, channels, f);
+    wav.write(samples.data(), 3);
+    wav.close();
+    QCOMPARE(offset.data().left(3), QByteArray("abc"));
+    QCOMPARE(offset.data().mid(3), data);
+
+    // more than 4 GiB is refused before anything is written
+    QBuffer large;
+    large.open(QIODevice::ReadWrite);
+    wav.open(&large, 48000, channels, f);
+    bool thrown = false;
+    try
+    {
+        wav.write(samples.data(), size_t(1) << 31);
+    }
+    catch (const QProps::Exception&)
+    {
+        thrown = true;
+    }
+    QVERIFY(thrown);
+    QCOMPARE(wav.numFrames(), uint64_t(0));
+    wav.close();
+    QCOMPARE(size_t(large.data().size()), header);
+}
+
+
+void SonotAudioTest::testParallelRender()
+{
+    Score score;
+    for (int st = 0; st < 3; ++st)
+    {
+        NoteStream stream;
+        auto props = stream.props();
+        props.set("pause-on-end", st == 1);
+        stream.setProperties(props);
+        for (int b = 0; b < 3; ++b)
+        {
+            Bar bar;
+            for (int r = 0; r < 3; ++r)
+            {
+                Notes notes(4);
+                for (int c = 0; c < 4; ++c)
+                    if ((b + c + r) % 3)
+                        notes.setNote(c, Note(Note::Name((st + b + c) % 7),
+                                              2 + r));
+                bar.append(notes);
+            }
+            stream.appendBar(bar);
+        }
+        score.appendNoteStream(stream);
+    }
+
+    Synth synth;
+    auto p = synth.props();
+    // real unisono voices with random detuning
+    p.set("number-unisono-voices", 3u);
+    synth.setProperties(p);
+
+    QByteArray ref;
+    for (size_t threads : { 2, 3, 8 })
+    {
+        SynthRenderer renderer;
+        renderer.setSynth(synth);
+        renderer.setFormat(WavWriter::F_FLOAT);
+        renderer.setMaxTail(2.);
+        renderer.setNumThreads(threads);
+
+        QBuffer buffer;
+        buffer.open(QIODevice::ReadWrite);
+        const SynthRenderer::Stats& stats = renderer.render(score, &buffer);
+
+        // 9 bars and one pause, at least
+        QVERIFY(stats.seconds >= 10. * score.noteStream(0).barLengthSeconds(0));
+        QVERIFY(stats.seconds <= 10. * score.noteStream(0).barLengthSeconds(0)
+                                 + 2.);
+
+        if (ref.isEmpty())
+            ref = buffer.data();
+        else
+            QVERIFY(buffer.data() == ref);
+    }
+}
+
+
+void SonotAudioTest::testSynthSettings()
+{
+    Synth synth;
+    SynthSettings settings;
+    QVERIFY(settings.props() == synth.props());
+    QCOMPARE(settings.sampleRate(), synth.sampleRate());
+
+    // modulator voices follow number-mod-voices
+    auto p = settings.props();
+    p.set("number-mod-voices", 3u);
+    settings.setProperties(p);
+    synth.setProperties(p);
+    QCOMPARE(settings.numberModVoices(), size_t(3));
+    for (size_t i = 0; i < 3; ++i)
+        QVERIFY(settings.modProps(i) == synth.modProps(i));
+
+    p.set("number-mod-voices", 1u);
+    settings.setProperties(p);
+    QCOMPARE(settings.numberModVoices(), size_t(1));
+
+    // same json as the Synth
+    Synth copy;
+    copy.fromJson(SynthSettings(synth).toJson());
+    QVERIFY(copy.props() == synth.props());
+    QCOMPARE(copy.numberModVoices(), size_t(3));
+}
+
+void SonotAudioTest::testSynthBuses()
+{
+    const size_t len = 300;
+
+    // mono, four buses and three buses which mute userIndex 3
+    Synth synth[3];
+    for (Synth& syn : synth)
+    {
+        setupSynth(syn, 0);
+        for (int n=0; n<24; ++n)
+            syn.noteOnAt(48 + (n * 5) % 24, .3, n * 700, n % 4);
+        for (int n=0; n<8; ++n)
+            syn.noteOffByIndexAt(n % 4, 1500 + n * 1900);
+    }
+
+    std::vector<float> mono(len);
+    std::vector<std::vector<float>> bus4(4, std::vector<float>(len)),
+                                    bus3(3, std::vector<float>(len));
+    std::vector<float*> buses4, buses3;
+    for (auto& b : bus4)
+        buses4.push_back(b.data());
+    for (auto& b : bus3)
+        buses3.push_back(b.data());
+
+    for (size_t pos = 0; pos < 20000; pos += len)
+    {
+        synth[0].process(mono.data(), len);
+        synth[1].process(buses4.data(), 4, len);
+        synth[2].process(buses3.data(), 3, len);
+
+        for (size_t i=0; i<len; ++i)
+        {
+            float sum = 0.f;
+            for (auto& b : bus4)
+                sum += b[i];
+            QVERIFY(std::abs(sum - mono[i]) < 1e-5f);
+            for (size_t k=0; k<3; ++k)
+                QCOMPARE(bus3[k][i], bus4[k][i]);
+        }
+    }
+}
+
+
+void SonotAudioTest::testSynthTimeline()
+{
+    Score score;
+    for (int st = 0; st < 3; ++st)
+    {
+        NoteStream stream;
+        auto props = stream.props();
+        props.set("pause-on-end", st == 1);
+        stream.setProperties(props);
+        for (int b = 0; b < 3; ++b)
+        {
+            Bar bar;
+            for (int r = 0; r < 2; ++r)
+            {
+                Notes notes(4);
+                for (int c = 0; c < 4; ++c)
+                    notes.setNote(c, Note(Note::Name((st + b + c) % 7), 3));
+                bar.append(notes);
+            }
+            stream.appendBar(bar);
+        }
+        score.appendNoteStream(stream);
+    }
+
+    SynthTimeline timeline;
+    timeline.compile(score, 44100);
+    QCOMPARE(timeline.streams().size(), size_t(3));
+    QCOMPARE(timeline.bars().size(), size_t(9));
+
+    size_t numEvents = 0;
+    for (size_t i=0; i<timeline.bars().size(); ++i)
+    {
+        const SynthTimeline::Bar& bar = timeline.bars()[i];
+        const SynthTimeline::Events& events = *bar.events;
+        for (size_t k=1; k<events.size(); ++k)
+            QVERIFY(events[k-1].offset <= events[k].offset);
+        numEvents += events.size();
+
+        QCOMPARE(timeline.findBar(timeline.barStart(i)), i);
+        QCOMPARE(timeline.findBar(bar.stream, bar.bar), i);
+        QCOMPARE(timeline.barStart(i + 1),
+                 timeline.barStart(i) + bar.length + bar.pause);
+    }
+    // note-off and note-on per column, note-offs after the pause
+    QCOMPARE(numEvents, size_t(9 * 2 * 4 * 2 + 2));
+
+    // one bar of pause after the second stream
+    const double barLength = score.noteStream(2).barLengthSeconds(0);
+    QCOMPARE(timeline.streamPauseEnd(0), timeline.streamEnd(0));
+    QCOMPARE(timeline.streamStart(1), timeline.streamPauseEnd(0));
+    QCOMPARE(timeline.streamStart(2), timeline.streamPauseEnd(1));
+    QCOMPARE(timeline.streamPauseEnd(1) - timeline.streamEnd(1),
+             uint64_t(barLength * 44100 + .5));
+    QCOMPARE(timeline.length(), timeline.streamEnd(2));
+
+    // the sequencer plays to the end, independent of the block size
+    Synth synth;
+    for (size_t blockSize : { 64, 1000 })
+    {
+        SynthSequencer seq;
+        seq.setLooping(false);
+        seq.setIndex(score.index(0,0,0,0));
+        seq.setTimeline(&timeline);
+
+        uint64_t length = 0;
+        while (!seq.isFinished())
+            length += seq.feed(synth, blockSize);
+        QCOMPARE(length, timeline.length());
+        QCOMPARE(seq.index().stream(), size_t(2));
+        QCOMPARE(seq.index().bar(), size_t(2));
+    }
+
+    // an edited timeline continues at the same position
+    SynthSequencer seq;
+    seq.setIndex(score.index(1,1,0,0));
+    seq.setTimeline(&timeline);
+    QCOMPARE(seq.position(), timeline.barStart(4));
+    seq.feed(synth, 1000);
+    const uint64_t pos = seq.position();
+
+    SynthTimeline edited(timeline);
+    QVERIFY(edited.updateBar(1, 1));
+    seq.updateTimeline(&edited);
+    QCOMPARE(seq.position(), pos);
+    QCOMPARE(seq.index().stream(), size_t(1));
+    QCOMPARE(seq.index().bar(), size_t(1));
+
+    // patched timelines equal a recompiled one
+    NoteStream stream = score.noteStream(0);
+    auto props = stream.props();
+    props.set("bpm", 90.);
+    stream.setProperties(props);
+    const Bar bar = stream.bar(2);
+    stream.insertBar(1, bar);
+    score.setNoteStream(0, stream);
+    score.noteStream(2).setNote(1, 1, 2, Note(Note::C, 5));
+    QVERIFY(edited.updateStream(0));
+    QVERIFY(edited.updateBar(2, 1));
+
+    SynthTimeline compiled;
+    compiled.compile(score, 44100);
+    QCOMPARE(edited.bars().size(), size_t(10));
+    QCOMPARE(edited.length(), compiled.length());
+    for (size_t i=0; i<compiled.bars().size(); ++i)
+    {
+        QCOMPARE(edited.barStart(i), compiled.barStart(i));
+        QCOMPARE(edited.bars()[i].events->size(),
+                 compiled.bars()[i].events->size());
+    }
+}
+
+
+void SonotAudioTest::testSynthTimeMap()
+{
+    Score score;
+    for (int st = 0; st < 2; ++st)
+    {
+        NoteStream stream;
+        auto props = stream.props();
+        props.set("pause-on-end", true);
+        props.set("bpm", 100. + st * 20.);
+        stream.setProperties(props);
+        for (int b = 0; b < 3; ++b)
+        {
+            Notes notes(3 + b);
+            for (size_t c = 0; c < notes.length(); ++c)
+                notes.setNote(c, Note(Note::Name(c % 7), 4));
+            stream.appendBar(notes);
+        }
+        score.appendNoteStream(stream);
+    }
+
+    SynthTimeline timeline;
+    timeline.compile(score, 48000);
+
+    // index -> time -> index
+    for (size_t st = 0; st < 2; ++st)
+    for (size_t b = 0; b < 3; ++b)
+    for (size_t c = 0; c < 3 + b; ++c)
+    {
+        const Score::Index idx = score.index(st, b, 0, c);
+        const uint64_t sample = timeline.indexSample(idx);
+        QVERIFY(timeline.indexAt(sample) == idx);
+        QVERIFY(timeline.indexAt(sample - 1) != idx);
+    }
+    QCOMPARE(timeline.indexSample(score.index(1,0,0,0)),
+             timeline.streamStart(1));
+
+    // the pause belongs to the last column
+    const Score::Index pause = timeline.indexAt(
+                timeline.streamPauseEnd(0) - 1);
+    QCOMPARE(pause.stream(), size_t(0));
+    QCOMPARE(pause.bar(), size_t(2));
+    QCOMPARE(pause.column(), size_t(4));
+
+    // play from a column, one voice per note
+    Synth synth;
+    setupSynth(synth, 3);
+    SynthSequencer seq;
+    seq.setIndex(score.index(0,1,0,2));
+    seq.setTimeline(&timeline);
+    QCOMPARE(seq.position(), timeline.indexSample(score.index(0,1,0,2)));
+    QCOMPARE(seq.index().bar(), size_t(1));
+
+    // play from a time
+    const uint64_t sample = timeline.indexSample(score.index(1,0,0,1));
+    seq.setPosition(timeline.toSample(timeline.toSeconds(sample)));
+    QCOMPARE(seq.position(), sample);
+    QCOMPARE(seq.index().stream(), size_t(1));
+    QCOMPARE(seq.index().bar(), size_t(0));
+
+    std::vector<float> buffer(100);
+    seq.feed(synth, buffer.size());
+    synth.process(buffer.data(), buffer.size());
+    QCOMPARE(synth.numActiveVoices(), size_t(1));
+
+    // the map does not read the score, which may be ahead of it
+    const Score::Index last = score.index(1,2,0,3);
+    const uint64_t lastSample = timeline.indexSample(last);
+    score.noteStream(0).removeRow(0);
+    score.removeNoteStream(1);
+    QCOMPARE(timeline.indexSample(last), lastSample);
+    QVERIFY(timeline.indexAt(lastSample) == last);
+    QCOMPARE(timeline.indexAt(sample).column(), size_t(1));
+}
+
+
+QTEST_APPLESS_MAIN(SonotAudioTest)
+
+#include "SonotAudioTest.moc"
@@ -18,6 +18,8 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 
 ****************************************************************************/
 
+#include <cmath>
+
 #include <QString>
 #include <QtTest>
 
@@ -112,6 +114,8 @@ public:
 private slots:
 
     void testNoteFreq();
+    void testNoteFreqTable();
+    void testTemperaments();
     void testNoteFromString();
     void testNoteFromValue();
     void testNoteTranspose();
@@ -274,6 +278,74 @@ void SonotCoreTest::testNoteFreq()
     abort();
 }
 
+void SonotCoreTest::testNoteFreqTable()
+{
+    // the table is exactly the formula
+    NoteFreq<double> f(12., 440.);
+    const double octPow = std::pow(2., 1. / 12.);
+    for (int i = 0; i < NoteFreq<double>::tableSize(); ++i)
+    {
+        QCOMPARE(f.frequency(i), 440. * std::pow(octPow, i));
+        QCOMPARE(f.range(i), f.frequency(i + 1) - f.frequency(i));
+    }
+    // outside of the table
+    QCOMPARE(f.frequency(-12), 220.);
+    QCOMPARE(f.frequency(200), 440. * std::pow(octPow, 200));
+
+    // changes are picked up
+    f.setBaseFrequency(100.);
+    QCOMPARE(f.frequency(12), 200.);
+    f.setNotesPerOctave(19.);
+    QCOMPARE(f.frequency(19), 200.);
+    f.setNotesPerOctave(12);
+    f.setPythagorean(3, 2);
+    QCOMPARE(f.frequency(7), 150.);
+    QCOMPARE(f.frequency(19), 300.);
+}
+
+void SonotCoreTest::testTemperaments()
+{
+    const double eps = 1e-12;
+
+    NoteFreq<double> f(12., 100.);
+    f.setTemperament(NoteFreq<double>::T_MEANTONE, 3);
+
+    // C stays the base frequency
+    QCOMPARE(f.frequency(0), 100.);
+    QCOMPARE(f.frequency(12), 200.);
+    // pure major thirds C-E, D-F#, E flat-G, E-G#
+    for (int n : { 0, 2, 3, 4 })
+        QVERIFY(std::abs(f.frequency(n + 4) / f.frequency(n) - 1.25) < eps);
+    // meantone fifths up to the wolf between G# and E flat
+    const double fifth = std::pow(5., .25);
+    for (int n : { 3, 10, 5, 0, 7, 2, 9, 4, 11, 6, 1 })
+    {
+        const double r = f.frequency(n + 7) / f.frequency(n);
+        QVERIFY(std::abs(r - fifth) < eps);
+    }
+    QVERIFY(std::abs(f.frequency(3 + 12) / f.frequency(8) - fifth) > .01);
+
+    // pythagorean on D: pure fifths from D to C#
+    f.setTemperament(NoteFreq<double>::T_PYTHAGOREAN, 2);
+    QCOMPARE(f.frequency(0), 100.);
+    for (int n : { 2, 9, 4, 11, 6, 1, 8, 3, 10, 5, 0 })
+    {
+        const double r = f.frequency(n + 7) / f.frequency(n);
+        QVERIFY(std::abs(r - 1.5) < eps);
+    }
+    QVERIFY(std::abs(f.frequency(2 + 12) / f.frequency(7) - 1.5) > .01);
+
+    // only for twelve notes per octave
+    f.setNotesPerOctave(19.);
+    QCOMPARE(f.frequency(19), 200.);
+    QVERIFY(std::abs(f.frequency(1) - 100. * std::pow(2., 1. / 19.)) < eps);
+
+    // back to equal
+    f.setNotesPerOctave(12.);
+    f.setTemperament(NoteFreq<double>::T_RATIO);
+    QVERIFY(std::abs(f.frequency(7) - 100. * std::pow(2., 7. / 12.)) < eps);
+}
+
 
 void SonotCoreTest::testNoteFromString()
 {